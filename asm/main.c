@@ -0,0 +1,956 @@
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+/*
+ * gbda-asm: a small two-pass SM83 assembler that builds the cartridge
+ * images under roms/. It knows the whole instruction set and just enough
+ * directives to lay out a banked ROM, and it fills in a valid header
+ * (logo, title, cartridge type, ROM and RAM sizes, both checksums).
+ *
+ * Syntax, one statement per line, ';' starting a comment:
+ *
+ *   label:                 a global label
+ *   .label:                local to the last global label
+ *   name equ expr          a constant (name = expr works too)
+ *   include "file"         relative to the including file
+ *   bank n                 what follows goes to ROM bank n, from $4000
+ *                          ($0000 for bank 0)
+ *   org addr               set the address within the current bank
+ *   db expr|"string", ...  bytes
+ *   dw expr, ...           little-endian words
+ *   ds count[, fill]       count bytes of fill (default 0)
+ *   title "NAME"           header fields; the ROM size comes from the
+ *   cart type              highest bank used
+ *   ramsize code
+ *
+ * Instructions use the usual Z80-style operands: ld a,(hl+), ldh (n),a,
+ * jr nz,.loop, bit 7,(hl) and so on. Expressions have C operators and
+ * precedence, $hex, %binary, 'c' characters, @ for the current address and
+ * low(), high() and bank() of a label.
+ */
+
+#define MAX_BANKS       128
+#define BANK_SIZE       0x4000
+#define MAX_SYMBOLS     4096
+#define MAX_NAME        64
+#define MAX_LINE        512
+#define MAX_OPERANDS    4
+#define MAX_INCLUDE     8
+
+struct symbol {
+    char name[MAX_NAME];
+    int value;
+    int bank;
+    int pass;       // the pass that last defined it, 0 for never
+};
+
+enum operand_kind {
+    OP_R8,          // b c d e h l (hl) a, reg holds the encoding
+    OP_R16,         // bc de hl sp, and af
+    OP_COND,        // nz z nc; c is an OP_R8 that branches also accept
+    OP_MEM_BC,
+    OP_MEM_DE,
+    OP_MEM_HLI,
+    OP_MEM_HLD,
+    OP_MEM_C,
+    OP_MEM,         // (expr)
+    OP_SP_OFS,      // sp+expr
+    OP_IMM,
+};
+
+struct operand {
+    enum operand_kind kind;
+    int reg;
+    int value;
+};
+
+static struct symbol symbols[MAX_SYMBOLS];
+static int symbol_cnt;
+static uint8_t rom[MAX_BANKS * BANK_SIZE];
+static int pass, bank, pc, top_bank, errors, include_depth;
+static const char *file_name;
+static int line_no;
+static char scope[MAX_NAME];
+static char title[17];
+static int cart_type, ram_size;
+
+static const uint8_t logo[48] = {
+    0xce, 0xed, 0x66, 0x66, 0xcc, 0x0d, 0x00, 0x0b, 0x03, 0x73, 0x00, 0x83,
+    0x00, 0x0c, 0x00, 0x0d, 0x00, 0x08, 0x11, 0x1f, 0x88, 0x89, 0x00, 0x0e,
+    0xdc, 0xcc, 0x6e, 0xe6, 0xdd, 0xdd, 0xd9, 0x99, 0xbb, 0xbb, 0x67, 0x63,
+    0x6e, 0x0e, 0xec, 0xcc, 0xdd, 0xdc, 0x99, 0x9f, 0xbb, 0xb9, 0x33, 0x3e,
+};
+
+static const char *r8_names[] = { "b", "c", "d", "e", "h", "l", "(hl)", "a" };
+static const char *r16_names[] = { "bc", "de", "hl", "sp", "af" };
+static const char *cond_names[] = { "nz", "z", "nc" };
+
+static void error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void error(const char *fmt, ...)
+{
+    va_list ap;
+
+    // everything is reported once, on the second pass
+    if (pass == 1)
+        return;
+    fprintf(stderr, "%s:%d: ", file_name, line_no);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    errors++;
+}
+
+/* Symbols */
+
+static void full_name(char *buf, const char *name)
+{
+    if (name[0] == '.')
+        snprintf(buf, MAX_NAME, "%s%s", scope, name);
+    else
+        snprintf(buf, MAX_NAME, "%s", name);
+}
+
+static struct symbol *symbol_find(const char *name, bool create)
+{
+    char buf[MAX_NAME];
+
+    full_name(buf, name);
+    for (int i = 0; i < symbol_cnt; i++)
+        if (!strcmp(symbols[i].name, buf))
+            return &symbols[i];
+    if (!create)
+        return NULL;
+    if (symbol_cnt == MAX_SYMBOLS) {
+        fprintf(stderr, "too many symbols\n");
+        exit(1);
+    }
+    strcpy(symbols[symbol_cnt].name, buf);
+    return &symbols[symbol_cnt++];
+}
+
+static void symbol_define(const char *name, int value, int sym_bank)
+{
+    struct symbol *sym = symbol_find(name, true);
+
+    if (sym->pass == pass)
+        error("%s defined twice", name);
+    sym->value = value;
+    sym->bank = sym_bank;
+    sym->pass = pass;
+}
+
+/* Expressions, by recursive descent. Symbols not defined yet read as 0 on
+   the first pass; no instruction's size depends on a value. */
+
+static const char *expr_p;
+
+static void skip_space(void)
+{
+    while (isspace((unsigned char)*expr_p))
+        expr_p++;
+}
+
+static bool ident_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+static int expr_parse(int prec);
+
+static int parse_ident(char *buf)
+{
+    int len = 0;
+
+    while (ident_char(*expr_p) && len < MAX_NAME - 1)
+        buf[len++] = *expr_p++;
+    buf[len] = '\0';
+    return len;
+}
+
+static int expr_primary(void)
+{
+    char name[MAX_NAME];
+    struct symbol *sym;
+    int value = 0;
+
+    skip_space();
+    switch (*expr_p) {
+    case '(':
+        expr_p++;
+        value = expr_parse(0);
+        skip_space();
+        if (*expr_p != ')')
+            error("missing )");
+        else
+            expr_p++;
+        return value;
+    case '-':
+        expr_p++;
+        return -expr_primary();
+    case '+':
+        expr_p++;
+        return expr_primary();
+    case '~':
+        expr_p++;
+        return ~expr_primary();
+    case '!':
+        expr_p++;
+        return !expr_primary();
+    case '@':
+        expr_p++;
+        return pc;
+    case '$':
+        expr_p++;
+        return strtol(expr_p, (char **)&expr_p, 16);
+    case '%':
+        expr_p++;
+        return strtol(expr_p, (char **)&expr_p, 2);
+    case '\'':
+        value = (unsigned char)expr_p[1];
+        if (expr_p[1] && expr_p[2] == '\'')
+            expr_p += 3;
+        else
+            error("bad character constant");
+        return value;
+    }
+    if (isdigit((unsigned char)*expr_p))
+        return strtol(expr_p, (char **)&expr_p, 0);
+    if (!ident_char(*expr_p)) {
+        error("expression expected at '%s'", expr_p);
+        return 0;
+    }
+    parse_ident(name);
+    skip_space();
+    if (*expr_p == '(' && (!strcasecmp(name, "low") || !strcasecmp(name, "high") ||
+                           !strcasecmp(name, "bank"))) {
+        expr_p++;
+        if (!strcasecmp(name, "bank")) {
+            skip_space();
+            parse_ident(name);
+            sym = symbol_find(name, false);
+            value = (sym) ? sym->bank : 0;
+            if (!sym && pass == 2)
+                error("undefined symbol %s", name);
+        } else {
+            value = expr_parse(0);
+            value = (!strcasecmp(name, "low")) ? value & 0xff : (value >> 8) & 0xff;
+        }
+        skip_space();
+        if (*expr_p != ')')
+            error("missing )");
+        else
+            expr_p++;
+        return value;
+    }
+    sym = symbol_find(name, false);
+    if (sym && sym->pass)
+        return sym->value;
+    if (pass == 2)
+        error("undefined symbol %s", name);
+    return 0;
+}
+
+static const struct {
+    const char *op;
+    int prec;
+} binary_ops[] = {
+    { "||", 1 }, { "&&", 2 }, { "|", 3 }, { "^", 4 }, { "&", 5 },
+    { "==", 6 }, { "!=", 6 }, { "<=", 7 }, { ">=", 7 }, { "<<", 8 },
+    { ">>", 8 }, { "<", 7 }, { ">", 7 }, { "+", 9 }, { "-", 9 },
+    { "*", 10 }, { "/", 10 }, { "%", 10 },
+};
+
+static int expr_apply(const char *op, int a, int b)
+{
+    if (!strcmp(op, "||")) return a || b;
+    if (!strcmp(op, "&&")) return a && b;
+    if (!strcmp(op, "|"))  return a | b;
+    if (!strcmp(op, "^"))  return a ^ b;
+    if (!strcmp(op, "&"))  return a & b;
+    if (!strcmp(op, "==")) return a == b;
+    if (!strcmp(op, "!=")) return a != b;
+    if (!strcmp(op, "<=")) return a <= b;
+    if (!strcmp(op, ">=")) return a >= b;
+    if (!strcmp(op, "<<")) return a << b;
+    if (!strcmp(op, ">>")) return a >> b;
+    if (!strcmp(op, "<"))  return a < b;
+    if (!strcmp(op, ">"))  return a > b;
+    if (!strcmp(op, "+"))  return a + b;
+    if (!strcmp(op, "-"))  return a - b;
+    if (!strcmp(op, "*"))  return a * b;
+    if (!b) {
+        error("division by zero");
+        return 0;
+    }
+    return (!strcmp(op, "/")) ? a / b : a % b;
+}
+
+static int expr_parse(int prec)
+{
+    int value = expr_primary();
+    size_t i;
+
+    for (;;) {
+        skip_space();
+        for (i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++)
+            if (!strncmp(expr_p, binary_ops[i].op, strlen(binary_ops[i].op)))
+                break;
+        if (i == sizeof(binary_ops) / sizeof(binary_ops[0]) || binary_ops[i].prec <= prec)
+            return value;
+        expr_p += strlen(binary_ops[i].op);
+        value = expr_apply(binary_ops[i].op, value, expr_parse(binary_ops[i].prec));
+    }
+}
+
+static int expr_eval(const char *s)
+{
+    int value;
+
+    expr_p = s;
+    value = expr_parse(0);
+    skip_space();
+    if (*expr_p)
+        error("junk after expression: '%s'", expr_p);
+    return value;
+}
+
+/* Output */
+
+static void emit(int byte)
+{
+    int offset;
+
+    if (bank == 0 && pc >= BANK_SIZE)
+        error("bank 0 overflows into $%04x", pc);
+    else if (bank > 0 && (pc < BANK_SIZE || pc >= 2 * BANK_SIZE))
+        error("address $%04x outside the switchable bank", pc);
+    offset = (bank) ? bank * BANK_SIZE + pc - BANK_SIZE : pc;
+    if (pass == 2 && offset >= 0 && offset < (int)sizeof(rom))
+        rom[offset] = byte;
+    pc++;
+}
+
+static void emit_word(int word)
+{
+    emit(word & 0xff);
+    emit((word >> 8) & 0xff);
+}
+
+static void emit_u8(int value)
+{
+    if (value < -128 || value > 255)
+        error("value %d does not fit in a byte", value);
+    emit(value & 0xff);
+}
+
+static void emit_u16(int value)
+{
+    if (value < -32768 || value > 65535)
+        error("value %d does not fit in a word", value);
+    emit_word(value & 0xffff);
+}
+
+/* Operands */
+
+static void trim(char *s)
+{
+    char *end = s + strlen(s);
+
+    while (end > s && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    memmove(s, s + strspn(s, " \t"), strlen(s + strspn(s, " \t")) + 1);
+}
+
+/* Split at top-level commas; returns the number of fields */
+static int split_args(char *s, char **args, int max)
+{
+    int cnt = 0, depth = 0;
+    bool quoted = false;
+
+    trim(s);
+    if (!*s)
+        return 0;
+    args[cnt++] = s;
+    for (; *s; s++) {
+        if (*s == '"')
+            quoted = !quoted;
+        else if (!quoted && *s == '(')
+            depth++;
+        else if (!quoted && *s == ')')
+            depth--;
+        else if (!quoted && !depth && *s == ',') {
+            *s = '\0';
+            if (cnt == max) {
+                error("too many operands");
+                break;
+            }
+            args[cnt++] = s + 1;
+        }
+    }
+    for (int i = 0; i < cnt; i++)
+        trim(args[i]);
+    return cnt;
+}
+
+/* True when s is "(...)" with the parentheses matching each other */
+static bool enclosed(const char *s)
+{
+    int depth = 0;
+    size_t len = strlen(s);
+
+    if (len < 2 || s[0] != '(' || s[len - 1] != ')')
+        return false;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '(')
+            depth++;
+        else if (s[i] == ')' && --depth == 0 && i != len - 1)
+            return false;
+    }
+    return true;
+}
+
+static bool same(const char *a, const char *b)
+{
+    char buf[MAX_LINE];
+    int len = 0;
+
+    // compare ignoring case and blanks, so "( hl + )" is "(hl+)"
+    for (; *a && len < MAX_LINE - 1; a++)
+        if (!isspace((unsigned char)*a))
+            buf[len++] = tolower((unsigned char)*a);
+    buf[len] = '\0';
+    return !strcmp(buf, b);
+}
+
+static struct operand parse_operand(const char *s)
+{
+    struct operand op = { OP_IMM, 0, 0 };
+    char inner[MAX_LINE];
+
+    for (int i = 0; i < 8; i++)
+        if (same(s, r8_names[i]))
+            return (struct operand){ OP_R8, i, 0 };
+    for (int i = 0; i < 5; i++)
+        if (same(s, r16_names[i]))
+            return (struct operand){ OP_R16, i, 0 };
+    for (int i = 0; i < 3; i++)
+        if (same(s, cond_names[i]))
+            return (struct operand){ OP_COND, i, 0 };
+    if (same(s, "(bc)"))
+        return (struct operand){ OP_MEM_BC, 0, 0 };
+    if (same(s, "(de)"))
+        return (struct operand){ OP_MEM_DE, 0, 0 };
+    if (same(s, "(hl+)") || same(s, "(hli)"))
+        return (struct operand){ OP_MEM_HLI, 0, 0 };
+    if (same(s, "(hl-)") || same(s, "(hld)"))
+        return (struct operand){ OP_MEM_HLD, 0, 0 };
+    if (same(s, "(c)") || same(s, "($ff00+c)"))
+        return (struct operand){ OP_MEM_C, 0, 0 };
+    if (!strncasecmp(s, "sp", 2) && (s[2 + strspn(s + 2, " \t")] == '+' ||
+                                     s[2 + strspn(s + 2, " \t")] == '-')) {
+        op.kind = OP_SP_OFS;
+        op.value = expr_eval(s + 2);
+        return op;
+    }
+    if (enclosed(s)) {
+        snprintf(inner, sizeof(inner), "%.*s", (int)strlen(s) - 2, s + 1);
+        op.kind = OP_MEM;
+        op.value = expr_eval(inner);
+        return op;
+    }
+    op.value = expr_eval(s);
+    return op;
+}
+
+static bool is_a(const struct operand *op)
+{
+    return op->kind == OP_R8 && op->reg == 7;
+}
+
+static bool is_r16(const struct operand *op, int reg)
+{
+    return op->kind == OP_R16 && op->reg == reg;
+}
+
+/* nz z nc c, or -1 */
+static int cond_code(const struct operand *op)
+{
+    if (op->kind == OP_COND)
+        return op->reg;
+    if (op->kind == OP_R8 && op->reg == 1)
+        return 3;
+    return -1;
+}
+
+static void emit_jr(int target)
+{
+    int offset = target - (pc + 1);
+
+    if (pass == 2 && (offset < -128 || offset > 127))
+        error("jr target out of range (%d)", offset);
+    emit(offset & 0xff);
+}
+
+/* ADD ADC SUB SBC AND XOR OR CP, in opcode order */
+static const char *alu_names[] = { "add", "adc", "sub", "sbc", "and", "xor", "or", "cp" };
+/* Rotates and shifts of the CB page, in opcode order */
+static const char *cb_names[] = { "rlc", "rrc", "rl", "rr", "sla", "sra", "swap", "srl" };
+
+static const struct {
+    const char *name;
+    uint8_t opcode;
+} implied[] = {
+    { "nop", 0x00 }, { "rlca", 0x07 }, { "rrca", 0x0f }, { "rla", 0x17 },
+    { "rra", 0x1f }, { "daa", 0x27 }, { "cpl", 0x2f }, { "scf", 0x37 },
+    { "ccf", 0x3f }, { "halt", 0x76 }, { "reti", 0xd9 }, { "di", 0xf3 },
+    { "ei", 0xfb },
+};
+
+static void bad_operands(const char *mnemonic)
+{
+    error("bad operands for %s", mnemonic);
+}
+
+static void assemble_ld(struct operand *d, struct operand *s)
+{
+    if (d->kind == OP_R8 && s->kind == OP_R8 && !(d->reg == 6 && s->reg == 6)) {
+        emit(0x40 | d->reg << 3 | s->reg);
+    } else if (d->kind == OP_R8 && s->kind == OP_IMM) {
+        emit(0x06 | d->reg << 3);
+        emit_u8(s->value);
+    } else if (d->kind == OP_R16 && d->reg < 4 && s->kind == OP_IMM) {
+        emit(0x01 | d->reg << 4);
+        emit_u16(s->value);
+    } else if (is_a(s) && d->kind >= OP_MEM_BC && d->kind <= OP_MEM_HLD) {
+        emit(0x02 | (d->kind - OP_MEM_BC) << 4);
+    } else if (is_a(d) && s->kind >= OP_MEM_BC && s->kind <= OP_MEM_HLD) {
+        emit(0x0a | (s->kind - OP_MEM_BC) << 4);
+    } else if (d->kind == OP_MEM && is_r16(s, 3)) {
+        emit(0x08);
+        emit_u16(d->value);
+    } else if (d->kind == OP_MEM && is_a(s)) {
+        emit(0xea);
+        emit_u16(d->value);
+    } else if (is_a(d) && s->kind == OP_MEM) {
+        emit(0xfa);
+        emit_u16(s->value);
+    } else if (d->kind == OP_MEM_C && is_a(s)) {
+        emit(0xe2);
+    } else if (is_a(d) && s->kind == OP_MEM_C) {
+        emit(0xf2);
+    } else if (is_r16(d, 2) && s->kind == OP_SP_OFS) {
+        emit(0xf8);
+        emit_u8(s->value);
+    } else if (is_r16(d, 3) && is_r16(s, 2)) {
+        emit(0xf9);
+    } else {
+        bad_operands("ld");
+    }
+}
+
+static void emit_high_page(int addr)
+{
+    if (addr >= 0xff00 && addr <= 0xffff)
+        emit(addr & 0xff);
+    else
+        emit_u8(addr);
+}
+
+static void assemble_ldh(struct operand *d, struct operand *s)
+{
+    if (d->kind == OP_MEM && is_a(s)) {
+        emit(0xe0);
+        emit_high_page(d->value);
+    } else if (is_a(d) && s->kind == OP_MEM) {
+        emit(0xf0);
+        emit_high_page(s->value);
+    } else if (d->kind == OP_MEM_C && is_a(s)) {
+        emit(0xe2);
+    } else if (is_a(d) && s->kind == OP_MEM_C) {
+        emit(0xf2);
+    } else {
+        bad_operands("ldh");
+    }
+}
+
+static void assemble(const char *mnemonic, char **args, int argc)
+{
+    struct operand ops[MAX_OPERANDS];
+    int cc;
+
+    for (size_t i = 0; i < sizeof(implied) / sizeof(implied[0]); i++) {
+        if (!strcasecmp(mnemonic, implied[i].name)) {
+            if (argc)
+                bad_operands(mnemonic);
+            emit(implied[i].opcode);
+            return;
+        }
+    }
+    for (int i = 0; i < argc; i++)
+        ops[i] = parse_operand(args[i]);
+
+    if (!strcasecmp(mnemonic, "ld") && argc == 2) {
+        assemble_ld(&ops[0], &ops[1]);
+        return;
+    }
+    if (!strcasecmp(mnemonic, "ldh") && argc == 2) {
+        assemble_ldh(&ops[0], &ops[1]);
+        return;
+    }
+    if (!strcasecmp(mnemonic, "stop")) {
+        emit(0x10);
+        emit(0x00);
+        return;
+    }
+    for (int i = 0; i < 8; i++) {
+        if (strcasecmp(mnemonic, alu_names[i]))
+            continue;
+        if (i == 0 && argc == 2 && is_r16(&ops[0], 2) && ops[1].kind == OP_R16 && ops[1].reg < 4) {
+            emit(0x09 | ops[1].reg << 4);                   // add hl,rr
+        } else if (i == 0 && argc == 2 && is_r16(&ops[0], 3) && ops[1].kind == OP_IMM) {
+            emit(0xe8);                                     // add sp,e
+            emit_u8(ops[1].value);
+        } else {
+            // "op a,x" or just "op x"
+            struct operand *src = (argc == 2 && is_a(&ops[0])) ? &ops[1] : &ops[0];
+
+            if ((argc != 1 && argc != 2) || (argc == 2 && !is_a(&ops[0])))
+                bad_operands(mnemonic);
+            else if (src->kind == OP_R8)
+                emit(0x80 | i << 3 | src->reg);
+            else if (src->kind == OP_IMM) {
+                emit(0xc6 | i << 3);
+                emit_u8(src->value);
+            } else
+                bad_operands(mnemonic);
+        }
+        return;
+    }
+    for (int i = 0; i < 8; i++) {
+        if (strcasecmp(mnemonic, cb_names[i]))
+            continue;
+        if (argc != 1 || ops[0].kind != OP_R8) {
+            bad_operands(mnemonic);
+            return;
+        }
+        emit(0xcb);
+        emit(i << 3 | ops[0].reg);
+        return;
+    }
+    if (!strcasecmp(mnemonic, "bit") || !strcasecmp(mnemonic, "res") || !strcasecmp(mnemonic, "set")) {
+        int base = (tolower(mnemonic[0]) == 'b') ? 0x40 : (tolower(mnemonic[0]) == 'r') ? 0x80 : 0xc0;
+
+        if (argc != 2 || ops[0].kind != OP_IMM || ops[0].value < 0 || ops[0].value > 7 ||
+            ops[1].kind != OP_R8) {
+            bad_operands(mnemonic);
+            return;
+        }
+        emit(0xcb);
+        emit(base | ops[0].value << 3 | ops[1].reg);
+        return;
+    }
+    if ((!strcasecmp(mnemonic, "inc") || !strcasecmp(mnemonic, "dec")) && argc == 1) {
+        bool dec = tolower(mnemonic[0]) == 'd';
+
+        if (ops[0].kind == OP_R8)
+            emit((dec ? 0x05 : 0x04) | ops[0].reg << 3);
+        else if (ops[0].kind == OP_R16 && ops[0].reg < 4)
+            emit((dec ? 0x0b : 0x03) | ops[0].reg << 4);
+        else
+            bad_operands(mnemonic);
+        return;
+    }
+    if ((!strcasecmp(mnemonic, "push") || !strcasecmp(mnemonic, "pop")) && argc == 1) {
+        int reg = (is_r16(&ops[0], 4)) ? 3 : ops[0].reg;
+
+        if (ops[0].kind != OP_R16 || is_r16(&ops[0], 3))
+            bad_operands(mnemonic);
+        else
+            emit((tolower(mnemonic[1]) == 'u' ? 0xc5 : 0xc1) | reg << 4);
+        return;
+    }
+    if (!strcasecmp(mnemonic, "jr")) {
+        if (argc == 1 && ops[0].kind == OP_IMM) {
+            emit(0x18);
+            emit_jr(ops[0].value);
+        } else if (argc == 2 && (cc = cond_code(&ops[0])) >= 0 && ops[1].kind == OP_IMM) {
+            emit(0x20 | cc << 3);
+            emit_jr(ops[1].value);
+        } else {
+            bad_operands(mnemonic);
+        }
+        return;
+    }
+    if (!strcasecmp(mnemonic, "jp") || !strcasecmp(mnemonic, "call")) {
+        bool call = tolower(mnemonic[0]) == 'c';
+
+        if (!call && argc == 1 && (is_r16(&ops[0], 2) || (ops[0].kind == OP_R8 && ops[0].reg == 6))) {
+            emit(0xe9);                                     // jp hl
+        } else if (argc == 1 && ops[0].kind == OP_IMM) {
+            emit(call ? 0xcd : 0xc3);
+            emit_u16(ops[0].value);
+        } else if (argc == 2 && (cc = cond_code(&ops[0])) >= 0 && ops[1].kind == OP_IMM) {
+            emit((call ? 0xc4 : 0xc2) | cc << 3);
+            emit_u16(ops[1].value);
+        } else {
+            bad_operands(mnemonic);
+        }
+        return;
+    }
+    if (!strcasecmp(mnemonic, "ret")) {
+        if (!argc)
+            emit(0xc9);
+        else if (argc == 1 && (cc = cond_code(&ops[0])) >= 0)
+            emit(0xc0 | cc << 3);
+        else
+            bad_operands(mnemonic);
+        return;
+    }
+    if (!strcasecmp(mnemonic, "rst")) {
+        if (argc != 1 || ops[0].kind != OP_IMM || (ops[0].value & ~0x38))
+            bad_operands(mnemonic);
+        else
+            emit(0xc7 | ops[0].value);
+        return;
+    }
+    error("unknown instruction %s", mnemonic);
+}
+
+/* Directives */
+
+static bool parse_string(const char *s, char *buf, size_t size)
+{
+    size_t len = strlen(s);
+
+    if (len < 2 || s[0] != '"' || s[len - 1] != '"')
+        return false;
+    snprintf(buf, size, "%.*s", (int)len - 2, s + 1);
+    return true;
+}
+
+static void assemble_file(const char *path);
+
+static bool directive(const char *name, char *rest)
+{
+    char *args[256], buf[MAX_LINE], path[MAX_LINE];
+    int argc, value;
+
+    if (!strcasecmp(name, "db") || !strcasecmp(name, "dw")) {
+        argc = split_args(rest, args, 256);
+        for (int i = 0; i < argc; i++) {
+            if (tolower(name[1]) == 'b' && parse_string(args[i], buf, sizeof(buf))) {
+                for (char *c = buf; *c; c++)
+                    emit((unsigned char)*c);
+            } else if (tolower(name[1]) == 'b') {
+                emit_u8(expr_eval(args[i]));
+            } else {
+                emit_u16(expr_eval(args[i]));
+            }
+        }
+    } else if (!strcasecmp(name, "ds")) {
+        argc = split_args(rest, args, 2);
+        value = (argc == 2) ? expr_eval(args[1]) : 0;
+        for (int i = (argc) ? expr_eval(args[0]) : 0; i > 0; i--)
+            emit_u8(value);
+    } else if (!strcasecmp(name, "org")) {
+        pc = expr_eval(rest);
+    } else if (!strcasecmp(name, "bank")) {
+        bank = expr_eval(rest);
+        if (bank < 0 || bank >= MAX_BANKS) {
+            error("bank %d out of range", bank);
+            bank = 0;
+        }
+        pc = (bank) ? BANK_SIZE : 0;
+        if (bank > top_bank)
+            top_bank = bank;
+    } else if (!strcasecmp(name, "include")) {
+        trim(rest);
+        if (!parse_string(rest, buf, sizeof(buf))) {
+            error("include needs a quoted file name");
+            return true;
+        }
+        snprintf(path, sizeof(path), "%.*s%s",
+                 (strrchr(file_name, '/')) ? (int)(strrchr(file_name, '/') - file_name + 1) : 0,
+                 file_name, buf);
+        assemble_file(path);
+    } else if (!strcasecmp(name, "title")) {
+        trim(rest);
+        if (!parse_string(rest, buf, sizeof(buf)) || strlen(buf) > 16)
+            error("title needs a quoted name of up to 16 characters");
+        else
+            strcpy(title, buf);
+    } else if (!strcasecmp(name, "cart")) {
+        cart_type = expr_eval(rest);
+    } else if (!strcasecmp(name, "ramsize")) {
+        ram_size = expr_eval(rest);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void assemble_line(char *line)
+{
+    char name[MAX_NAME], *p, *colon, *args[MAX_OPERANDS];
+    bool quoted = false;
+    int len, argc;
+
+    for (p = line; *p; p++) {
+        if (!quoted && *p == '\'' && p[1] && p[2] == '\'')
+            p += 2;
+        else if (*p == '"')
+            quoted = !quoted;
+        else if (*p == ';' && !quoted) {
+            *p = '\0';
+            break;
+        }
+    }
+    p = line + strspn(line, " \t");
+
+    // label:
+    for (len = 0; ident_char(p[len]); len++)
+        ;
+    colon = p + len + strspn(p + len, " \t");
+    if (len && *colon == ':') {
+        snprintf(name, sizeof(name), "%.*s", len, p);
+        if (name[0] != '.')
+            strcpy(scope, name);
+        symbol_define(name, pc, bank);
+        p = colon + 1 + strspn(colon + 1, " \t");
+        for (len = 0; ident_char(p[len]); len++)
+            ;
+    }
+    if (!len)
+        return;
+    snprintf(name, sizeof(name), "%.*s", len, p);
+    p += len;
+
+    // name equ expr, name = expr
+    colon = p + strspn(p, " \t");
+    if (!strncasecmp(colon, "equ", 3) && isspace((unsigned char)colon[3])) {
+        symbol_define(name, expr_eval(colon + 3), bank);
+        return;
+    }
+    if (*colon == '=' && colon[1] != '=') {
+        symbol_define(name, expr_eval(colon + 1), bank);
+        return;
+    }
+    if (directive(name, p))
+        return;
+    argc = split_args(p, args, MAX_OPERANDS);
+    assemble(name, args, argc);
+}
+
+static void assemble_file(const char *path)
+{
+    const char *saved_name = file_name;
+    int saved_line = line_no;
+    char line[MAX_LINE];
+    FILE *f;
+
+    if (include_depth == MAX_INCLUDE) {
+        error("includes nested too deeply");
+        return;
+    }
+    if (!(f = fopen(path, "r"))) {
+        if (file_name) {
+            pass = 2;
+            error("cannot open %s", path);
+        } else {
+            fprintf(stderr, "cannot open %s\n", path);
+        }
+        exit(1);
+    }
+    include_depth++;
+    file_name = path;
+    line_no = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        assemble_line(line);
+    }
+    fclose(f);
+    include_depth--;
+    file_name = saved_name;
+    line_no = saved_line;
+}
+
+/* Header and checksums over the image, which is size bytes long */
+static void write_header(int size)
+{
+    uint16_t global = 0;
+    uint8_t header = 0;
+    int code = 0;
+
+    while ((2 * BANK_SIZE << code) < size)
+        code++;
+    memcpy(&rom[0x104], logo, sizeof(logo));
+    memset(&rom[0x134], 0, 16);
+    memcpy(&rom[0x134], title, strlen(title));
+    rom[0x147] = cart_type;
+    rom[0x148] = code;
+    rom[0x149] = ram_size;
+    rom[0x14a] = 0x01;                          // not for Japan
+    for (int i = 0x134; i < 0x14d; i++)
+        header = header - rom[i] - 1;
+    rom[0x14d] = header;
+    for (int i = 0; i < size; i++)
+        if (i != 0x14e && i != 0x14f)
+            global += rom[i];
+    rom[0x14e] = global >> 8;
+    rom[0x14f] = global & 0xff;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: gbda-asm [-o out.gb] source.asm\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *out = "out.gb";
+    int opt, size;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+        case 'o':
+            out = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind != 1)
+        usage();
+
+    for (pass = 1; pass <= 2; pass++) {
+        bank = pc = top_bank = 0;
+        scope[0] = '\0';
+        file_name = NULL;
+        assemble_file(argv[optind]);
+    }
+    if (errors)
+        return 1;
+
+    // the smallest power of two number of banks, at least two
+    for (size = 2 * BANK_SIZE; size < (top_bank + 1) * BANK_SIZE; size *= 2)
+        ;
+    write_header(size);
+    if (!(f = fopen(out, "wb")) || fwrite(rom, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "cannot write %s\n", out);
+        return 1;
+    }
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,297 @@
+#include "gb.h"
+#include "gbda.h"
+#include "joypad.h"
+#include <pthread.h>
+#include <sched.h>
+#include <strings.h>
+#include <time.h>
+
+/*
+ * gbda-batch: run many independent emulator instances on a worker pool.
+ *
+ * A job is a ROM run for a fixed number of frames, optionally fed by an
+ * input script. Jobs are dealt round-robin to one deque per worker; a worker
+ * takes jobs from the back of its own deque and, once that is empty, steals
+ * from the front of the others. Every worker is pinned to one of the CPUs the
+ * process may run on and creates its instances itself, so with the kernel's
+ * default first-touch policy their memory ends up on that CPU's NUMA node.
+ *
+ * Input scripts have one "frame key..." line per change, keys being any of
+ * a b select start right left up down; the listed keys are held from that
+ * frame until the next line. Lines starting with # are ignored.
+ *
+ * With -s every job also reports the core's counters (struct gb_stats), to
+ * spot ROMs that switch banks, start DMAs or take interrupts unusually often.
+ */
+
+#define MAX_SCRIPT_LINES    4096
+#define MAX_SCRIPTS         1024
+
+struct script_line {
+    int frame;
+    uint8_t keys;
+};
+
+struct job {
+    const char *rom;
+    const char *script_path;
+    struct script_line *script;
+    int script_len;
+    bool ok;
+    double seconds;
+    struct gb_stats stats;
+};
+
+struct deque {
+    pthread_mutex_t lock;
+    int *jobs;
+    int head;
+    int tail;
+};
+
+struct worker {
+    pthread_t thread;
+    int index;
+    int cpu;
+};
+
+static struct job *jobs;
+static struct deque *deques;
+static int job_cnt, worker_cnt, frames = 600;
+static bool print_stats;
+
+static const char *key_names[8] = {
+    "a", "b", "select", "start", "right", "left", "up", "down",
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool script_load(struct job *job)
+{
+    char line[256], *tok;
+    FILE *f = fopen(job->script_path, "r");
+
+    if (!f)
+        return false;
+    job->script = calloc(MAX_SCRIPT_LINES, sizeof(*job->script));
+    while (job->script_len < MAX_SCRIPT_LINES && fgets(line, sizeof(line), f)) {
+        struct script_line *sl = &job->script[job->script_len];
+
+        if (line[0] == '#' || !(tok = strtok(line, " \t\r\n")))
+            continue;
+        sl->frame = atoi(tok);
+        sl->keys = 0;
+        while ((tok = strtok(NULL, " \t\r\n"))) {
+            for (int i = 0; i < 8; i++)
+                if (!strcasecmp(tok, key_names[i]))
+                    sl->keys |= 1U << i;
+        }
+        job->script_len++;
+    }
+    fclose(f);
+    return true;
+}
+
+/* Press and release buttons so that exactly keys are held */
+static void set_keys(struct gb *gb, uint8_t held, uint8_t keys)
+{
+    for (int i = 0; i < 8; i++) {
+        if ((keys & ~held) & (1U << i))
+            joypad_press_button(gb, 1U << i);
+        else if ((held & ~keys) & (1U << i))
+            joypad_release_button(gb, 1U << i);
+    }
+}
+
+static void job_run(struct job *job)
+{
+    struct gb *gb = gb_create();
+    uint8_t held = 0, keys;
+    int line = 0;
+    double start;
+
+    if (!gb || !gb_load(gb, job->rom)) {
+        gb_destroy(gb);
+        return;
+    }
+    start = now_seconds();
+    for (int frame = 0; frame < frames; frame++) {
+        keys = held;
+        while (line < job->script_len && job->script[line].frame <= frame)
+            keys = job->script[line++].keys;
+        if (keys != held) {
+            set_keys(gb, held, keys);
+            held = keys;
+        }
+        gb_run_frame(gb);
+    }
+    job->seconds = now_seconds() - start;
+    gb_get_stats(gb, &job->stats);
+    job->ok = true;
+    gb_destroy(gb);
+}
+
+/* Own jobs are taken from the back, stolen ones from the front */
+static int deque_pop(struct deque *d, bool steal)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->head != d->tail)
+        job = (steal) ? d->jobs[d->head++] : d->jobs[--d->tail];
+    pthread_mutex_unlock(&d->lock);
+    return job;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    cpu_set_t set;
+    int job;
+
+    if (w->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    for (;;) {
+        job = deque_pop(&deques[w->index], false);
+        for (int i = 1; job < 0 && i < worker_cnt; i++)
+            job = deque_pop(&deques[(w->index + i) % worker_cnt], true);
+        if (job < 0)
+            break;
+        job_run(&jobs[job]);
+    }
+    return NULL;
+}
+
+static void print_job_stats(const struct gb_stats *stats)
+{
+    uint64_t io_reads = 0, io_writes = 0, cycles = (uint64_t)frames * 70224;
+
+    // 0x80-0xfe are HRAM, not registers
+    for (int i = 0; i < 0x100; i++) {
+        if (i < 0x80 || i == 0xff) {
+            io_reads += stats->io_reads[i];
+            io_writes += stats->io_writes[i];
+        }
+    }
+    printf("         %llu instructions, %llu/%llu I/O reads/writes, %llu MBC writes, "
+           "%llu ROM and %llu RAM bank switches, %llu OAM DMAs\n",
+           (unsigned long long)stats->instructions, (unsigned long long)io_reads,
+           (unsigned long long)io_writes, (unsigned long long)stats->mbc_writes,
+           (unsigned long long)stats->rom_bank_switches, (unsigned long long)stats->ram_bank_switches,
+           (unsigned long long)stats->oam_dmas);
+    printf("         interrupts %llu/%llu/%llu/%llu/%llu (vblank/stat/timer/serial/joypad), "
+           "%llu frames, %llu samples, %.1f%% halted\n",
+           (unsigned long long)stats->interrupts[0], (unsigned long long)stats->interrupts[1],
+           (unsigned long long)stats->interrupts[2], (unsigned long long)stats->interrupts[3],
+           (unsigned long long)stats->interrupts[4], (unsigned long long)stats->frames,
+           (unsigned long long)stats->samples, 100.0 * stats->halt_cycles / cycles);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: gbda-batch [-s] [-j workers] [-f frames] rom.gb...\n"
+                    "       gbda-batch [-s] [-j workers] [-f frames] -i script... rom.gb\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *scripts[MAX_SCRIPTS];
+    int opt, script_cnt = 0, cpus[CPU_SETSIZE], cpu_cnt = 0;
+    struct worker *workers;
+    double start, wall, fps;
+    long total_frames = 0;
+    cpu_set_t set;
+
+    worker_cnt = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "f:i:j:s")) != -1) {
+        switch (opt) {
+        case 'f':
+            frames = atoi(optarg);
+            break;
+        case 'i':
+            if (script_cnt == MAX_SCRIPTS)
+                usage();
+            scripts[script_cnt++] = optarg;
+            break;
+        case 'j':
+            worker_cnt = atoi(optarg);
+            break;
+        case 's':
+            print_stats = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind == argc || (script_cnt && argc - optind != 1) || worker_cnt < 1 || frames < 1)
+        usage();
+
+    job_cnt = (script_cnt) ? script_cnt : argc - optind;
+    jobs = calloc(job_cnt, sizeof(*jobs));
+    for (int i = 0; i < job_cnt; i++) {
+        jobs[i].rom = (script_cnt) ? argv[optind] : argv[optind + i];
+        if (script_cnt) {
+            jobs[i].script_path = scripts[i];
+            if (!script_load(&jobs[i])) {
+                fprintf(stderr, "cannot read script %s\n", scripts[i]);
+                return 1;
+            }
+        }
+    }
+    if (worker_cnt > job_cnt)
+        worker_cnt = job_cnt;
+
+    if (!sched_getaffinity(0, sizeof(set), &set))
+        for (int i = 0; i < CPU_SETSIZE; i++)
+            if (CPU_ISSET(i, &set))
+                cpus[cpu_cnt++] = i;
+    deques = calloc(worker_cnt, sizeof(*deques));
+    for (int i = 0; i < worker_cnt; i++) {
+        pthread_mutex_init(&deques[i].lock, NULL);
+        deques[i].jobs = malloc(job_cnt * sizeof(int));
+    }
+    for (int i = 0; i < job_cnt; i++) {
+        struct deque *d = &deques[i % worker_cnt];
+
+        d->jobs[d->tail++] = i;
+    }
+
+    workers = calloc(worker_cnt, sizeof(*workers));
+    start = now_seconds();
+    for (int i = 0; i < worker_cnt; i++) {
+        workers[i].index = i;
+        workers[i].cpu = (cpu_cnt) ? cpus[i % cpu_cnt] : -1;
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    for (int i = 0; i < worker_cnt; i++)
+        pthread_join(workers[i].thread, NULL);
+    wall = now_seconds() - start;
+
+    for (int i = 0; i < job_cnt; i++) {
+        printf("job %3d  %s", i, jobs[i].rom);
+        if (jobs[i].script_path)
+            printf(" < %s", jobs[i].script_path);
+        if (!jobs[i].ok) {
+            printf("  failed\n");
+            continue;
+        }
+        fps = frames / jobs[i].seconds;
+        printf("  %d frames in %.3f s, %.1f fps\n", frames, jobs[i].seconds, fps);
+        if (print_stats)
+            print_job_stats(&jobs[i].stats);
+        total_frames += frames;
+    }
+    printf("%d jobs on %d workers: %ld frames in %.3f s, %.1f fps aggregate\n",
+           job_cnt, worker_cnt, total_frames, wall, total_frames / wall);
+    return 0;
+}
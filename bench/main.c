@@ -0,0 +1,178 @@
+#include "gb.h"
+#include "gbda.h"
+#include <time.h>
+
+/*
+ * gbda-bench: run a fixed set of workloads for a fixed number of emulated
+ * frames and report emulated MHz, frames per second and nanoseconds per
+ * emulated instruction.
+ *
+ * The workloads are the ROMs assembled from roms/ (see the comment at the
+ * top of each source), so every build measures exactly the same guest code:
+ *
+ *   alu      a register-only arithmetic loop, the LCD showing nothing
+ *   scroll   a fully tiled background, SCX rewritten on every line
+ *   sprites  40 8x16 sprites moved and copied to OAM by DMA every frame
+ *   audio    all four channels playing, rewritten on every line
+ *   halt     a game idling in HALT between VBlank interrupts
+ *   banks    MBC1 bank switching, a routine called in each of 7 banks
+ *   stat     STAT interrupt raster effects on an MBC3 cartridge
+ *
+ * Any other ROM can be given by path instead of by name.
+ */
+
+#define CYCLES_PER_FRAME    70224
+#define MAX_RUNS            64
+
+#ifndef GBDA_ROM_DIR
+#define GBDA_ROM_DIR        "roms"
+#endif
+
+struct result {
+    const char *name;
+    uint64_t cycles;
+    uint64_t instructions;
+    double seconds;
+};
+
+static const char *workloads[] = {
+    "alu", "scroll", "sprites", "audio", "halt", "banks", "stat",
+};
+
+#define WORKLOAD_CNT    (sizeof(workloads) / sizeof(workloads[0]))
+
+static const char *rom_dir = GBDA_ROM_DIR;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A workload is a name from the list above or the path of a ROM */
+static bool read_rom(const char *workload, uint8_t *rom, size_t *size)
+{
+    char path[4096];
+    FILE *f;
+
+    if (strchr(workload, '/') || strstr(workload, ".gb"))
+        snprintf(path, sizeof(path), "%s", workload);
+    else
+        snprintf(path, sizeof(path), "%s/%s.gb", rom_dir, workload);
+    if (!(f = fopen(path, "rb")))
+        return false;
+    *size = fread(rom, 1, 2 * MiB, f);
+    fclose(f);
+    return *size > 0x150;
+}
+
+static bool run_workload(const char *workload, uint64_t frames, struct result *res)
+{
+    static uint8_t rom[2 * MiB];
+    uint64_t cycles, instructions;
+    struct gb *gb;
+    double start;
+    size_t size;
+
+    if (!read_rom(workload, rom, &size)) {
+        fprintf(stderr, "cannot read workload %s\n", workload);
+        return false;
+    }
+    if (!(gb = gb_create())) {
+        fprintf(stderr, "out of memory\n");
+        return false;
+    }
+    gb_load_rom(gb, rom, size);
+    cycles = gb->scheduler.now;
+    instructions = gb->cpu.instructions;
+    start = now_seconds();
+    gb_run_cycles(gb, frames * CYCLES_PER_FRAME);
+    res->seconds = now_seconds() - start;
+    res->name = workload;
+    res->cycles = gb->scheduler.now - cycles;
+    res->instructions = gb->cpu.instructions - instructions;
+    gb_destroy(gb);
+    return true;
+}
+
+static void print_text(const struct result *res, int cnt)
+{
+    printf("%-10s %8s %10s %9s %10s %10s\n", "workload", "frames", "seconds", "MHz", "fps", "ns/instr");
+    for (int i = 0; i < cnt; i++) {
+        printf("%-10s %8.0f %10.3f %9.1f %10.1f %10.2f\n", res[i].name,
+               (double)res[i].cycles / CYCLES_PER_FRAME, res[i].seconds,
+               res[i].cycles / res[i].seconds / 1e6,
+               res[i].cycles / (double)CYCLES_PER_FRAME / res[i].seconds,
+               res[i].seconds * 1e9 / res[i].instructions);
+    }
+}
+
+static void print_json(const struct result *res, int cnt)
+{
+    printf("{\n  \"workloads\": [\n");
+    for (int i = 0; i < cnt; i++) {
+        printf("    {\"name\": \"%s\", \"frames\": %.0f, \"cycles\": %llu, "
+               "\"instructions\": %llu, \"seconds\": %.6f, \"mhz\": %.3f, "
+               "\"fps\": %.3f, \"ns_per_instruction\": %.4f}%s\n",
+               res[i].name, (double)res[i].cycles / CYCLES_PER_FRAME,
+               (unsigned long long)res[i].cycles, (unsigned long long)res[i].instructions,
+               res[i].seconds, res[i].cycles / res[i].seconds / 1e6,
+               res[i].cycles / (double)CYCLES_PER_FRAME / res[i].seconds,
+               res[i].seconds * 1e9 / res[i].instructions, (i + 1 < cnt) ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: gbda-bench [-j] [-f frames] [-d rom_dir] [workload | rom.gb]...\n"
+                    "workloads:");
+    for (size_t i = 0; i < WORKLOAD_CNT; i++)
+        fprintf(stderr, " %s", workloads[i]);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct result res[MAX_RUNS];
+    const char *run[MAX_RUNS];
+    uint64_t frames = 3600;
+    bool json = false;
+    int opt, cnt = 0;
+
+    while ((opt = getopt(argc, argv, "d:f:j")) != -1) {
+        switch (opt) {
+        case 'd':
+            rom_dir = optarg;
+            break;
+        case 'f':
+            frames = strtoull(optarg, NULL, 0);
+            break;
+        case 'j':
+            json = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (!frames || argc - optind > MAX_RUNS)
+        usage();
+
+    for (int i = optind; i < argc; i++)
+        run[cnt++] = argv[i];
+    if (!cnt)
+        for (size_t i = 0; i < WORKLOAD_CNT; i++)
+            run[cnt++] = workloads[i];
+
+    for (int i = 0; i < cnt; i++)
+        if (!run_workload(run[i], frames, &res[i]))
+            return 1;
+    if (json)
+        print_json(res, cnt);
+    else
+        print_text(res, cnt);
+    return 0;
+}
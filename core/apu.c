@@ -1,4 +1,6 @@
 #include "apu.h"
+#include "scheduler.h"
+#include "trace.h"
 
 uint8_t nrxx_or_val[6][5] = {
     [0] = {0x00, 0x00, 0x00, 0x00, 0x00},       // don't use this
@@ -116,46 +118,16 @@ uint8_t get_wave_channel_sample(struct gb *gb)
     return (pos % 2 == 0) ? (gb->apu.wave_ram[pos / 2] >> 4) & 0x0f : gb->apu.wave_ram[pos / 2] & 0x0f;
 }
 
+/* The sound registers are laid out as five blocks of five registers
+   starting at NR10, with 0xff15 and 0xff1f left unused. */
+static bool is_apu_reg(uint16_t addr)
+{
+    return IN_RANGE(addr, APU_REG_NR10, APU_REG_NR52) && addr != 0xff15 && addr != 0xff1f;
+}
+
 uint8_t get_register_num(uint16_t addr)
 {
-    int ret = 0;
-
-    switch (addr) {
-    case APU_REG_NR10:
-    case APU_REG_NR30:
-    case APU_REG_NR50:
-        ret = 0;
-        break;
-    case APU_REG_NR11:
-    case APU_REG_NR21:
-    case APU_REG_NR31:
-    case APU_REG_NR41:
-    case APU_REG_NR51:
-        ret = 1;
-        break;
-    case APU_REG_NR12:
-    case APU_REG_NR22:
-    case APU_REG_NR32:
-    case APU_REG_NR42:
-    case APU_REG_NR52:
-        ret = 2;
-        break;
-    case APU_REG_NR13:
-    case APU_REG_NR23:
-    case APU_REG_NR33:
-    case APU_REG_NR43:
-        ret = 3;
-        break;
-    case APU_REG_NR14:
-    case APU_REG_NR24:
-    case APU_REG_NR34:
-    case APU_REG_NR44:
-        ret = 4;
-        break;
-    default:
-        break;
-    }
-    return ret;
+    return (is_apu_reg(addr)) ? (addr - APU_REG_NR10) % 5 : 0;
 }
 
 void load_new_frequency(struct apu_channel *chan, uint16_t frequency)
@@ -173,20 +145,25 @@ struct apu_channel *get_channel_from_addr(struct gb *gb, uint16_t addr)
 {
     struct apu_channel *ret = NULL;
 
-    if (addr == APU_REG_NR10 || addr == APU_REG_NR11 || addr == APU_REG_NR12 ||
-        addr == APU_REG_NR13 || addr == APU_REG_NR14)
+    if (!is_apu_reg(addr))
+        return ret;
+    switch ((addr - APU_REG_NR10) / 5) {
+    case 0:
         ret = &gb->apu.sqr1;
-    else if (addr == APU_REG_NR21 || addr == APU_REG_NR22 || addr == APU_REG_NR23 ||
-        addr == APU_REG_NR24)
+        break;
+    case 1:
         ret = &gb->apu.sqr2;
-    else if (addr == APU_REG_NR30 || addr == APU_REG_NR31 || addr == APU_REG_NR32 ||
-        addr == APU_REG_NR33 || addr == APU_REG_NR34)
+        break;
+    case 2:
         ret = &gb->apu.wave;
-    else if (addr == APU_REG_NR41 || addr == APU_REG_NR42 || addr == APU_REG_NR43 ||
-        addr == APU_REG_NR44)
+        break;
+    case 3:
         ret = &gb->apu.noise;
-    else if (addr == APU_REG_NR50 || addr == APU_REG_NR51 || addr == APU_REG_NR52)
+        break;
+    default:
         ret = &gb->apu.ctrl;
+        break;
+    }
     return ret;
 }
 
@@ -269,6 +246,7 @@ void generate_sample(struct gb *gb)
     gb->apu.sample_buffer.buf[gb->apu.sample_buffer.ptr] = (int16_t)(left_mixer_output * 32767.0f);
     gb->apu.sample_buffer.buf[gb->apu.sample_buffer.ptr + 1] = (int16_t)(right_mixer_output * 32767.0f);
     gb->apu.sample_buffer.ptr += 2;
+    COUNTER_ADD(gb->stats.samples, 1);
     if (gb->apu.sample_buffer.ptr == 1024) {
         gb->apu.sample_buffer.is_full = true;
         gb->apu.sample_buffer.ptr = 0;
@@ -380,6 +358,7 @@ void apu_regs_write(struct gb *gb, uint16_t addr, uint8_t val)
     struct apu_channel *chan = get_channel_from_addr(gb, addr);
     int reg_num = get_register_num(addr);
 
+    apu_sync(gb);
     switch (reg_num) {
     case 0:
         chan->regs.nrx0 = val;
@@ -437,10 +416,12 @@ void apu_regs_write(struct gb *gb, uint16_t addr, uint8_t val)
     default:
         break;
     }
+    apu_schedule(gb);
 }
 
 void apu_ram_write(struct gb *gb, uint16_t addr, uint8_t val)
 {
+    apu_sync(gb);
     gb->apu.wave_ram[addr - 0xff30] = val;
 }
 
@@ -483,79 +464,95 @@ uint8_t apu_ram_read(struct gb *gb, uint16_t addr)
     return gb->apu.wave_ram[addr - 0xff30];
 }
 
-void ch1_tick(struct gb *gb)
+uint32_t get_channel_period(struct apu_channel *chan)
 {
-    struct apu_channel *chan = &gb->apu.sqr1;
+    uint32_t ret;
 
-    if (!chan->is_active || !is_dac_on(chan))
-        return;
-    if (chan->timer > 0) {
-        chan->timer--;
-        if (!chan->timer) {
-            chan->timer = (2048 - get_frequency(chan)) * 4;
-            chan->output = square_wave[get_square_duty_cycle(chan)][chan->pos];
-            chan->pos = (chan->pos == 7) ? 0 : chan->pos + 1;
-        }
+    switch (chan->name) {
+    case WAVE:
+        ret = (2048 - get_frequency(chan)) * 2;
+        break;
+    case NOISE:
+        ret = chan->lfsr.divisor << chan->lfsr.clock_shift;
+        break;
+    default:
+        ret = (2048 - get_frequency(chan)) * 4;
+        break;
     }
+    return ret;
 }
 
-void ch2_tick(struct gb *gb)
+/* Clock the channel's waveform n times. Only the last step decides what
+   the channel outputs, except for the LFSR which has to be shifted. */
+void channel_clock(struct gb *gb, struct apu_channel *chan, uint32_t n)
 {
-    struct apu_channel *chan = &gb->apu.sqr2;
-
-    if (!chan->is_active || !is_dac_on(chan))
-        return;
-    if (chan->timer > 0) {
-        chan->timer--;
-        if (!chan->timer) {
-            chan->timer = (2048 - get_frequency(chan)) * 4;
-            chan->output = square_wave[get_square_duty_cycle(chan)][chan->pos];
-            chan->pos = (chan->pos == 7) ? 0 : chan->pos + 1;
-        }
+    switch (chan->name) {
+    case WAVE:
+        chan->pos = (chan->pos + n - 1) % 32;
+        chan->output = get_wave_channel_sample(gb) >> wave_channel_shift[chan->volume_code];
+        chan->pos = (chan->pos == 31) ? 0 : chan->pos + 1;
+        break;
+    case NOISE:
+        while (n--)
+            chan->output = !lfsr_tick(chan);
+        break;
+    default:
+        chan->pos = (chan->pos + n - 1) % 8;
+        chan->output = square_wave[get_square_duty_cycle(chan)][chan->pos];
+        chan->pos = (chan->pos == 7) ? 0 : chan->pos + 1;
+        break;
     }
 }
 
-void ch3_tick(struct gb *gb)
+/* Advance the channel's frequency timer by a number of T-cycles at once */
+void channel_run(struct gb *gb, struct apu_channel *chan, uint32_t ticks)
 {
-    struct apu_channel *chan = &gb->apu.wave;
+    uint32_t period;
 
-    if (!chan->is_active || !is_dac_on(chan))
+    if (!chan->is_active || !is_dac_on(chan) || !chan->timer)
+        return;
+    if (ticks < chan->timer) {
+        chan->timer -= ticks;
         return;
-    if (chan->timer > 0) {
-        chan->timer--;
-        if (!chan->timer) {
-            chan->timer = (2048 - get_frequency(chan)) * 2;
-            chan->output = get_wave_channel_sample(gb) >> wave_channel_shift[chan->volume_code];
-            chan->pos = (chan->pos == 31) ? 0 : chan->pos + 1;
-        }
     }
+    ticks -= chan->timer;
+    period = get_channel_period(chan);
+    chan->timer = period - ticks % period;
+    channel_clock(gb, chan, 1 + ticks / period);
 }
 
-void ch4_tick(struct gb *gb)
+/* Bring every channel up to the current cycle. The scheduler never lets
+   this cross a frame sequencer step or a sample point. */
+void apu_sync(struct gb *gb)
 {
-    struct apu_channel *chan = &gb->apu.noise;
+    uint32_t ticks = gb->scheduler.now - gb->apu.last_sync;
 
-    if (!chan->is_active || !is_dac_on(chan))
+    gb->apu.last_sync = gb->scheduler.now;
+    if (!BIT(gb->apu.ctrl.regs.nrx2, 7) || !ticks)
         return;
-    if (chan->timer > 0) {
-        chan->timer--;
-        if (!chan->timer) {
-            chan->timer = chan->lfsr.divisor << chan->lfsr.clock_shift;
-            chan->output = !lfsr_tick(chan);
-        }
-    }
+    channel_run(gb, &gb->apu.sqr1, ticks);
+    channel_run(gb, &gb->apu.sqr2, ticks);
+    channel_run(gb, &gb->apu.wave, ticks);
+    channel_run(gb, &gb->apu.noise, ticks);
+    gb->apu.tick += ticks;
 }
 
-void apu_tick(struct gb *gb)
+void apu_schedule(struct gb *gb)
 {
-    if (!BIT(gb->apu.ctrl.regs.nrx2, 7))
+    int next_sample = 95 - gb->apu.tick % 95;
+    int next_step = 8192 - gb->apu.tick;
+
+    if (!BIT(gb->apu.ctrl.regs.nrx2, 7)) {
+        scheduler_cancel(gb, EVENT_APU);
         return;
-    gb->apu.tick++;
-    ch1_tick(gb);
-    ch2_tick(gb);
-    ch3_tick(gb);
-    ch4_tick(gb);
+    }
+    scheduler_schedule(gb, EVENT_APU, gb->apu.last_sync +
+                       ((next_sample < next_step) ? next_sample : next_step));
+}
 
+void apu_event(struct gb *gb)
+{
+    apu_sync(gb);
     if (!(gb->apu.tick % 8192)) {
         frame_sequencer_tick(&gb->apu);
         gb->apu.tick = 0;
@@ -564,6 +561,10 @@ void apu_tick(struct gb *gb)
     /* Every 95 Hz, we get a sample. This would happen until the sampling
         buffer is full of 512 samples. 95 here is from the Game Boy's working
         frequency / 44100. */
-    if (!(gb->apu.tick % 95))
+    if (!(gb->apu.tick % 95)) {
+        TRACE_BEGIN(gb, start);
         generate_sample(gb);
-}
\ No newline at end of file
+        TRACE_END(gb, TRACE_SAMPLE, start);
+    }
+    apu_schedule(gb);
+}
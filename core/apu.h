@@ -45,7 +45,9 @@ void apu_regs_write(struct gb *gb, uint16_t addr, uint8_t val);
 uint8_t apu_regs_read(struct gb *gb, uint16_t addr);
 void apu_ram_write(struct gb *gb, uint16_t addr, uint8_t val);
 uint8_t apu_ram_read(struct gb *gb, uint16_t addr);
-void apu_tick(struct gb *gb);
+void apu_sync(struct gb *gb);
+void apu_schedule(struct gb *gb);
+void apu_event(struct gb *gb);
 
 /* frequency sweep helpers */
 uint8_t get_sweep_period(struct apu_channel *chan);
@@ -76,4 +78,5 @@ bool is_dac_on(struct apu_channel *chan);
 uint8_t get_length_load(struct apu_channel *chan);
 uint8_t get_register_num(uint16_t addr);
 struct apu_channel *get_channel_from_addr(struct gb *gb, uint16_t addr);
-float get_channel_amplitude(struct apu_channel *chan);
\ No newline at end of file
+float get_channel_amplitude(struct apu_channel *chan);
+void generate_sample(struct gb *gb);
\ No newline at end of file
@@ -0,0 +1,348 @@
+#include "block.h"
+#include "bus.h"
+#include "sm83.h"
+#include "recomp.h"
+
+/* Instructions after which execution does not fall through to the next one */
+static const bool ends_block[0x100] = {
+    [0x10] = true,                                              // STOP
+    [0x18] = true, [0x20] = true, [0x28] = true,                // JR
+    [0x30] = true, [0x38] = true,
+    [0x76] = true,                                              // HALT
+    [0xc0] = true, [0xc8] = true, [0xc9] = true,                // RET
+    [0xd0] = true, [0xd8] = true, [0xd9] = true,
+    [0xc2] = true, [0xc3] = true, [0xca] = true,                // JP
+    [0xd2] = true, [0xda] = true, [0xe9] = true,
+    [0xc4] = true, [0xcc] = true, [0xcd] = true,                // CALL
+    [0xd4] = true, [0xdc] = true,
+    [0xc7] = true, [0xcf] = true, [0xd7] = true, [0xdf] = true, // RST
+    [0xe7] = true, [0xef] = true, [0xf7] = true, [0xff] = true,
+};
+
+/*
+ * ROM blocks are keyed by their offset in the ROM image, so the same PC in
+ * two different banks never aliases and a bank switch does not need to throw
+ * anything away. WRAM and HRAM blocks are keyed by address and are dropped
+ * as soon as one of their bytes is written. Code running anywhere else is
+ * not cached.
+ */
+static uint32_t block_key(struct gb *gb, uint16_t pc)
+{
+    uint8_t *page;
+
+    if (pc < 0x8000) {
+        page = gb->bus.read_map[pc >> 8];
+        return (page) ? page + (pc & 0xff) - gb->cart.rom : BLOCK_KEY_NONE;
+    }
+    if (IN_RANGE(pc, 0xc000, 0xdfff) || IN_RANGE(pc, 0xff80, 0xfffe))
+        return BLOCK_KEY_RAM | pc;
+    return BLOCK_KEY_NONE;
+}
+
+/* A block never crosses into a region whose contents can change on its own */
+static uint32_t block_region_end(uint16_t pc)
+{
+    if (pc < 0x4000)
+        return 0x4000;
+    else if (pc < 0x8000)
+        return 0x8000;
+    else if (pc < 0xe000)
+        return 0xe000;
+    return 0xffff;
+}
+
+static void block_watch(struct gb *gb, uint16_t addr)
+{
+    if (addr >= 0xff80) {
+        gb->block_cache.hram_code[addr - 0xff80] = true;
+    } else {
+        gb->block_cache.wram_code[addr - 0xc000] = true;
+        bus_watch_wram(gb, addr);
+    }
+}
+
+/*
+ * Idle loops. A block that branches back to its own start and only loads
+ * from memory, compares and tests is a polling loop: once an iteration has
+ * run without a scheduler event firing, every following iteration reads the
+ * same values and branches back again until the next event. Registers and
+ * flags are tracked as a bit set so that a loop carrying state from one
+ * iteration to the next (a DEC B delay loop, say) is not mistaken for one.
+ */
+#define IDLE_A          (1U << 0)
+#define IDLE_B          (1U << 1)
+#define IDLE_C          (1U << 2)
+#define IDLE_D          (1U << 3)
+#define IDLE_E          (1U << 4)
+#define IDLE_H          (1U << 5)
+#define IDLE_L          (1U << 6)
+#define IDLE_FZ         (1U << 7)   // Z, N and H
+#define IDLE_FC         (1U << 8)
+
+/* longest single skip in machine cycles, one frame */
+#define IDLE_MAX_SKIP   17556
+
+/* register operand index of the 8-bit instructions: B C D E H L (HL) A */
+static const unsigned idle_r8[8] = {
+    IDLE_B, IDLE_C, IDLE_D, IDLE_E, IDLE_H, IDLE_L, IDLE_H | IDLE_L, IDLE_A,
+};
+
+/* Registers read and written by an instruction allowed in an idle loop */
+static bool idle_instr(const struct block_instr *instr, unsigned *reads, unsigned *writes)
+{
+    uint8_t op = instr->opcode, x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+
+    *reads = *writes = 0;
+    if (op == 0x00)
+        return true;
+    if (x == 1 && y != 6 && op != 0x76) {                       // LD r,r'
+        *reads = idle_r8[z];
+        *writes = idle_r8[y];
+        return true;
+    }
+    if (x == 0 && y != 6 && z == 6) {                           // LD r,n
+        *writes = idle_r8[y];
+        return true;
+    }
+    if (x == 2 || (x == 3 && z == 6)) {                         // ALU A,r / A,n
+        *reads = IDLE_A | ((x == 2) ? idle_r8[z] : 0) | ((y == 1 || y == 3) ? IDLE_FC : 0);
+        *writes = ((y != 7) ? IDLE_A : 0) | IDLE_FZ | IDLE_FC;
+        return true;
+    }
+    switch (op) {
+    case 0xf0:                                                  // LDH A,(n)
+    case 0xfa:                                                  // LD A,(nn)
+        *writes = IDLE_A;
+        return true;
+    case 0xf2:                                                  // LD A,(C)
+        *reads = IDLE_C;
+        *writes = IDLE_A;
+        return true;
+    case 0x0a:                                                  // LD A,(BC)
+    case 0x1a:                                                  // LD A,(DE)
+        *reads = (op == 0x0a) ? IDLE_B | IDLE_C : IDLE_D | IDLE_E;
+        *writes = IDLE_A;
+        return true;
+    case 0xcb:                                                  // BIT b,r
+        if (!IN_RANGE(instr->operand, 0x40, 0x7f))
+            return false;
+        *reads = idle_r8[instr->operand & 7];
+        *writes = IDLE_FZ;
+        return true;
+    }
+    return false;
+}
+
+static bool block_is_idle_loop(const struct block *block)
+{
+    const struct block_instr *branch = &block->instrs[block->count - 1];
+    unsigned reads, writes, written = 0, defined = 0;
+    uint8_t op = branch->opcode;
+    uint16_t target;
+
+    if (op == 0x18 || op == 0x20 || op == 0x28 || op == 0x30 || op == 0x38)
+        target = branch->pc + 2 + (int8_t)branch->operand;
+    else if (op == 0xc3 || op == 0xc2 || op == 0xca || op == 0xd2 || op == 0xda)
+        target = branch->operand;
+    else
+        return false;
+    if (target != block->instrs[0].pc)
+        return false;
+    for (int i = 0; i < block->count - 1; i++) {
+        if (!idle_instr(&block->instrs[i], &reads, &writes))
+            return false;
+        written |= writes;
+    }
+    // every value read must come from this iteration or never change
+    for (int i = 0; i < block->count - 1; i++) {
+        idle_instr(&block->instrs[i], &reads, &writes);
+        if (reads & written & ~defined)
+            return false;
+        defined |= writes;
+    }
+    if (op != 0x18 && op != 0xc3)
+        reads = (op & 0x10) ? IDLE_FC : IDLE_FZ;
+    else
+        reads = 0;
+    return !(reads & written & ~defined);
+}
+
+/* Memory whose contents only change in scheduler events or CPU writes. DIV
+   and TIMA are derived from the current time, so they are left out. */
+static bool idle_address(uint16_t addr)
+{
+    return IN_RANGE(addr, 0xc000, 0xdfff) || (addr >= 0xff00 && addr != 0xff04 && addr != 0xff05);
+}
+
+/* The address the instruction reads memory from, or -1 if it reads none */
+static int idle_read_address(struct gb *gb, const struct block_instr *instr)
+{
+    switch (instr->opcode) {
+    case 0xf0: return 0xff00 | instr->operand;
+    case 0xf2: return 0xff00 | gb->cpu.bc.c;
+    case 0xfa: return instr->operand;
+    case 0x0a: return gb->cpu.bc.val;
+    case 0x1a: return gb->cpu.de.val;
+    case 0xcb:
+        return ((instr->operand & 7) == 6) ? gb->cpu.hl.val : -1;
+    default:
+        return ((instr->opcode & 7) == 6 && IN_RANGE(instr->opcode, 0x40, 0xbf)) ? gb->cpu.hl.val : -1;
+    }
+}
+
+static bool idle_reads_ok(struct gb *gb, const struct block *block)
+{
+    int addr;
+
+    for (int i = 0; i < block->count - 1; i++) {
+        addr = idle_read_address(gb, &block->instrs[i]);
+        if (addr >= 0 && !idle_address(addr))
+            return false;
+    }
+    return true;
+}
+
+/* Count the I/O reads of the skipped iterations, which never reach io_read() */
+static void idle_count_reads(struct gb *gb, const struct block *block, uint64_t count)
+{
+    int addr;
+
+    for (int i = 0; i < block->count - 1; i++) {
+        addr = idle_read_address(gb, &block->instrs[i]);
+        if (addr >= 0xff00)
+            COUNTER_ADD(gb->stats.io_reads[addr & 0xff], count);
+    }
+}
+
+static void idle_loop_account(struct gb *gb, const struct block *block, int cycles)
+{
+    struct block_cache *cache = &gb->block_cache;
+    struct idle_loop *loop;
+
+    for (int i = 0; i < cache->idle_loop_count; i++) {
+        loop = &cache->idle_loops[i];
+        if (loop->key == block->key) {
+            loop->hits++;
+            loop->cycles += cycles;
+            return;
+        }
+    }
+    if (cache->idle_loop_count == IDLE_LOOP_MAX)
+        return;
+    loop = &cache->idle_loops[cache->idle_loop_count++];
+    loop->key = block->key;
+    loop->pc = block->instrs[0].pc;
+    loop->hits = 1;
+    loop->cycles = cycles;
+}
+
+/*
+ * Called every time the interpreter enters an idle block, with looped set
+ * when the previous block it ran was this one, start to end. If no event
+ * fired since that iteration started, tick the system up to the last
+ * iteration that still ends before the next event and return the machine
+ * cycles skipped. The interpreter then carries on with the block as usual.
+ */
+int block_idle_loop(struct gb *gb, struct block *block, bool looped)
+{
+    struct scheduler *scheduler = &gb->scheduler;
+    uint64_t next = gb->block_cache.idle_next, count;
+    int period = block->cycles + 1;     // taken branch
+
+    gb->block_cache.idle_next = scheduler->next;
+    if (!looped || next <= scheduler->now || !idle_reads_ok(gb, block))
+        return 0;
+    count = (scheduler->next - scheduler->now) / (period * 4);
+    if (count > IDLE_MAX_SKIP / period)
+        count = IDLE_MAX_SKIP / period;
+    if (!count)
+        return 0;
+    sm83_cycle(gb, count * period);
+    COUNTER_ADD(gb->cpu.instructions, count * block->count);
+    idle_count_reads(gb, block, count);
+    gb->block_cache.idle_next = scheduler->next;
+    idle_loop_account(gb, block, count * period);
+    return count * period;
+}
+
+const struct idle_loop *block_idle_loops(struct gb *gb, int *count)
+{
+    *count = gb->block_cache.idle_loop_count;
+    return gb->block_cache.idle_loops;
+}
+
+static void block_decode(struct gb *gb, struct block *block, uint32_t key, uint16_t pc)
+{
+    uint32_t end = block_region_end(pc);
+    struct block_instr *instr;
+
+    block->key = key;
+    block->count = 0;
+    block->cycles = 0;
+    block->native = NULL;
+    block->hits = 0;
+    block->recompiled = (key & BLOCK_KEY_RAM) ? NULL : recomp_find(gb, key);
+    while (block->count < BLOCK_MAX_INSTRS) {
+        instr = &block->instrs[block->count];
+        instr->pc = pc;
+        instr->opcode = bus_read(gb, pc);
+        instr->length = instr_length[instr->opcode];
+        if (pc + instr->length > end)
+            break;
+        if (instr->length == 2)
+            instr->operand = bus_read(gb, pc + 1);
+        else if (instr->length == 3)
+            instr->operand = TO_U16(bus_read(gb, pc + 1), bus_read(gb, pc + 2));
+        else
+            instr->operand = 0;
+        instr->cycles = (instr->opcode == 0xcb) ? cb_instr_cycle[instr->operand] : instr_cycle[instr->opcode];
+        if (key & BLOCK_KEY_RAM)
+            for (int i = 0; i < instr->length; i++)
+                block_watch(gb, pc + i);
+        block->cycles += instr->cycles;
+        block->count++;
+        pc += instr->length;
+        if (ends_block[instr->opcode])
+            break;
+    }
+    if (!block->count)
+        block->key = BLOCK_KEY_NONE;
+    block->idle = block->count && block_is_idle_loop(block);
+}
+
+void block_cache_init(struct gb *gb)
+{
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++)
+        gb->block_cache.blocks[i].key = BLOCK_KEY_NONE;
+    memset(gb->block_cache.wram_code, 0, sizeof(gb->block_cache.wram_code));
+    memset(gb->block_cache.hram_code, 0, sizeof(gb->block_cache.hram_code));
+    gb->block_cache.flush = true;
+    gb->block_cache.idle_loop_count = 0;
+}
+
+struct block *block_lookup(struct gb *gb, uint16_t pc)
+{
+    uint32_t key = block_key(gb, pc);
+    struct block *block;
+
+    if (key == BLOCK_KEY_NONE)
+        return NULL;
+    block = &gb->block_cache.blocks[(key ^ (key >> 11)) & (BLOCK_CACHE_SIZE - 1)];
+    if (block->key != key)
+        block_decode(gb, block, key, pc);
+    return (block->key == key) ? block : NULL;
+}
+
+/* Called when cached WRAM/HRAM code is overwritten. RAM code is rare and
+   short, so every RAM block is dropped rather than tracking which one owns
+   the byte. */
+void block_cache_invalidate_ram(struct gb *gb)
+{
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++)
+        if (gb->block_cache.blocks[i].key != BLOCK_KEY_NONE && (gb->block_cache.blocks[i].key & BLOCK_KEY_RAM))
+            gb->block_cache.blocks[i].key = BLOCK_KEY_NONE;
+    memset(gb->block_cache.wram_code, 0, sizeof(gb->block_cache.wram_code));
+    memset(gb->block_cache.hram_code, 0, sizeof(gb->block_cache.hram_code));
+    gb->block_cache.flush = true;
+    bus_unwatch_wram(gb);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gb.h"
+
+void block_cache_init(struct gb *gb);
+struct block *block_lookup(struct gb *gb, uint16_t pc);
+void block_cache_invalidate_ram(struct gb *gb);
+int block_idle_loop(struct gb *gb, struct block *block, bool looped);
+const struct idle_loop *block_idle_loops(struct gb *gb, int *count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,49 +1,11 @@
 #include "bus.h"
 
-enum BUS_REGION {
-    ROM = (1U << 0),
-    VRAM = (1U << 1),
-    ExRAM = (1U << 2),
-    WRAM = (1U << 3),
-    EcRAM = (1U << 4),
-    OAM = (1U << 5),
-    UNUSED = (1U << 6),
-    IO = (1U << 7),
-    HRAM = (1U << 8),
-};
-
-bool is_interrupt_reg(uint16_t addr)
-{
-    return (addr == INTR_REG_IE || addr == INTR_REG_IF);
-}
-
-bool is_timer_reg(uint16_t addr)
-{
-    return (addr == TIM_REG_DIV || addr == TIM_REG_TAC ||
-            addr == TIM_REG_TIMA || addr == TIM_REG_TMA);
-}
-
-bool is_ppu_reg(uint16_t addr)
-{
-    return (addr == PPU_REG_LCDC || addr == PPU_REG_STAT || addr == PPU_REG_SCY ||
-            addr == PPU_REG_SCX || addr == PPU_REG_LY || addr == PPU_REG_LYC ||
-            addr == PPU_REG_BGP || addr == PPU_REG_OBP0 || addr == PPU_REG_OBP1 ||
-            addr == PPU_REG_WY || addr == PPU_REG_WX);
-}
-
-bool is_apu_reg(uint16_t addr)
-{
-    return (addr == APU_REG_NR10 || addr == APU_REG_NR11 || addr == APU_REG_NR12 || addr == APU_REG_NR13 || addr == APU_REG_NR14 ||
-            addr == APU_REG_NR21 || addr == APU_REG_NR22 || addr == APU_REG_NR23 || addr == APU_REG_NR24 ||
-            addr == APU_REG_NR30 || addr == APU_REG_NR31 || addr == APU_REG_NR32 || addr == APU_REG_NR33 || addr == APU_REG_NR34 ||
-            addr == APU_REG_NR41 || addr == APU_REG_NR42 || addr == APU_REG_NR43 || addr == APU_REG_NR44 ||
-            addr == APU_REG_NR50 || addr == APU_REG_NR51 || addr == APU_REG_NR52);
-}
-
 /* write functions */
 void vram_write(struct gb *gb, uint16_t addr, uint8_t val)
 {
     gb->vram[addr - 0x8000] = val;
+    if (addr < 0x9800)
+        ppu_tile_write(gb, addr);
 }
 
 void exram_write(struct gb *gb, uint16_t addr, uint8_t val)
@@ -64,6 +26,8 @@ void exram_write(struct gb *gb, uint16_t addr, uint8_t val)
 void wram_write(struct gb *gb, uint16_t addr, uint8_t val)
 {
     gb->wram[addr - 0xc000] = val;
+    if (gb->block_cache.wram_code[addr - 0xc000])
+        block_cache_invalidate_ram(gb);
 }
 
 void ecram_write(struct gb *gb, uint16_t addr, uint8_t val)
@@ -74,7 +38,7 @@ void ecram_write(struct gb *gb, uint16_t addr, uint8_t val)
 
 void oam_write(struct gb *gb, uint16_t addr, uint8_t val)
 {
-    gb->oam[addr - 0xfe00] = val;
+    ppu_oam_write(gb, addr - 0xfe00, val);
 }
 
 void unused_write(struct gb *gb, uint16_t addr, uint8_t val)
@@ -82,27 +46,11 @@ void unused_write(struct gb *gb, uint16_t addr, uint8_t val)
     gb->unused[addr - 0xfea0] = val;
 }
 
-void io_write(struct gb *gb, uint16_t addr, uint8_t val)
-{
-    if (is_interrupt_reg(addr))
-        interrupt_write(gb, addr, val);
-    else if (is_timer_reg(addr))
-        timer_write(gb, addr, val);
-    else if (is_ppu_reg(addr))
-        ppu_write(gb, addr, val);
-    else if (addr == DMA_REG_DMA)
-        dma_write(gb, val);
-    else if (addr == JOYPAD_REG_JOYP)
-        joypad_write(gb, val);
-    else if (is_apu_reg(addr))
-        apu_regs_write(gb, addr, val);
-    else if (IN_RANGE(addr, 0xff30, 0xff3f))
-        apu_ram_write(gb, addr, val);
-}
-
 void hram_write(struct gb *gb, uint16_t addr, uint8_t val)
 {
     gb->hram[addr - 0xff80] = val;
+    if (gb->block_cache.hram_code[addr - 0xff80])
+        block_cache_invalidate_ram(gb);
 }
 
 /* read functions */
@@ -151,82 +99,211 @@ uint8_t unused_read(struct gb *gb, uint16_t addr)
     return gb->unused[addr - 0xfea0];
 }
 
-uint8_t io_read(struct gb *gb, uint16_t addr)
+uint8_t hram_read(struct gb *gb, uint16_t addr)
 {
-    uint8_t ret = 0xff;
+    return gb->hram[addr - 0xff80];
+}
 
-    if (is_interrupt_reg(addr))
-        ret = interrupt_read(gb, addr);
-    else if (is_timer_reg(addr))
-        ret = timer_read(gb, addr);
-    else if (is_ppu_reg(addr))
-        ret = ppu_read(gb, addr);
-    else if (addr == DMA_REG_DMA)
-        ret = dma_read(gb);
-    else if (addr == JOYPAD_REG_JOYP)
-        ret = joypad_read(gb);
-    else if (is_apu_reg(addr))
-        ret = apu_regs_read(gb, addr);
-    else if (IN_RANGE(addr, 0xff30, 0xff3f))
-        ret = apu_ram_read(gb, addr);
-    return ret;
+/* 0xfe00-0xfeff: OAM followed by the unusable area */
+void oam_page_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    if (addr <= 0xfe9f)
+        oam_write(gb, addr, val);
+    else
+        unused_write(gb, addr, val);
 }
 
-uint8_t hram_read(struct gb *gb, uint16_t addr)
+uint8_t oam_page_read(struct gb *gb, uint16_t addr)
+{
+    return (addr <= 0xfe9f) ? oam_read(gb, addr) : unused_read(gb, addr);
+}
+
+/* 0xff00-0xffff: I/O registers, HRAM and IE, dispatched per address.
+   Addresses without a register read as 0xff and ignore writes. */
+uint8_t io_unmapped_read(struct gb *gb, uint16_t addr)
+{
+    return 0xff;
+}
+
+void io_unmapped_write(struct gb *gb, uint16_t addr, uint8_t val)
 {
-    return gb->hram[addr - 0xff80];
 }
 
-uint16_t bus_get_mem_region(uint16_t addr)
-{
-    return ((IN_RANGE(addr, 0x0000, 0x7fff) << 0) |
-            (IN_RANGE(addr, 0x8000, 0x9fff) << 1) |
-            (IN_RANGE(addr, 0xa000, 0xbfff) << 2) |
-            (IN_RANGE(addr, 0xc000, 0xdfff) << 3) |
-            (IN_RANGE(addr, 0xe000, 0xfdff) << 4) |
-            (IN_RANGE(addr, 0xfe00, 0xfe9f) << 5) |
-            (IN_RANGE(addr, 0xfea0, 0xfeff) << 6) |
-            (IN_RANGE(addr, 0xff00, 0xff7f) << 7) |
-            (IN_RANGE(addr, 0xff80, 0xfffe) << 8) |
-            ((addr == 0xffff) << 7));
-}
-
-void (*write_function[])(struct gb *gb, uint16_t addr, uint8_t val) = {
-    [ROM] = rom_write,
-    [VRAM] = vram_write,
-    [ExRAM] = exram_write,
-    [WRAM] = wram_write,
-    [EcRAM] = ecram_write,
-    [OAM] = oam_write,
-    [UNUSED] = unused_write,
-    [IO] = io_write,
-    [HRAM] = hram_write,
+void (*io_write_function[0x100])(struct gb *gb, uint16_t addr, uint8_t val) = {
+    [0x00] = joypad_write,
+    [0x01 ... 0x03] = io_unmapped_write,
+    [0x04] = timer_div_write,
+    [0x05] = timer_tima_write,
+    [0x06] = timer_tma_write,
+    [0x07] = timer_tac_write,
+    [0x08 ... 0x0e] = io_unmapped_write,
+    [0x0f] = interrupt_if_write,
+    [0x10 ... 0x14] = apu_regs_write,
+    [0x15] = io_unmapped_write,
+    [0x16 ... 0x1e] = apu_regs_write,
+    [0x1f] = io_unmapped_write,
+    [0x20 ... 0x26] = apu_regs_write,
+    [0x27 ... 0x2f] = io_unmapped_write,
+    [0x30 ... 0x3f] = apu_ram_write,
+    [0x40] = ppu_lcdc_write,
+    [0x41] = ppu_stat_write,
+    [0x42] = ppu_scy_write,
+    [0x43] = ppu_scx_write,
+    [0x44] = io_unmapped_write,         /* LY is read-only */
+    [0x45] = ppu_lyc_write,
+    [0x46] = dma_write,
+    [0x47] = ppu_bgp_write,
+    [0x48] = ppu_obp0_write,
+    [0x49] = ppu_obp1_write,
+    [0x4a] = ppu_wy_write,
+    [0x4b] = ppu_wx_write,
+    [0x4c ... 0x7f] = io_unmapped_write,
+    [0x80 ... 0xfe] = hram_write,
+    [0xff] = interrupt_ie_write,
 };
 
-uint8_t (*read_function[])(struct gb *gb, uint16_t addr) = {
-    [ROM] = rom_read,
-    [VRAM] = vram_read,
-    [ExRAM] = exram_read,
-    [WRAM] = wram_read,
-    [EcRAM] = ecram_read,
-    [OAM] = oam_read,
-    [IO] = io_read,
-    [UNUSED] = unused_read,
-    [HRAM] = hram_read,
+uint8_t (*io_read_function[0x100])(struct gb *gb, uint16_t addr) = {
+    [0x00] = joypad_read,
+    [0x01 ... 0x03] = io_unmapped_read,
+    [0x04] = timer_div_read,
+    [0x05] = timer_tima_read,
+    [0x06] = timer_tma_read,
+    [0x07] = timer_tac_read,
+    [0x08 ... 0x0e] = io_unmapped_read,
+    [0x0f] = interrupt_if_read,
+    [0x10 ... 0x14] = apu_regs_read,
+    [0x15] = io_unmapped_read,
+    [0x16 ... 0x1e] = apu_regs_read,
+    [0x1f] = io_unmapped_read,
+    [0x20 ... 0x26] = apu_regs_read,
+    [0x27 ... 0x2f] = io_unmapped_read,
+    [0x30 ... 0x3f] = apu_ram_read,
+    [0x40] = ppu_lcdc_read,
+    [0x41] = ppu_stat_read,
+    [0x42] = ppu_scy_read,
+    [0x43] = ppu_scx_read,
+    [0x44] = ppu_ly_read,
+    [0x45] = ppu_lyc_read,
+    [0x46] = dma_read,
+    [0x47] = ppu_bgp_read,
+    [0x48] = ppu_obp0_read,
+    [0x49] = ppu_obp1_read,
+    [0x4a] = ppu_wy_read,
+    [0x4b] = ppu_wx_read,
+    [0x4c ... 0x7f] = io_unmapped_read,
+    [0x80 ... 0xfe] = hram_read,
+    [0xff] = interrupt_ie_read,
 };
 
+void io_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    COUNTER_ADD(gb->stats.io_writes[addr & 0xff], 1);
+    io_write_function[addr & 0xff](gb, addr, val);
+}
+
+uint8_t io_read(struct gb *gb, uint16_t addr)
+{
+    COUNTER_ADD(gb->stats.io_reads[addr & 0xff], 1);
+    return io_read_function[addr & 0xff](gb, addr);
+}
+
+/* Handlers for the pages that have no host pointer in the memory map */
+void (*write_function[0x100])(struct gb *gb, uint16_t addr, uint8_t val) = {
+    [0x00 ... 0x7f] = rom_write,
+    [0x80 ... 0x9f] = vram_write,
+    [0xa0 ... 0xbf] = exram_write,
+    [0xc0 ... 0xdf] = wram_write,
+    [0xe0 ... 0xfd] = ecram_write,
+    [0xfe] = oam_page_write,
+    [0xff] = io_write,
+};
+
+uint8_t (*read_function[0x100])(struct gb *gb, uint16_t addr) = {
+    [0x00 ... 0x7f] = rom_read,
+    [0x80 ... 0x9f] = vram_read,
+    [0xa0 ... 0xbf] = exram_read,
+    [0xc0 ... 0xdf] = wram_read,
+    [0xe0 ... 0xfd] = ecram_read,
+    [0xfe] = oam_page_read,
+    [0xff] = io_read,
+};
+
+/* Point the cartridge pages at the banks the MBC currently selects. ROM
+   writes always go to the MBC, so only the read side is mapped. */
+void bus_map_cartridge(struct gb *gb)
+{
+    uint8_t *rom_bank = mbc_get_rom_bank(gb);
+    uint8_t *ram_bank = mbc_get_ram_bank(gb);
+
+    for (int i = 0; i < 0x40; i++) {
+        gb->bus.read_map[i] = (rom_bank) ? gb->cart.rom + i * 0x100 : NULL;
+        gb->bus.read_map[i + 0x40] = (rom_bank) ? rom_bank + i * 0x100 : NULL;
+        gb->bus.write_map[i] = gb->bus.write_map[i + 0x40] = NULL;
+    }
+    for (int i = 0; i < 0x20; i++)
+        gb->bus.read_map[i + 0xa0] = gb->bus.write_map[i + 0xa0] = (ram_bank) ? ram_bank + i * 0x100 : NULL;
+    // the code behind the cartridge pages may have changed
+    gb->block_cache.flush = true;
+}
+
+/* Host memory behind a WRAM or echo RAM page */
+static uint8_t *bus_wram_page(struct gb *gb, int page)
+{
+    return (page <= 0xdf) ? gb->wram + (page - 0xc0) * 0x100 : gb->wram + ((page << 8) & 0xddff) - 0xc000;
+}
+
+/* Send writes to the WRAM page holding addr, through every page that
+   aliases it, to wram_write() so that cached code there gets invalidated.
+   bus_unwatch_wram() maps all of WRAM directly again. */
+void bus_watch_wram(struct gb *gb, uint16_t addr)
+{
+    uint8_t *page = gb->wram + ((addr - 0xc000) & ~0xff);
+
+    for (int i = 0xc0; i <= 0xfd; i++)
+        if (bus_wram_page(gb, i) == page)
+            gb->bus.write_map[i] = NULL;
+}
+
+void bus_unwatch_wram(struct gb *gb)
+{
+    for (int i = 0xc0; i <= 0xfd; i++)
+        gb->bus.write_map[i] = bus_wram_page(gb, i);
+}
+
+void bus_init(struct gb *gb)
+{
+    // tile data writes go through vram_write() to keep the decoded tiles current
+    for (int i = 0x80; i <= 0x9f; i++) {
+        gb->bus.read_map[i] = gb->vram + (i - 0x80) * 0x100;
+        gb->bus.write_map[i] = (i >= 0x98) ? gb->bus.read_map[i] : NULL;
+    }
+    for (int i = 0xc0; i <= 0xfd; i++)
+        gb->bus.read_map[i] = gb->bus.write_map[i] = bus_wram_page(gb, i);
+    gb->bus.read_map[0xfe] = gb->bus.write_map[0xfe] = NULL;
+    gb->bus.read_map[0xff] = gb->bus.write_map[0xff] = NULL;
+    bus_map_cartridge(gb);
+}
+
 uint8_t bus_read(struct gb *gb, uint16_t addr)
 {
-    return read_function[bus_get_mem_region(addr)](gb, addr);
+    uint8_t *page = gb->bus.read_map[addr >> 8];
+
+    if (page)
+        return page[addr & 0xff];
+    return read_function[addr >> 8](gb, addr);
 }
 
 uint8_t dma_get_data(struct gb *gb, uint16_t addr)
 {
-    return read_function[bus_get_mem_region(addr)](gb, addr);
+    return bus_read(gb, addr);
 }
 
 void bus_write(struct gb *gb, uint16_t addr, uint8_t val)
 {
-    write_function[bus_get_mem_region(addr)](gb, addr, val);
+    uint8_t *page = gb->bus.write_map[addr >> 8];
 
+    if (page)
+        page[addr & 0xff] = val;
+    else
+        write_function[addr >> 8](gb, addr, val);
 }
\ No newline at end of file
@@ -13,8 +13,15 @@ extern "C" {
 #include "joypad.h"
 #include "mbc.h"
 #include "apu.h"
+#include "block.h"
 
+void bus_init(struct gb *gb);
+void bus_map_cartridge(struct gb *gb);
+void bus_watch_wram(struct gb *gb, uint16_t addr);
+void bus_unwatch_wram(struct gb *gb);
 uint8_t dma_get_data(struct gb *gb, uint16_t addr);
+uint8_t io_read(struct gb *gb, uint16_t addr);
+void io_write(struct gb *gb, uint16_t addr, uint8_t val);
 uint8_t bus_read(struct gb *gb, uint16_t addr);
 void bus_write(struct gb *gb, uint16_t addr, uint8_t val);
 
@@ -0,0 +1,272 @@
+#include "callstack.h"
+#include "sm83.h"
+
+/*
+ * Guest call-stack sampling for SM83_PROFILE builds. CALL, RST and interrupt
+ * entry push a frame for the routine entered, RET and RETI pop it, and every
+ * period T-cycles the interpreter records the frames currently on the stack.
+ * Samples are aggregated by stack and written in the folded format read by
+ * flamegraph.pl and similar tools, one "outer;inner;leaf count" per line.
+ *
+ * Frames remember the guest SP pointing at their return address rather than
+ * trusting calls and returns to pair up: a routine that drops its return
+ * address, or a RET used as a computed jump, only loses the frames whose
+ * return address is no longer on the guest stack. ROM routines are keyed by
+ * offset in the ROM image like block keys, so banks are told apart.
+ */
+
+#define RAM_KEY     (2 * MiB)
+
+static uint32_t callstack_key(struct gb *gb, uint16_t pc)
+{
+    uint8_t *page;
+
+    if (pc < 0x8000 && (page = gb->bus.read_map[pc >> 8]))
+        return page + (pc & 0xff) - gb->cart.rom;
+    return RAM_KEY + (pc & 0x7fff);
+}
+
+bool callstack_start(struct gb *gb, uint64_t period)
+{
+    struct callstack *cs;
+
+    if (!period || (!gb->callstack && !(gb->callstack = calloc(1, sizeof(*gb->callstack)))))
+        return false;
+    cs = gb->callstack;
+    cs->period = period;
+    cs->next = gb->scheduler.now + period;
+    // the code running now is the root, it never returns
+    cs->frames[0].key = callstack_key(gb, gb->cpu.pc);
+    cs->frames[0].sp = 0x10000;
+    cs->depth = 1;
+    return true;
+}
+
+void callstack_free(struct gb *gb)
+{
+    struct callstack *cs = gb->callstack;
+
+    if (!cs)
+        return;
+    free(cs->samples);
+    free(cs->keys);
+    free(cs->buckets);
+    free(cs);
+    gb->callstack = NULL;
+}
+
+/* Called once the return address is pushed and PC points at the routine */
+void callstack_enter(struct gb *gb)
+{
+    struct callstack *cs = gb->callstack;
+
+    // frames whose return address got overwritten were left without a RET
+    while (cs->depth > 1 && cs->frames[cs->depth - 1].sp <= gb->cpu.sp)
+        cs->depth--;
+    if (cs->depth == CALLSTACK_DEPTH)
+        return;
+    cs->frames[cs->depth].key = callstack_key(gb, gb->cpu.pc);
+    cs->frames[cs->depth].sp = gb->cpu.sp;
+    cs->depth++;
+}
+
+/* Called once a return address is popped */
+void callstack_leave(struct gb *gb)
+{
+    struct callstack *cs = gb->callstack;
+
+    while (cs->depth > 1 && cs->frames[cs->depth - 1].sp < gb->cpu.sp)
+        cs->depth--;
+}
+
+static uint32_t callstack_hash(const struct callstack *cs)
+{
+    uint32_t hash = 0x811c9dc5;
+
+    for (int i = 0; i < cs->depth; i++)
+        hash = (hash ^ cs->frames[i].key) * 0x01000193;
+    return hash;
+}
+
+static bool callstack_same(const struct callstack *cs, const struct callstack_sample *sample)
+{
+    if (sample->depth != (uint32_t)cs->depth)
+        return false;
+    for (int i = 0; i < cs->depth; i++)
+        if (cs->keys[sample->first + i] != cs->frames[i].key)
+            return false;
+    return true;
+}
+
+static bool callstack_grow(struct callstack *cs)
+{
+    uint32_t cnt = cs->bucket_cnt ? cs->bucket_cnt * 2 : 1024;
+    uint32_t *buckets = calloc(cnt, sizeof(*buckets));
+
+    if (!buckets)
+        return false;
+    for (uint32_t i = 0; i < cs->sample_cnt; i++) {
+        const struct callstack_sample *sample = &cs->samples[i];
+        uint32_t hash = 0x811c9dc5;
+
+        for (uint32_t j = 0; j < sample->depth; j++)
+            hash = (hash ^ cs->keys[sample->first + j]) * 0x01000193;
+        while (buckets[hash & (cnt - 1)])
+            hash++;
+        buckets[hash & (cnt - 1)] = i + 1;
+    }
+    free(cs->buckets);
+    cs->buckets = buckets;
+    cs->bucket_cnt = cnt;
+    return true;
+}
+
+static struct callstack_sample *callstack_find(struct callstack *cs)
+{
+    struct callstack_sample *sample;
+    uint32_t hash, idx;
+    void *p;
+
+    if (cs->sample_cnt * 2 >= cs->bucket_cnt && !callstack_grow(cs))
+        return NULL;
+    for (hash = callstack_hash(cs); (idx = cs->buckets[hash & (cs->bucket_cnt - 1)]); hash++)
+        if (callstack_same(cs, &cs->samples[idx - 1]))
+            return &cs->samples[idx - 1];
+
+    if (cs->sample_cnt == cs->sample_cap) {
+        if (!(p = realloc(cs->samples, (cs->sample_cap * 2 + 256) * sizeof(*cs->samples))))
+            return NULL;
+        cs->samples = p;
+        cs->sample_cap = cs->sample_cap * 2 + 256;
+    }
+    if (cs->key_cnt + cs->depth > cs->key_cap) {
+        if (!(p = realloc(cs->keys, (cs->key_cap * 2 + 4096) * sizeof(*cs->keys))))
+            return NULL;
+        cs->keys = p;
+        cs->key_cap = cs->key_cap * 2 + 4096;
+    }
+    sample = &cs->samples[cs->sample_cnt++];
+    sample->count = 0;
+    sample->first = cs->key_cnt;
+    sample->depth = cs->depth;
+    for (int i = 0; i < cs->depth; i++)
+        cs->keys[cs->key_cnt++] = cs->frames[i].key;
+    cs->buckets[hash & (cs->bucket_cnt - 1)] = cs->sample_cnt;
+    return sample;
+}
+
+/* An instruction taking the given T-cycles is retiring: record the stack
+   once for every sampling point it covers, a long HALT counting several times */
+void callstack_sample(struct gb *gb, uint64_t cycles)
+{
+    struct callstack *cs = gb->callstack;
+    struct callstack_sample *sample;
+    uint64_t end = gb->scheduler.now + cycles, n;
+
+    if (end < cs->next)
+        return;
+    n = (end - cs->next) / cs->period + 1;
+    cs->next += n * cs->period;
+    if ((sample = callstack_find(cs)))
+        sample->count += n;
+}
+
+struct sym {
+    uint32_t key;
+    char name[64];
+};
+
+static int sym_cmp(const void *a, const void *b)
+{
+    const struct sym *x = a, *y = b;
+
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/* Read an RGBDS .sym file, "bank:address name" per line, sorted by key */
+static bool sym_load(const char *path, struct sym **out, int *cnt)
+{
+    struct sym *syms = NULL, *p;
+    unsigned bank, addr;
+    char line[256], name[64];
+    int cap = 0;
+    FILE *f;
+
+    *cnt = 0;
+    if (!(f = fopen(path, "r")))
+        return false;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, " %x:%x %63[^ \t\r\n;]", &bank, &addr, name) != 3 || addr > 0xffff)
+            continue;
+        if (*cnt == cap) {
+            if (!(p = realloc(syms, (cap * 2 + 256) * sizeof(*syms))))
+                break;
+            syms = p;
+            cap = cap * 2 + 256;
+        }
+        if (addr >= 0x8000)
+            syms[*cnt].key = RAM_KEY + (addr & 0x7fff);
+        else if (addr >= 0x4000)
+            syms[*cnt].key = bank * 0x4000 + (addr & 0x3fff);
+        else
+            syms[*cnt].key = addr;
+        snprintf(syms[*cnt].name, sizeof(syms[*cnt].name), "%s", name);
+        (*cnt)++;
+    }
+    fclose(f);
+    if (*cnt)
+        qsort(syms, *cnt, sizeof(*syms), sym_cmp);
+    *out = syms;
+    return true;
+}
+
+/* The closest symbol at or below the key in the same bank, or bank:address */
+static void callstack_name(uint32_t key, const struct sym *syms, int cnt, char *buf, size_t size)
+{
+    int lo = 0, hi = cnt;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (syms[mid].key <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo && (syms[lo - 1].key >> 14) == (key >> 14)) {
+        if (syms[lo - 1].key == key)
+            snprintf(buf, size, "%s", syms[lo - 1].name);
+        else
+            snprintf(buf, size, "%s+%u", syms[lo - 1].name, key - syms[lo - 1].key);
+    } else if (key >= RAM_KEY) {
+        snprintf(buf, size, "%04x", 0x8000 + key - RAM_KEY);
+    } else {
+        snprintf(buf, size, "%02x:%04x", key >> 14, (key < 0x4000) ? key : 0x4000 | (key & 0x3fff));
+    }
+}
+
+/* Write the samples in folded format, naming frames from the .sym file if
+   one is given */
+bool callstack_write(struct gb *gb, FILE *f, const char *sym_path)
+{
+    struct callstack *cs = gb->callstack;
+    struct sym *syms = NULL;
+    char name[80];
+    int sym_cnt = 0;
+
+    if (!cs)
+        return false;
+    if (sym_path && !sym_load(sym_path, &syms, &sym_cnt))
+        fprintf(stderr, "cannot read symbols from %s\n", sym_path);
+    for (uint32_t i = 0; i < cs->sample_cnt; i++) {
+        const struct callstack_sample *sample = &cs->samples[i];
+
+        for (uint32_t j = 0; j < sample->depth; j++) {
+            callstack_name(cs->keys[sample->first + j], syms, sym_cnt, name, sizeof(name));
+            fprintf(f, "%s%s", j ? ";" : "", name);
+        }
+        fprintf(f, " %llu\n", (unsigned long long)sample->count);
+    }
+    free(syms);
+    return !ferror(f);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gb.h"
+
+#ifdef SM83_PROFILE
+#define CALLSTACK_ENTER(gb)     do { if ((gb)->callstack) callstack_enter(gb); } while (0)
+#define CALLSTACK_LEAVE(gb)     do { if ((gb)->callstack) callstack_leave(gb); } while (0)
+#else
+#define CALLSTACK_ENTER(gb)     do { } while (0)
+#define CALLSTACK_LEAVE(gb)     do { } while (0)
+#endif
+
+bool callstack_start(struct gb *gb, uint64_t period);
+void callstack_free(struct gb *gb);
+void callstack_enter(struct gb *gb);
+void callstack_leave(struct gb *gb);
+void callstack_sample(struct gb *gb, uint64_t cycles);
+bool callstack_write(struct gb *gb, FILE *f, const char *sym_path);
+
+#ifdef __cplusplus
+}
+#endif
@@ -108,41 +108,63 @@ void cartridge_print_info(struct gb *gb)
     printf("bank size: %d\n", gb->cart.infos.bank_size);
 }
 
-void cartridge_load(struct gb *gb, char *cartridge_path)
+/* Load a ROM file without printing anything but errors. Returns false, with
+   no cartridge left loaded, if the file cannot be read. */
+bool cartridge_load(struct gb *gb, const char *cartridge_path)
 {
     FILE *fp = NULL;
     long file_size;
 
-    if (cartridge_path != NULL) {
-        fp = fopen(cartridge_path, "r");
-        if (!fp) {
-            printf("The cartridge path is wrong\n");
-            goto file_not_found;
-        }
-        fseek(fp, 0, SEEK_END);
-        file_size = ftell(fp);
-        rewind(fp);
-        if (fread(gb->cart.rom, 1, file_size, fp) != file_size)
-            goto read_failed;
-        printf("cartridge loaded\n");
-        gb->cart.cartridge_loaded = true;
-        cartridge_get_infos(gb);
-        cartridge_print_info(gb);
-        mbc_init(gb);
+    gb->cart.cartridge_loaded = false;
+    if (cartridge_path == NULL)
+        return false;
+    fp = fopen(cartridge_path, "rb");
+    if (!fp) {
+        fprintf(stderr, "cannot open cartridge %s\n", cartridge_path);
+        return false;
     }
-
-file_not_found:
+    fseek(fp, 0, SEEK_END);
+    file_size = ftell(fp);
+    rewind(fp);
+    if (file_size <= 0x150 || file_size > (long)sizeof(gb->cart.rom) ||
+        fread(gb->cart.rom, 1, file_size, fp) != (size_t)file_size)
+        goto read_failed;
+    gb->cart.cartridge_loaded = true;
+    cartridge_get_infos(gb);
+    mbc_init(gb);
     fclose(fp);
-    return;    
+    return true;
 read_failed:
-    fprintf(stderr, "Read failed\n");
+    fprintf(stderr, "cannot read cartridge %s\n", cartridge_path);
     fclose(fp);
-    exit(EXIT_FAILURE);
+    // whatever was read over the old image is not a ROM either
+    memset(gb->cart.rom, 0, sizeof(gb->cart.rom));
+    return false;
+}
+
+/* Load a ROM image that is already in memory, without printing anything */
+void cartridge_load_buffer(struct gb *gb, const uint8_t *data, size_t size)
+{
+    if (size > sizeof(gb->cart.rom))
+        size = sizeof(gb->cart.rom);
+    memcpy(gb->cart.rom, data, size);
+    gb->cart.cartridge_loaded = true;
+    cartridge_get_infos(gb);
+    mbc_init(gb);
 }
 
 void rom_write(struct gb *gb, uint16_t addr, uint8_t val)
 {
+    uint8_t *rom_bank = gb->bus.read_map[0x40], *ram_bank = gb->bus.read_map[0xa0];
+
     write_func[gb->cart.infos.type](gb, addr, val);
+    bus_map_cartridge(gb);
+    COUNTER_ADD(gb->stats.mbc_writes, 1);
+    if (gb->bus.read_map[0x40] != rom_bank)
+        COUNTER_ADD(gb->stats.rom_bank_switches, 1);
+    // enabling or disabling RAM is not a switch
+    if (gb->bus.read_map[0xa0] != ram_bank && gb->bus.read_map[0xa0] && ram_bank)
+        COUNTER_ADD(gb->stats.ram_bank_switches, 1);
 }
 
 uint8_t rom_read(struct gb *gb, uint16_t addr)
@@ -166,6 +188,7 @@ void load_state_after_booting(struct gb *gb)
     struct apu *apu = &gb->apu;
 
     gb->mode = NORMAL;
+    scheduler_init(gb);
     if (!gb->volume_set)
         gb->user_volume = 7;
 
@@ -174,10 +197,12 @@ void load_state_after_booting(struct gb *gb)
     cpu->af.a = 0x01;
     cpu->af.flag.z = 1;
     cpu->af.flag.n = 0;
+    cpu->lazy.op = FLAGS_SYNCED;
     cpu->bc.val = 0x0013;
     cpu->de.val = 0x00d8;
     cpu->hl.val = 0x014d;
     cpu->sp = 0xfffe; 
+    __atomic_store_n(&cpu->instructions, 0, __ATOMIC_RELAXED);
 
     // interrupt
     interrupt->flag = 0xe1;
@@ -189,6 +214,7 @@ void load_state_after_booting(struct gb *gb)
     timer->tma = 0x00;
     timer->tac.val = 0xf8;
     timer->old_edge = 0;
+    timer->last_sync = gb->scheduler.now;
 
     // ppu
     ppu->lcdc.val = 0x91;
@@ -198,9 +224,11 @@ void load_state_after_booting(struct gb *gb)
     ppu->ly = 0x00;
     ppu->lyc = 0x00;
     ppu->bgp = 0xfc;
+    ppu_update_palettes(gb);
     ppu->wy = 0x00;
     ppu->wx = 0x00;
     ppu->ticks = 0;
+    ppu->line_start = gb->scheduler.now;
     ppu->mode = OAM_SCAN;
     memset(ppu->frame_buffer, COLOR_WHITE, SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
     ppu->frame_ready = false;
@@ -215,6 +243,7 @@ void load_state_after_booting(struct gb *gb)
     // dma
     dma->mode = OFF;
     dma->reg = 0xff;
+    dma->index = 0;
 
     // joypad
     joypad->a = 1;
@@ -239,12 +268,20 @@ void load_state_after_booting(struct gb *gb)
     mbc->mbc3.rom_bank = 0;
     mbc->mbc3.ram_bank = 0;
 
+    // memory map
+    bus_init(gb);
+    recomp_attach(gb);
+    block_cache_init(gb);
+    for (size_t i = 0; i < sizeof(gb->stats) / sizeof(uint64_t); i++)
+        __atomic_store_n((uint64_t *)&gb->stats + i, 0, __ATOMIC_RELAXED);
+
 
 
     // TODO: update each channel after booting status 
     //       when implementing them. 
 
     apu->tick = 0;
+    apu->last_sync = gb->scheduler.now;
     apu->frame_sequencer = 0;
 
     // apu square1
@@ -340,4 +377,9 @@ void load_state_after_booting(struct gb *gb)
     apu->sample_buffer.ptr = 0;
     memset(apu->sample_buffer.buf, 0, BUFFER_SIZE * sizeof(int16_t));
     apu->sample_buffer.is_full = false;
+
+    // scheduler
+    timer_schedule(gb);
+    ppu_schedule(gb, false);
+    apu_schedule(gb);
 }
\ No newline at end of file
@@ -7,8 +7,13 @@ extern "C" {
 #include "gb.h"
 #include "mbc.h"
 #include "apu.h"
+#include "timer.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "bus.h"
 
-void cartridge_load(struct gb *gb, char *cartridge_path);
+bool cartridge_load(struct gb *gb, const char *cartridge_path);
+void cartridge_load_buffer(struct gb *gb, const uint8_t *data, size_t size);
 void cartridge_get_infos(struct gb *gb);
 void cartridge_print_info(struct gb *gb);
 void load_state_after_booting(struct gb *gb);
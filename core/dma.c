@@ -1,18 +1,37 @@
 #include "dma.h"
+#include "bus.h"
+#include "ppu.h"
 
-void dma_write(struct gb *gb, uint8_t val)
+void dma_write(struct gb *gb, uint16_t addr, uint8_t val)
 {
     gb->dma.reg = val;
     gb->dma.mode = WAITING;
     gb->dma.start_addr = TO_U16(0x00, val);
+    gb->dma.index = 0;
+    COUNTER_ADD(gb->stats.oam_dmas, 1);
+    // the transfer advances at the end of every M-cycle
+    scheduler_schedule(gb, EVENT_DMA, (gb->scheduler.now & ~3ULL) + 4);
 }
 
-uint8_t dma_read(struct gb *gb)
+uint8_t dma_read(struct gb *gb, uint16_t addr)
 {
     return gb->dma.reg;
 }
 
-void dma_transfer(struct gb *gb)
+void dma_event(struct gb *gb)
 {
-
-}
\ No newline at end of file
+    switch (gb->dma.mode) {
+    case WAITING:
+        gb->dma.mode = TRANSFERING;
+        break;
+    case TRANSFERING:
+        ppu_oam_write(gb, gb->dma.index, dma_get_data(gb, gb->dma.start_addr + gb->dma.index));
+        if (gb->dma.index++ == 0x9f)
+            gb->dma.mode = OFF;
+        break;
+    default:
+        break;
+    }
+    if (gb->dma.mode != OFF)
+        scheduler_schedule(gb, EVENT_DMA, gb->scheduler.now + 4);
+}
@@ -5,13 +5,14 @@ extern "C" {
 #endif
 
 #include "gb.h"
+#include "scheduler.h"
 
 #define DMA_REG_DMA                     0xff46
 #define OAM_DMA_ADDR                    0xfe00
 
-void dma_write(struct gb *gb, uint8_t val);
-uint8_t dma_read(struct gb *gb);
-void dma_transfer(struct gb *gb);
+void dma_write(struct gb *gb, uint16_t addr, uint8_t val);
+uint8_t dma_read(struct gb *gb, uint16_t addr);
+void dma_event(struct gb *gb);
 
 #ifdef __cplusplus
 }
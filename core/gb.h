@@ -40,6 +40,15 @@ typedef enum {
     STOP
 } gb_mode_t;
 
+typedef enum {
+    FLAGS_SYNCED,
+    FLAGS_ADD,
+    FLAGS_SUB,
+    FLAGS_INC,
+    FLAGS_DEC,
+    FLAGS_LOGIC,
+} flags_op_t;
+
 typedef enum {
     HBLANK,
     VBLANK,
@@ -53,6 +62,14 @@ typedef enum {
     TRANSFERING,
 } dma_mode_t;
 
+typedef enum {
+    EVENT_TIMER,
+    EVENT_PPU,
+    EVENT_APU,
+    EVENT_DMA,
+    EVENT_MAX,
+} event_t;
+
 typedef enum {
     SQUARE1 = 1,
     SQUARE2 = 2,
@@ -109,6 +126,19 @@ struct sm83 {
 
     uint16_t sp;
     uint16_t pc;
+
+    /* the last flag-setting ALU operation, F is only brought up to date
+       when something reads it (see flags_sync() in sm83.c) */
+    struct {
+        uint8_t op;
+        uint8_t a;
+        uint8_t b;
+        uint8_t c;
+    } lazy;
+
+    /* instructions retired since power-on, fast-forwarded idle loop
+       iterations included */
+    uint64_t instructions;
 };
 
 struct cartridge {
@@ -155,6 +185,7 @@ struct timer {
         };
     } tac;
     bool old_edge;
+    uint64_t last_sync;
 };
 
 struct oam_entry {
@@ -212,9 +243,13 @@ struct ppu {
     uint8_t wy;
     uint8_t wx;
     uint16_t ticks;
+    uint64_t line_start;
     ppu_mode_t mode;
     uint32_t frame_buffer[SCREEN_HEIGHT * SCREEN_WIDTH];
     bool frame_ready;
+    /* One bit per OAM entry whose Y puts a 16 pixel tall sprite on the line,
+       kept up to date by ppu_oam_write() */
+    uint64_t line_sprites[SCREEN_HEIGHT];
     struct oam_entry oam_entry[10];
     uint8_t oam_entry_cnt : 4;
     uint8_t sprite_cnt : 4;
@@ -234,12 +269,20 @@ struct ppu {
     bool window_in_frame;
     int window_line_cnt;
     bool draw_window_this_line;
+    /* VRAM tile data decoded to one colour ID per pixel, kept up to date by
+       ppu_tile_write(); tiles_flipped holds every row mirrored for sprites */
+    uint8_t tiles[384][8][8];
+    uint8_t tiles_flipped[384][8][8];
+    /* OBP0, OBP1 and BGP resolved to output colours, indexed by palette_t
+       and colour ID, rebuilt whenever a palette register is written */
+    uint32_t colors[3][4];
 };
 
 struct dma {
     dma_mode_t mode;
     uint16_t reg;
     uint16_t start_addr;
+    uint8_t index;
 };
 
 struct joypad {
@@ -347,6 +390,7 @@ struct apu_channel {
 
 struct apu {
     int tick;
+    uint64_t last_sync;
     bool is_active;
     uint8_t master_volume_left : 3;
     uint8_t master_volume_right : 3;
@@ -364,6 +408,184 @@ struct apu {
     uint16_t wave_ram[16];
 };
 
+struct bus {
+    uint8_t *read_map[0x100];
+    uint8_t *write_map[0x100];
+};
+
+struct scheduler {
+    uint64_t now;
+    uint64_t next;
+    uint64_t events[EVENT_MAX];
+};
+
+#define BLOCK_CACHE_SIZE            2048
+#define BLOCK_MAX_INSTRS            16
+#define BLOCK_KEY_NONE              UINT32_MAX
+#define BLOCK_KEY_RAM               0x80000000
+#define IDLE_LOOP_MAX               32
+
+struct block_instr {
+    uint16_t pc;
+    uint16_t operand;
+    uint8_t opcode;
+    uint8_t length;
+    uint8_t cycles;
+};
+
+struct gb;
+
+struct block {
+    uint32_t key;
+    uint8_t count;
+    uint8_t cycles;
+    struct block_instr instrs[BLOCK_MAX_INSTRS];
+    /* native translation of the first native_count instructions, see jit.c */
+    int (*native)(struct gb *gb, int budget, int index);
+    uint8_t native_count;
+    uint8_t hits;
+    /* ahead-of-time compiled code for this address, see recomp.c */
+    bool (*recompiled)(struct gb *gb);
+    /* side-effect-free polling loop, see block_idle_loop() */
+    bool idle;
+};
+
+/* Number of times a polling loop was fast-forwarded, for the frontend */
+struct idle_loop {
+    uint32_t key;
+    uint16_t pc;
+    uint64_t hits;
+    uint64_t cycles;
+};
+
+struct block_cache {
+    struct block blocks[BLOCK_CACHE_SIZE];
+    bool wram_code[0x2000];
+    bool hram_code[0x7f];
+    bool flush;
+    uint64_t idle_next;
+    struct idle_loop idle_loops[IDLE_LOOP_MAX];
+    int idle_loop_count;
+};
+
+#define JIT_CODE_SIZE               (1 * MiB)
+#define JIT_HOT_THRESHOLD           8
+
+struct jit {
+    uint8_t *code;
+    size_t used;
+    bool enabled;
+    uint8_t flags[0x100];           // F from the host flags in AH after LAHF
+};
+
+/*
+ * The emulation thread is the only writer of the counters below and of
+ * cpu.instructions. It updates them with relaxed atomic stores, and
+ * gb_get_stats() reads them with relaxed atomic loads, so they can be read
+ * from another thread while the instance runs without a data race or torn
+ * 64-bit values.
+ */
+#define COUNTER_ADD(counter, n)     __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+/*
+ * Always-on counters, since the last reset, read through gb_get_stats().
+ * io_reads and io_writes are indexed by address & 0xff over 0xff00-0xffff,
+ * so 0x80-0xfe count HRAM accesses and 0xff IE accesses. A bank switch is
+ * an MBC write that changes the bank mapped, mbc_writes counts them all.
+ */
+struct gb_stats {
+    uint64_t instructions;
+    uint64_t io_reads[0x100];
+    uint64_t io_writes[0x100];
+    uint64_t mbc_writes;
+    uint64_t rom_bank_switches;
+    uint64_t ram_bank_switches;
+    uint64_t oam_dmas;
+    uint64_t interrupts[5];         // VBlank, STAT, timer, serial, joypad
+    uint64_t frames;
+    uint64_t samples;
+    uint64_t halt_cycles;           // T-cycles spent halted
+};
+
+/* Counters kept by an SM83_PROFILE build, see sm83_profile() */
+#define PROFILE_OPCODES             0x200                       // 0x100-0x1ff: CB-prefixed
+#define PROFILE_ROM_BANKS           128
+#define PROFILE_BANKS               (PROFILE_ROM_BANKS + 4)     // then VRAM, SRAM, WRAM, HRAM
+#define PROFILE_PCS                 (2 * MiB + 0x8000)          // ROM offsets, then 0x8000-0xffff
+
+struct profile_counter {
+    uint64_t count;
+    uint64_t cycles;
+};
+
+struct profile {
+    uint64_t instructions;
+    struct profile_counter opcodes[PROFILE_OPCODES];
+    struct profile_counter banks[PROFILE_BANKS];
+    struct profile_counter pcs[PROFILE_PCS];
+};
+
+/* Shadow call stack sampled by an SM83_PROFILE build, see callstack.c */
+#define CALLSTACK_DEPTH             64
+
+struct callstack_frame {
+    uint32_t key;                   // ROM offset of the routine, or 2 MiB + address
+    uint32_t sp;                    // guest SP pointing at its return address
+};
+
+struct callstack_sample {
+    uint64_t count;
+    uint32_t first;                 // outermost frame, index in keys
+    uint32_t depth;
+};
+
+struct callstack {
+    struct callstack_frame frames[CALLSTACK_DEPTH];
+    int depth;
+    uint64_t period;
+    uint64_t next;
+    struct callstack_sample *samples;
+    uint32_t sample_cnt;
+    uint32_t sample_cap;
+    uint32_t *keys;
+    uint32_t key_cnt;
+    uint32_t key_cap;
+    uint32_t *buckets;              // sample index + 1, 0 when free
+    uint32_t bucket_cnt;
+};
+
+/* Host timestamps recorded by a GBDA_TRACE build, see trace.c */
+struct trace_event {
+    uint64_t start;                 // host nanoseconds
+    uint64_t end;
+    uint8_t phase;                  // enum trace_phase
+};
+
+/* Enough events for about 40 s of emulation */
+#define TRACE_CAPACITY              (1 << 21)
+
+struct trace {
+    struct trace_event *events;
+    size_t count;
+    size_t capacity;
+    uint64_t dropped;
+    uint64_t origin;
+};
+
+/* Code generated by gbda-recomp for one ROM, keyed by ROM offset */
+struct recomp_block {
+    uint32_t offset;
+    bool (*run)(struct gb *gb);
+};
+
+struct recomp_rom {
+    uint8_t header_checksum;
+    uint16_t global_checksum;
+    const struct recomp_block *blocks;
+    int count;
+    struct recomp_rom *next;
+};
+
 struct gb {
     uint8_t vram[0x2000];
     uint8_t extern_ram[8 * KiB];
@@ -382,8 +604,20 @@ struct gb {
     struct joypad joypad;
     struct mbc mbc;
     struct apu apu;
+    struct bus bus;
+    struct scheduler scheduler;
+    struct gb_stats stats;
+    struct block_cache block_cache;
+    struct jit jit;
+    struct profile *profile;
+    struct callstack *callstack;
+    struct trace *trace;
+    const struct recomp_rom *recomp;
     int screen_scaler;
-    int executed_cycle;
     int user_volume;
     bool volume_set;
+    uint32_t user_palette[4];
+    bool palette_set;
+    bool print_idle_loops;
+    const char *trace_path;
 };
\ No newline at end of file
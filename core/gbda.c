@@ -0,0 +1,179 @@
+#include "gbda.h"
+#include "sm83.h"
+#include "cartridge.h"
+
+struct gb *gb_create(void)
+{
+    struct gb *gb = calloc(1, sizeof(*gb));
+
+    if (!gb)
+        return NULL;
+    sm83_init(gb);
+    return gb;
+}
+
+/* Load a ROM and power the system on. Returns false if it cannot be read. */
+bool gb_load(struct gb *gb, const char *rom_path)
+{
+    if (!cartridge_load(gb, rom_path))
+        return false;
+    gb_reset(gb);
+    return true;
+}
+
+/* Same, for a ROM image already in memory. The image is copied. */
+void gb_load_rom(struct gb *gb, const uint8_t *rom, size_t size)
+{
+    cartridge_load_buffer(gb, rom, size);
+    gb_reset(gb);
+}
+
+/* Back to the state the boot ROM leaves behind, keeping the loaded ROM */
+void gb_reset(struct gb *gb)
+{
+    load_state_after_booting(gb);
+}
+
+/* Run until the next frame is complete. Audio samples are dropped; a
+   frontend that plays sound drives sm83_run() itself. */
+void gb_run_frame(struct gb *gb)
+{
+    gb->ppu.frame_ready = false;
+    while (!gb->ppu.frame_ready) {
+        gb->apu.sample_buffer.is_full = false;
+        sm83_run(gb);
+    }
+}
+
+/* Run for exactly the given number of T-cycles, or the first instruction
+   boundary past it. Audio samples are dropped as in gb_run_frame(). */
+void gb_run_cycles(struct gb *gb, uint64_t cycles)
+{
+    uint64_t until = gb->scheduler.now + cycles;
+
+    // sm83_run() returns at least once per frame
+    while (gb->scheduler.now + 70224 < until) {
+        gb->ppu.frame_ready = false;
+        gb->apu.sample_buffer.is_full = false;
+        sm83_run(gb);
+    }
+    while (gb->scheduler.now < until)
+        sm83_step_retire(gb);
+}
+
+/* Output colours for the four shades, lightest first, as RGBA like the frame
+   buffer. They stay in effect across resets. */
+void gb_set_palette(struct gb *gb, const uint32_t colors[4])
+{
+    memcpy(gb->user_palette, colors, sizeof(gb->user_palette));
+    gb->palette_set = true;
+    ppu_update_palettes(gb);
+}
+
+/* Run translated code for hot ROM blocks, or only the interpreter. Returns
+   false if asked to enable it in a build without GBDA_JIT. */
+bool gb_set_jit(struct gb *gb, bool enabled)
+{
+#ifdef SM83_JIT
+    gb->jit.enabled = enabled;
+    return true;
+#else
+    return !enabled;
+#endif
+}
+
+/* Copy the counters in struct gb_stats. Safe to call from another thread
+   while the instance runs: every counter is loaded atomically, but the copy
+   is not one consistent snapshot. */
+void gb_get_stats(const struct gb *gb, struct gb_stats *stats)
+{
+    const struct gb_stats *live = &gb->stats;
+
+    for (size_t i = 0; i < 0x100; i++) {
+        stats->io_reads[i] = __atomic_load_n(&live->io_reads[i], __ATOMIC_RELAXED);
+        stats->io_writes[i] = __atomic_load_n(&live->io_writes[i], __ATOMIC_RELAXED);
+    }
+    for (size_t i = 0; i < 5; i++)
+        stats->interrupts[i] = __atomic_load_n(&live->interrupts[i], __ATOMIC_RELAXED);
+    stats->mbc_writes = __atomic_load_n(&live->mbc_writes, __ATOMIC_RELAXED);
+    stats->rom_bank_switches = __atomic_load_n(&live->rom_bank_switches, __ATOMIC_RELAXED);
+    stats->ram_bank_switches = __atomic_load_n(&live->ram_bank_switches, __ATOMIC_RELAXED);
+    stats->oam_dmas = __atomic_load_n(&live->oam_dmas, __ATOMIC_RELAXED);
+    stats->frames = __atomic_load_n(&live->frames, __ATOMIC_RELAXED);
+    stats->samples = __atomic_load_n(&live->samples, __ATOMIC_RELAXED);
+    stats->halt_cycles = __atomic_load_n(&live->halt_cycles, __ATOMIC_RELAXED);
+    stats->instructions = __atomic_load_n(&gb->cpu.instructions, __ATOMIC_RELAXED);
+}
+
+/* Sample the guest call stack every period T-cycles from now on. Returns
+   false if gbdacore was built without GBDA_PROFILE. */
+bool gb_sample_stacks(struct gb *gb, uint64_t period)
+{
+#ifdef SM83_PROFILE
+    return callstack_start(gb, period);
+#else
+    return false;
+#endif
+}
+
+/* Write the call stacks sampled so far in folded format, frames named from
+   an RGBDS .sym file when sym_path is not NULL */
+bool gb_write_stacks(struct gb *gb, const char *path, const char *sym_path)
+{
+#ifdef SM83_PROFILE
+    FILE *f = fopen(path, "w");
+    bool ok;
+
+    if (!f)
+        return false;
+    ok = callstack_write(gb, f, sym_path);
+    return (fclose(f) == 0) && ok;
+#else
+    return false;
+#endif
+}
+
+/* Record host timings of frame phases, up to capacity events. Returns false
+   if gbdacore was built without GBDA_TRACE. */
+bool gb_trace_start(struct gb *gb, size_t capacity)
+{
+#ifdef GBDA_TRACE
+    return trace_start(gb, capacity);
+#else
+    return false;
+#endif
+}
+
+/* Write the events recorded so far as Chrome trace-event JSON */
+bool gb_trace_write(struct gb *gb, const char *path)
+{
+#ifdef GBDA_TRACE
+    FILE *f = fopen(path, "w");
+    bool ok;
+
+    if (!f)
+        return false;
+    ok = trace_write(gb, f);
+    return (fclose(f) == 0) && ok;
+#else
+    return false;
+#endif
+}
+
+void gb_destroy(struct gb *gb)
+{
+    if (!gb)
+        return;
+#ifdef SM83_JIT
+    jit_free(gb);
+#endif
+#ifdef SM83_PROFILE
+    sm83_profile_report(gb, stderr);
+    sm83_profile_free(gb);
+    callstack_free(gb);
+#endif
+#ifdef GBDA_TRACE
+    trace_free(gb);
+#endif
+    free(gb);
+}
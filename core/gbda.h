@@ -0,0 +1,32 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gb.h"
+
+/*
+ * Heap-allocated emulator instances. All emulation state lives in struct gb,
+ * so any number of instances can run in one process, each on its own thread;
+ * only the table of recompiled ROMs registered at startup is shared, and it
+ * is read-only by then.
+ */
+struct gb *gb_create(void);
+bool gb_load(struct gb *gb, const char *rom_path);
+void gb_load_rom(struct gb *gb, const uint8_t *rom, size_t size);
+void gb_reset(struct gb *gb);
+void gb_run_frame(struct gb *gb);
+void gb_run_cycles(struct gb *gb, uint64_t cycles);
+void gb_set_palette(struct gb *gb, const uint32_t colors[4]);
+bool gb_set_jit(struct gb *gb, bool enabled);
+void gb_get_stats(const struct gb *gb, struct gb_stats *stats);
+bool gb_sample_stacks(struct gb *gb, uint64_t period);
+bool gb_write_stacks(struct gb *gb, const char *path, const char *sym_path);
+bool gb_trace_start(struct gb *gb, size_t capacity);
+bool gb_trace_write(struct gb *gb, const char *path);
+void gb_destroy(struct gb *gb);
+
+#ifdef __cplusplus
+}
+#endif
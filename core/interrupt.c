@@ -8,43 +8,34 @@ uint8_t interrupt_vector[] = {
     [INTR_SRC_JOYPAD] = 0x60,
 };
 
-uint8_t interrupt_read(struct gb *gb, uint16_t addr)
+uint8_t interrupt_ie_read(struct gb *gb, uint16_t addr)
 {
-    uint8_t ret = 0xff;
+    return gb->interrupt.ie;
+}
 
-    switch (addr) {
-    case INTR_REG_IE:
-        ret = gb->interrupt.ie;
-        break;
-    case INTR_REG_IF:
-        ret = gb->interrupt.flag;
-        break;
-    default:
-        break;
-    }
-    return ret;
+uint8_t interrupt_if_read(struct gb *gb, uint16_t addr)
+{
+    return gb->interrupt.flag;
 }
 
-void interrupt_write(struct gb *gb, uint16_t addr, uint8_t val)
+void interrupt_ie_write(struct gb *gb, uint16_t addr, uint8_t val)
 {
-    switch (addr) {
-    case INTR_REG_IE:
-        gb->interrupt.ie = val | 0xe0;
-        break;
-    case INTR_REG_IF:
-        gb->interrupt.flag = val | 0xe0;
-        break;
-    default:
-        break;
-    }
+    gb->interrupt.ie = val | 0xe0;
+}
+
+void interrupt_if_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    gb->interrupt.flag = val | 0xe0;
 }
 
 int interrupt_handler(struct gb *gb, uint8_t intr_src)
 {
     gb->cpu.ime = false;
     gb->interrupt.flag &= ~intr_src;
+    COUNTER_ADD(gb->stats.interrupts[__builtin_ctz(intr_src)], 1);
     sm83_push_word(gb, gb->cpu.pc);
     gb->cpu.pc = interrupt_vector[intr_src];
+    CALLSTACK_ENTER(gb);
     return 5;
 }
 
@@ -16,8 +16,10 @@ extern "C" {
 #define INTR_SRC_SERIAL     (1U << 3)
 #define INTR_SRC_JOYPAD     (1U << 4)
 
-uint8_t interrupt_read(struct gb *gb, uint16_t addr);
-void interrupt_write(struct gb *gb, uint16_t addr, uint8_t val);
+uint8_t interrupt_ie_read(struct gb *gb, uint16_t addr);
+uint8_t interrupt_if_read(struct gb *gb, uint16_t addr);
+void interrupt_ie_write(struct gb *gb, uint16_t addr, uint8_t val);
+void interrupt_if_write(struct gb *gb, uint16_t addr, uint8_t val);
 int interrupt_process(struct gb *gb);
 void interrupt_request(struct gb *gb, uint8_t intr_src);
 bool is_interrupt_pending(struct gb *gb);
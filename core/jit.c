@@ -0,0 +1,977 @@
+#include "jit.h"
+#include "sm83.h"
+#include <stddef.h>
+#include <sys/mman.h>
+
+/*
+ * x86-64 translation of hot ROM blocks. A translation covers the longest
+ * prefix of a cached block it can translate, up to and including the branch
+ * that ends the block; the interpreter runs whatever follows it.
+ *
+ * Registers. The SM83 registers live in host registers for the whole
+ * translation: B C D E H L A F in r8-r15, SP in ebp, struct gb in rbx. The
+ * prologue loads them and every exit stores them back along with PC. F is
+ * computed eagerly from the host flags (LAHF and a table, see jit_init()),
+ * so the caller syncs the interpreter's lazy flags before entering.
+ *
+ * Memory. Loads and stores go through bus.read_map and bus.write_map like
+ * bus_read() and bus_write(). A page with no host pointer needs a handler:
+ * I/O, OAM, tile data, MBC registers (bank switches) and WRAM holding cached
+ * code. The translation then exits before the instruction, with nothing of
+ * it done, and the interpreter executes it. LDH to HRAM is done inline and
+ * counted like io_read() and io_write() do; other I/O accesses, EI, DI,
+ * RETI, HALT and STOP end the translation.
+ *
+ * Timing. Native code does not tick the system between instructions. The
+ * caller passes the machine cycles left before the next scheduler event,
+ * and instruction i only runs if the ones before it end before that event.
+ * Every event therefore fires at the same instruction boundary as in the
+ * interpreter, and no interrupt can become pending inside a translation.
+ * Once the interpreter has run the event, it re-enters the translation at
+ * the instruction that was cut off through a jump table.
+ *
+ * A translation returns the number of instructions it retired, with the
+ * machine cycles they took in the bits above the low byte.
+ */
+
+#define GB_OFF(field)       ((int32_t)offsetof(struct gb, field))
+#define CPU_OFF(field)      GB_OFF(cpu.field)
+#define OFF_READ_MAP        GB_OFF(bus.read_map)
+#define OFF_WRITE_MAP       GB_OFF(bus.write_map)
+#define OFF_HRAM            GB_OFF(hram)
+#define OFF_HRAM_CODE       GB_OFF(block_cache.hram_code)
+#define OFF_IO_READS        GB_OFF(stats.io_reads)
+#define OFF_IO_WRITES       GB_OFF(stats.io_writes)
+#define OFF_FLAGS           GB_OFF(jit.flags)
+
+#define JIT_RESULT(count, cycles)   ((count) | ((cycles) << 8))
+
+/* x86 registers */
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+    NO_REG = -1,
+};
+
+/* x86 condition codes */
+enum { CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_LE = 0xe };
+
+/* guest state pinned in host registers */
+#define REG_GB              RBX
+#define REG_BUDGET          RSI
+#define REG_SP              RBP
+#define REG_A               R14
+#define REG_F               R15
+
+/* register operand index of the 8-bit instructions: B C D E H L (HL) A */
+static const int host_r8[8] = { R8, R9, R10, R11, R12, R13, NO_REG, REG_A };
+
+/* high and low halves of the register pairs BC DE HL */
+static const int pair_hi[3] = { R8, R10, R12 };
+static const int pair_lo[3] = { R9, R11, R13 };
+
+/* everything loaded by the prologue and stored back on exit, but SP */
+static const struct {
+    int reg;
+    int32_t off;
+} pinned[] = {
+    { R8, CPU_OFF(bc.b) }, { R9, CPU_OFF(bc.c) }, { R10, CPU_OFF(de.d) }, { R11, CPU_OFF(de.e) },
+    { R12, CPU_OFF(hl.h) }, { R13, CPU_OFF(hl.l) }, { REG_A, CPU_OFF(af.a) }, { REG_F, CPU_OFF(af.f) },
+};
+
+/* callee-saved registers the translation uses */
+static const int saved[] = { RBX, RBP, R12, R13, R14, R15 };
+
+/* jump targets: an exit before instruction n of the block, the epilogue, or
+   the jump table that resumes a translation at one of its instructions */
+#define LABEL_EPILOGUE      (BLOCK_MAX_INSTRS + 1)
+#define LABEL_RESUME        (BLOCK_MAX_INSTRS + 2)
+#define JIT_MAX_FIXUPS      128
+
+struct emitter {
+    uint8_t *buf;
+    size_t pos;
+    size_t size;
+    struct {
+        size_t pos;
+        int label;
+    } fixups[JIT_MAX_FIXUPS];
+    int fixup_count;
+    bool failed;        // out of fixups, the translation is dropped
+};
+
+/* what emit_instr() did */
+enum { EMIT_FAILED, EMIT_NEXT, EMIT_EXITED };
+
+static void emit8(struct emitter *e, uint8_t b)
+{
+    if (e->pos < e->size)
+        e->buf[e->pos] = b;
+    e->pos++;
+}
+
+static void emit32(struct emitter *e, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        emit8(e, v >> (i * 8));
+}
+
+static void patch32(struct emitter *e, size_t pos, uint32_t v)
+{
+    if (pos + 4 <= e->size)
+        memcpy(e->buf + pos, &v, 4);
+}
+
+/*
+ * Operand size prefix, REX and opcode (0x0fxx for two-byte opcodes). size is
+ * the operand size in bits; byte_rex forces a REX so that 8-bit registers
+ * 4-7 are spl/bpl/sil/dil rather than ah/ch/dh/bh.
+ */
+static void emit_opcode(struct emitter *e, int size, uint16_t opcode, int reg, int index, int base, bool byte_rex)
+{
+    uint8_t rex = 0x40 | ((size == 64) << 3) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+
+    if (size == 16)
+        emit8(e, 0x66);
+    if (rex != 0x40 || byte_rex)
+        emit8(e, rex);
+    if (opcode > 0xff)
+        emit8(e, opcode >> 8);
+    emit8(e, opcode);
+}
+
+/* Instruction with a register ModRM operand: reg is a register or /digit */
+static void emit_rr(struct emitter *e, int size, uint16_t opcode, int reg, int rm)
+{
+    emit_opcode(e, size, opcode, reg, 0, rm, size == 8 && ((reg & ~3) == 4 || (rm & ~3) == 4));
+    emit8(e, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* Same with a memory operand [base + index * scale + disp] */
+static void emit_rm(struct emitter *e, int size, uint16_t opcode, int reg, int base, int index, int scale,
+                    int32_t disp)
+{
+    uint8_t mod = (disp == (int8_t)disp) ? 0x40 : 0x80;
+
+    emit_opcode(e, size, opcode, reg, (index == NO_REG) ? 0 : index, base, size == 8 && (reg & ~3) == 4);
+    if (index == NO_REG && (base & 7) != RSP) {
+        emit8(e, mod | ((reg & 7) << 3) | (base & 7));
+    } else {
+        emit8(e, mod | ((reg & 7) << 3) | RSP);
+        emit8(e, (__builtin_ctz(scale) << 6) | ((((index == NO_REG) ? RSP : index) & 7) << 3) | (base & 7));
+    }
+    if (mod == 0x40)
+        emit8(e, disp);
+    else
+        emit32(e, disp);
+}
+
+/* mov dst, src (32-bit) */
+static void emit_mov(struct emitter *e, int dst, int src)
+{
+    emit_rr(e, 32, 0x89, src, dst);
+}
+
+/* movzx dst, src8 */
+static void emit_movzx(struct emitter *e, int dst, int src)
+{
+    emit_rr(e, 8, 0x0fb6, dst, src);
+}
+
+/* mov reg, imm32 */
+static void emit_mov_imm(struct emitter *e, int reg, uint32_t imm)
+{
+    if (reg & 8)
+        emit8(e, 0x41);
+    emit8(e, 0xb8 + (reg & 7));
+    emit32(e, imm);
+}
+
+/* group-1 ALU op /digit on an 8-bit register with an immediate */
+static void emit_op8_imm(struct emitter *e, int digit, int reg, uint8_t imm)
+{
+    emit_rr(e, 8, 0x80, digit, reg);
+    emit8(e, imm);
+}
+
+/* shift or rotate /digit of a 32-bit register by an immediate */
+static void emit_shift32(struct emitter *e, int digit, int reg, uint8_t n)
+{
+    emit_rr(e, 32, 0xc1, digit, reg);
+    emit8(e, n);
+}
+
+/* add/sub (digit 0 or 5) of an immediate to a 16-bit register */
+static void emit_op16_imm(struct emitter *e, int digit, int reg, int8_t imm)
+{
+    emit_rr(e, 16, 0x83, digit, reg);
+    emit8(e, imm);
+}
+
+/* Jump to a label, patched once the translation is complete */
+static void emit_fixup(struct emitter *e, int label)
+{
+    if (e->fixup_count == JIT_MAX_FIXUPS) {
+        e->failed = true;
+        return;
+    }
+    e->fixups[e->fixup_count].pos = e->pos;
+    e->fixups[e->fixup_count++].label = label;
+    emit32(e, 0);
+}
+
+static void emit_jcc(struct emitter *e, int cc, int label)
+{
+    emit8(e, 0x0f); emit8(e, 0x80 + cc);
+    emit_fixup(e, label);
+}
+
+static void emit_jmp(struct emitter *e, int label)
+{
+    emit8(e, 0xe9);
+    emit_fixup(e, label);
+}
+
+/* Forward jump within an instruction, returns where to patch it */
+static size_t emit_jcc_forward(struct emitter *e, int cc)
+{
+    emit8(e, 0x0f); emit8(e, 0x80 + cc);
+    emit32(e, 0);
+    return e->pos - 4;
+}
+
+static void emit_patch_here(struct emitter *e, size_t pos)
+{
+    patch32(e, pos, e->pos - (pos + 4));
+}
+
+/* Leave with count instructions retired and the given PC, or with PC
+   already in ecx when pc is negative */
+static void emit_exit(struct emitter *e, int count, int cycles, int pc)
+{
+    emit_mov_imm(e, RAX, JIT_RESULT(count, cycles));
+    if (pc >= 0)
+        emit_mov_imm(e, RCX, pc);
+    emit_jmp(e, LABEL_EPILOGUE);
+}
+
+/* Host flags to F: Z, H and C come from AH after LAHF through a table.
+   F = (table & use) | (F & keep) | set, rax is clobbered. */
+static void emit_flags(struct emitter *e, uint8_t use, uint8_t keep, uint8_t set)
+{
+    emit8(e, 0x9f);                                                 // lahf
+    emit8(e, 0x0f); emit8(e, 0xb6); emit8(e, 0xc4);                 // movzx eax, ah
+    if (!keep) {
+        emit_rm(e, 8, 0x0fb6, REG_F, REG_GB, RAX, 1, OFF_FLAGS);    // movzx f, [flags + rax]
+        if (use != 0xb0)
+            emit_op8_imm(e, 4, REG_F, use);                         // and f, use
+    } else {
+        emit_rm(e, 8, 0x0fb6, RAX, REG_GB, RAX, 1, OFF_FLAGS);      // movzx eax, [flags + rax]
+        emit_op8_imm(e, 4, RAX, use);                               // and al, use
+        emit_op8_imm(e, 4, REG_F, keep);                            // and f, keep
+        emit_rr(e, 8, 0x08, RAX, REG_F);                            // or f, al
+    }
+    if (set)
+        emit_op8_imm(e, 1, REG_F, set);                             // or f, set
+}
+
+/* F = C from the host carry, and Z from reg8 unless reg is NO_REG. For
+   rotates and shifts, which do not set the host ZF. */
+static void emit_flags_shift(struct emitter *e, int reg)
+{
+    emit8(e, 0x0f); emit8(e, 0x92); emit8(e, 0xc0);                 // setc al
+    emit_rr(e, 8, 0xc0, 4, RAX); emit8(e, 4);                       // shl al, 4
+    if (reg != NO_REG) {
+        emit_rr(e, 8, 0x84, reg, reg);                              // test reg, reg
+        emit8(e, 0x0f); emit8(e, 0x94); emit8(e, 0xc2);             // setz dl
+        emit_rr(e, 8, 0xc0, 4, RDX); emit8(e, 7);                   // shl dl, 7
+        emit_rr(e, 8, 0x08, RDX, RAX);                              // or al, dl
+    }
+    emit_movzx(e, REG_F, RAX);
+}
+
+/* Set the host carry to the C flag, for ADC, SBC, RLA, RRA, RL and RR */
+static void emit_carry_in(struct emitter *e)
+{
+    emit_rr(e, 32, 0x0fba, 4, REG_F); emit8(e, 4);                  // bt f, 4
+}
+
+/* dst = register pair p (BC DE HL SP) */
+static void emit_pair_get(struct emitter *e, int dst, int p)
+{
+    if (p == 3) {
+        emit_mov(e, dst, REG_SP);
+        return;
+    }
+    emit_mov(e, dst, pair_hi[p]);
+    emit_shift32(e, 4, dst, 8);                                     // shl dst, 8
+    emit_rr(e, 32, 0x09, pair_lo[p], dst);                          // or dst, lo
+}
+
+/* Register pair p (BC DE HL) = the 16-bit value in src, which is clobbered */
+static void emit_pair_set(struct emitter *e, int p, int src)
+{
+    emit_movzx(e, pair_lo[p], src);
+    emit_shift32(e, 5, src, 8);                                     // shr src, 8
+    emit_movzx(e, pair_hi[p], src);
+}
+
+/* INC rr / DEC rr */
+static void emit_pair_step(struct emitter *e, int p, bool dec)
+{
+    if (p == 3) {
+        emit_rr(e, 16, 0xff, dec, REG_SP);                          // inc/dec bp
+        return;
+    }
+    emit_op8_imm(e, dec ? 5 : 0, pair_lo[p], 1);                    // add/sub lo, 1
+    emit_op8_imm(e, dec ? 3 : 2, pair_hi[p], 0);                    // adc/sbb hi, 0
+}
+
+/*
+ * page = the host page of the guest address in addr through map (read_map
+ * or write_map). Exits before instruction i if the page has none, so the
+ * interpreter runs the handler.
+ */
+static void emit_page(struct emitter *e, int i, int32_t map, int page, int addr)
+{
+    emit_mov(e, page, addr);
+    emit_shift32(e, 5, page, 8);                                    // shr page, 8
+    emit_rm(e, 64, 0x8b, page, REG_GB, page, 8, map);               // mov page, [map + page * 8]
+    emit_rr(e, 64, 0x85, page, page);                               // test page, page
+    emit_jcc(e, CC_E, i);
+}
+
+/* Same for an address known at translation time, into rax */
+static void emit_page_const(struct emitter *e, int i, int32_t map, uint16_t addr)
+{
+    emit_rm(e, 64, 0x8b, RAX, REG_GB, NO_REG, 1, map + (addr >> 8) * 8);
+    emit_rr(e, 64, 0x85, RAX, RAX);                                 // test rax, rax
+    emit_jcc(e, CC_E, i);
+}
+
+/* ecx = the byte at the guest address in edi */
+static void emit_read(struct emitter *e, int i)
+{
+    emit_page(e, i, OFF_READ_MAP, RAX, RDI);
+    emit_movzx(e, RCX, RDI);
+    emit_rm(e, 8, 0x0fb6, RCX, RAX, RCX, 1, 0);                     // movzx ecx, [rax + rcx]
+}
+
+/* Store src8, or imm if src is NO_REG, at the guest address in edi */
+static void emit_write(struct emitter *e, int i, int src, uint8_t imm)
+{
+    emit_page(e, i, OFF_WRITE_MAP, RAX, RDI);
+    emit_movzx(e, RCX, RDI);
+    if (src == NO_REG) {
+        emit_rm(e, 8, 0xc6, 0, RAX, RCX, 1, 0);                     // mov byte [rax + rcx], imm
+        emit8(e, imm);
+    } else {
+        emit_rm(e, 8, 0x88, src, RAX, RCX, 1, 0);                   // mov [rax + rcx], src
+    }
+}
+
+/* Read-modify-write of (HL): ecx = the byte, rax = where it goes back.
+   Both pages are checked before anything is done. */
+static void emit_hl_rmw(struct emitter *e, int i)
+{
+    emit_pair_get(e, RDI, 2);
+    emit_page(e, i, OFF_WRITE_MAP, RAX, RDI);
+    emit_page(e, i, OFF_READ_MAP, RDX, RDI);
+    emit_movzx(e, RCX, RDI);
+    emit_rr(e, 64, 0x01, RCX, RAX);                                 // add rax, rcx
+    emit_rm(e, 8, 0x0fb6, RCX, RDX, RCX, 1, 0);                     // movzx ecx, [rdx + rcx]
+}
+
+/* mov [rax], cl, the end of emit_hl_rmw(). Host flags are preserved. */
+static void emit_hl_writeback(struct emitter *e)
+{
+    emit_rm(e, 8, 0x88, RCX, RAX, NO_REG, 1, 0);
+}
+
+/* Push two bytes, registers or the halves of imm when hi is NO_REG. Both
+   pages are checked before anything is written. */
+static void emit_push(struct emitter *e, int i, int hi, int lo, uint16_t imm)
+{
+    emit_mov(e, RDI, REG_SP);
+    emit_op16_imm(e, 5, RDI, 1);                                    // sub di, 1
+    emit_mov(e, RAX, RDI);
+    emit_op16_imm(e, 5, RAX, 1);                                    // sub ax, 1
+    emit_page(e, i, OFF_WRITE_MAP, RDX, RDI);
+    emit_page(e, i, OFF_WRITE_MAP, RCX, RAX);
+    emit_movzx(e, RDI, RDI);
+    emit_movzx(e, RAX, RAX);
+    if (hi == NO_REG) {
+        emit_rm(e, 8, 0xc6, 0, RDX, RDI, 1, 0); emit8(e, imm >> 8); // mov byte [rdx + rdi], imm >> 8
+        emit_rm(e, 8, 0xc6, 0, RCX, RAX, 1, 0); emit8(e, imm);      // mov byte [rcx + rax], imm
+    } else {
+        emit_rm(e, 8, 0x88, hi, RDX, RDI, 1, 0);                    // mov [rdx + rdi], hi
+        emit_rm(e, 8, 0x88, lo, RCX, RAX, 1, 0);                    // mov [rcx + rax], lo
+    }
+    emit_op16_imm(e, 5, REG_SP, 2);                                 // sub bp, 2
+}
+
+/* Pop two bytes into lo and hi. Both pages are checked first. */
+static void emit_pop(struct emitter *e, int i, int hi, int lo)
+{
+    emit_mov(e, RDI, REG_SP);
+    emit_mov(e, RAX, REG_SP);
+    emit_op16_imm(e, 0, RAX, 1);                                    // add ax, 1
+    emit_page(e, i, OFF_READ_MAP, RDX, RDI);
+    emit_page(e, i, OFF_READ_MAP, RCX, RAX);
+    emit_movzx(e, RDI, RDI);
+    emit_movzx(e, RAX, RAX);
+    emit_rm(e, 8, 0x0fb6, lo, RDX, RDI, 1, 0);                      // movzx lo, [rdx + rdi]
+    emit_rm(e, 8, 0x0fb6, hi, RCX, RAX, 1, 0);                      // movzx hi, [rcx + rax]
+    emit_op16_imm(e, 0, REG_SP, 2);                                 // add bp, 2
+}
+
+/* LDH between A and HRAM at 0xff00 + n, counted like io_read()/io_write() */
+static void emit_hram_const(struct emitter *e, int i, uint8_t n, bool write)
+{
+    if (write) {
+        emit_rm(e, 8, 0x80, 7, REG_GB, NO_REG, 1, OFF_HRAM_CODE + n - 0x80);
+        emit8(e, 0);                                                // cmp byte [hram_code + n], 0
+        emit_jcc(e, CC_NE, i);
+        emit_rm(e, 8, 0x88, REG_A, REG_GB, NO_REG, 1, OFF_HRAM + n - 0x80);
+        emit_rm(e, 64, 0xff, 0, REG_GB, NO_REG, 1, OFF_IO_WRITES + n * 8);  // inc qword [io_writes + n]
+    } else {
+        emit_rm(e, 8, 0x0fb6, REG_A, REG_GB, NO_REG, 1, OFF_HRAM + n - 0x80);
+        emit_rm(e, 64, 0xff, 0, REG_GB, NO_REG, 1, OFF_IO_READS + n * 8);   // inc qword [io_reads + n]
+    }
+}
+
+/* Same for LD (C),A and LD A,(C), exiting when C is not an HRAM address */
+static void emit_hram_c(struct emitter *e, int i, bool write)
+{
+    emit_movzx(e, RCX, host_r8[1]);
+    emit_op8_imm(e, 7, RCX, 0x80);                                  // cmp cl, 0x80
+    emit_jcc(e, CC_B, i);
+    emit_op8_imm(e, 7, RCX, 0xff);                                  // cmp cl, 0xff
+    emit_jcc(e, CC_E, i);
+    if (write) {
+        emit_rm(e, 8, 0x80, 7, REG_GB, RCX, 1, OFF_HRAM_CODE - 0x80);
+        emit8(e, 0);                                                // cmp byte [hram_code + rcx], 0
+        emit_jcc(e, CC_NE, i);
+        emit_rm(e, 8, 0x88, REG_A, REG_GB, RCX, 1, OFF_HRAM - 0x80);
+        emit_rm(e, 64, 0xff, 0, REG_GB, RCX, 8, OFF_IO_WRITES);
+    } else {
+        emit_rm(e, 8, 0x0fb6, REG_A, REG_GB, RCX, 1, OFF_HRAM - 0x80);
+        emit_rm(e, 64, 0xff, 0, REG_GB, RCX, 8, OFF_IO_READS);
+    }
+}
+
+/* 8-bit ALU op y (ADD ADC SUB SBC AND XOR OR CP) of A with src8, or with
+   imm if src is NO_REG */
+static void emit_alu(struct emitter *e, int y, int src, uint8_t imm)
+{
+    static const uint8_t op_rr[8] = { 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 };
+    static const uint8_t op_digit[8] = { 0, 2, 5, 3, 4, 6, 1, 7 };
+
+    if (y == 1 || y == 3)
+        emit_carry_in(e);
+    if (src == NO_REG)
+        emit_op8_imm(e, op_digit[y], REG_A, imm);
+    else
+        emit_rr(e, 8, op_rr[y], src, REG_A);
+    switch (y) {
+    case 0: case 1:                                                 // ADD, ADC
+        emit_flags(e, 0xb0, 0, 0);
+        break;
+    case 2: case 3: case 7:                                         // SUB, SBC, CP
+        emit_flags(e, 0xb0, 0, 0x40);
+        break;
+    case 4:                                                         // AND
+        emit_flags(e, 0x80, 0, 0x20);
+        break;
+    default:                                                        // XOR, OR
+        emit_flags(e, 0x80, 0, 0);
+        break;
+    }
+}
+
+/* CB-prefixed instruction */
+static void emit_cb(struct emitter *e, int i, uint8_t cb)
+{
+    static const uint8_t shift_digit[8] = { 0, 1, 2, 3, 4, 7, 0, 5 };   // RLC RRC RL RR SLA SRA SWAP SRL
+    int index = cb & 7, n = (cb >> 3) & 7, reg = (index == 6) ? RCX : host_r8[index];
+
+    if (index == 6 && (cb >> 6) == 1) {
+        emit_pair_get(e, RDI, 2);
+        emit_read(e, i);
+    } else if (index == 6) {
+        emit_hl_rmw(e, i);
+    }
+    switch (cb >> 6) {
+    case 0:
+        if (n == 2 || n == 3)
+            emit_carry_in(e);
+        if (n == 6) {
+            emit_rr(e, 8, 0xc0, 0, reg); emit8(e, 4);               // rol reg, 4
+        } else {
+            emit_rr(e, 8, 0xd0, shift_digit[n], reg);               // shift/rotate reg, 1
+        }
+        if (index == 6)
+            emit_hl_writeback(e);
+        if (n == 6) {
+            emit_rr(e, 8, 0x84, reg, reg);                          // test reg, reg
+            emit8(e, 0x0f); emit8(e, 0x94); emit8(e, 0xc0);         // setz al
+            emit_rr(e, 8, 0xc0, 4, RAX); emit8(e, 7);               // shl al, 7
+            emit_movzx(e, REG_F, RAX);
+        } else {
+            emit_flags_shift(e, reg);
+        }
+        break;
+    case 1:                                                         // BIT
+        emit_rr(e, 8, 0xf6, 0, reg); emit8(e, 1 << n);              // test reg, 1 << n
+        emit8(e, 0x0f); emit8(e, 0x94); emit8(e, 0xc0);             // setz al
+        emit_rr(e, 8, 0xc0, 4, RAX); emit8(e, 7);                   // shl al, 7
+        emit_op8_imm(e, 4, REG_F, 0x10);                            // and f, c
+        emit_op8_imm(e, 1, REG_F, 0x20);                            // or f, h
+        emit_rr(e, 8, 0x08, RAX, REG_F);                            // or f, al
+        break;
+    case 2:                                                         // RES
+        emit_op8_imm(e, 4, reg, ~(1 << n));
+        if (index == 6)
+            emit_hl_writeback(e);
+        break;
+    case 3:                                                         // SET
+        emit_op8_imm(e, 1, reg, 1 << n);
+        if (index == 6)
+            emit_hl_writeback(e);
+        break;
+    }
+}
+
+/* JR, JP, CALL, RET, RST and JP HL, all of which end the block. cycles is
+   the count before the branch. */
+static int emit_branch(struct emitter *e, const struct block_instr *instr, int i, int cycles)
+{
+    uint8_t op = instr->opcode, y = (op >> 3) & 7;
+    uint16_t next = instr->pc + instr->length;
+    bool cond = (op & 0xe7) == 0x20 || (op & 0xe7) == 0xc0 || (op & 0xe7) == 0xc2 || (op & 0xe7) == 0xc4;
+    size_t not_taken = 0;
+
+    cycles += instr->cycles;
+    if (cond) {
+        emit_rr(e, 8, 0xf6, 0, REG_F); emit8(e, (y & 2) ? 0x10 : 0x80);    // test f, c or z
+        not_taken = emit_jcc_forward(e, (y & 1) ? CC_E : CC_NE);
+    }
+    switch (op) {
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:         // JR
+        emit_exit(e, i + 1, cycles + 1, (uint16_t)(next + (int8_t)instr->operand));
+        break;
+    case 0xc3: case 0xc2: case 0xca: case 0xd2: case 0xda:         // JP
+        emit_exit(e, i + 1, cycles + 1, instr->operand);
+        break;
+    case 0xcd: case 0xc4: case 0xcc: case 0xd4: case 0xdc:         // CALL
+        emit_push(e, i, NO_REG, NO_REG, next);
+        emit_exit(e, i + 1, cycles + 3, instr->operand);
+        break;
+    case 0xc9: case 0xc0: case 0xc8: case 0xd0: case 0xd8:         // RET
+        emit_pop(e, i, RAX, RDI);
+        emit_shift32(e, 4, RAX, 8);                                 // shl eax, 8
+        emit_rr(e, 32, 0x09, RDI, RAX);                             // or eax, edi
+        emit_mov(e, RCX, RAX);
+        emit_exit(e, i + 1, cycles + 3, -1);
+        break;
+    case 0xe9:                                                      // JP HL
+        emit_pair_get(e, RCX, 2);
+        emit_exit(e, i + 1, cycles, -1);
+        break;
+    default:                                                        // RST
+        if ((op & 0xc7) != 0xc7)
+            return EMIT_FAILED;
+        emit_push(e, i, NO_REG, NO_REG, next);
+        emit_exit(e, i + 1, cycles, op & 0x38);
+        break;
+    }
+    if (cond) {
+        emit_patch_here(e, not_taken);
+        emit_exit(e, i + 1, cycles, next);
+    }
+    return EMIT_EXITED;
+}
+
+/* Translate instruction i of the block, cycles being the count before it */
+static int emit_instr(struct emitter *e, const struct block *block, int i, int cycles)
+{
+    const struct block_instr *instr = &block->instrs[i];
+    uint8_t op = instr->opcode, x = op >> 6, y = (op >> 3) & 7, z = op & 7, n = instr->operand;
+    uint16_t nn = instr->operand;
+    int p = y >> 1;
+
+    if (op == 0x00)
+        return EMIT_NEXT;
+    if (x == 1 && op != 0x76) {                                     // LD r,r' / LD r,(HL) / LD (HL),r
+        if (z == 6 || y == 6)
+            emit_pair_get(e, RDI, 2);
+        if (z == 6) {
+            emit_read(e, i);
+            emit_mov(e, host_r8[y], RCX);
+        } else if (y == 6) {
+            emit_write(e, i, host_r8[z], 0);
+        } else {
+            emit_mov(e, host_r8[y], host_r8[z]);
+        }
+        return EMIT_NEXT;
+    }
+    if (x == 2 || (x == 3 && z == 6)) {                             // ALU A,r / A,(HL) / A,n
+        if (x == 3) {
+            emit_alu(e, y, NO_REG, n);
+        } else if (z == 6) {
+            emit_pair_get(e, RDI, 2);
+            emit_read(e, i);
+            emit_alu(e, y, RCX, 0);
+        } else {
+            emit_alu(e, y, host_r8[z], 0);
+        }
+        return EMIT_NEXT;
+    }
+    if (x == 0 && z == 6) {                                         // LD r,n / LD (HL),n
+        if (y == 6) {
+            emit_pair_get(e, RDI, 2);
+            emit_write(e, i, NO_REG, n);
+        } else {
+            emit_mov_imm(e, host_r8[y], n);
+        }
+        return EMIT_NEXT;
+    }
+    if (x == 0 && (z == 4 || z == 5)) {                             // INC/DEC r / (HL)
+        if (y == 6) {
+            emit_hl_rmw(e, i);
+            emit_rr(e, 8, 0xfe, z == 5, RCX);                       // inc/dec cl
+            emit_hl_writeback(e);
+        } else {
+            emit_rr(e, 8, 0xfe, z == 5, host_r8[y]);                // inc/dec r
+        }
+        emit_flags(e, 0xa0, 0x10, (z == 5) ? 0x40 : 0);
+        return EMIT_NEXT;
+    }
+    if (x == 0 && z == 1 && !(y & 1)) {                             // LD rr,nn
+        if (p == 3) {
+            emit_mov_imm(e, REG_SP, nn);
+        } else {
+            emit_mov_imm(e, pair_hi[p], nn >> 8);
+            emit_mov_imm(e, pair_lo[p], nn & 0xff);
+        }
+        return EMIT_NEXT;
+    }
+    if (x == 0 && z == 1) {                                         // ADD HL,rr
+        if (p == 3) {
+            emit_mov(e, RAX, REG_SP);
+            emit_mov(e, RCX, REG_SP);
+            emit_shift32(e, 5, RCX, 8);                             // shr ecx, 8
+            emit_rr(e, 8, 0x00, RAX, pair_lo[2]);                   // add l, al
+            emit_rr(e, 8, 0x10, RCX, pair_hi[2]);                   // adc h, cl
+        } else {
+            emit_rr(e, 8, 0x00, pair_lo[p], pair_lo[2]);            // add l, lo
+            emit_rr(e, 8, 0x10, pair_hi[p], pair_hi[2]);            // adc h, hi
+        }
+        emit_flags(e, 0x30, 0x80, 0);
+        return EMIT_NEXT;
+    }
+    if (x == 0 && z == 3) {                                         // INC rr / DEC rr
+        emit_pair_step(e, p, y & 1);
+        return EMIT_NEXT;
+    }
+    if (x == 0 && z == 2) {                                         // LD (rr),A / LD A,(rr)
+        emit_pair_get(e, RDI, (p < 2) ? p : 2);
+        if (y & 1) {
+            emit_read(e, i);
+            emit_mov(e, REG_A, RCX);
+        } else {
+            emit_write(e, i, REG_A, 0);
+        }
+        if (p >= 2)
+            emit_pair_step(e, 2, p == 3);                           // HL+ / HL-
+        return EMIT_NEXT;
+    }
+    if (x == 3 && (z == 1 || z == 5) && !(y & 1)) {                 // POP rr / PUSH rr
+        int hi = (p == 3) ? REG_A : pair_hi[p], lo = (p == 3) ? REG_F : pair_lo[p];
+
+        if (z == 5) {
+            emit_push(e, i, hi, lo, 0);
+        } else {
+            emit_pop(e, i, hi, lo);
+            if (p == 3)
+                emit_op8_imm(e, 4, REG_F, 0xf0);                    // and f, 0xf0
+        }
+        return EMIT_NEXT;
+    }
+
+    switch (op) {
+    case 0x07: case 0x0f: case 0x17: case 0x1f:                     // RLCA RRCA RLA RRA
+        if (op >= 0x17)
+            emit_carry_in(e);
+        emit_rr(e, 8, 0xd0, y, REG_A);                              // rol/ror/rcl/rcr a, 1
+        emit_flags_shift(e, NO_REG);
+        return EMIT_NEXT;
+    case 0x2f:                                                      // CPL
+        emit_rr(e, 8, 0xf6, 2, REG_A);                              // not a
+        emit_op8_imm(e, 1, REG_F, 0x60);                            // or f, n|h
+        return EMIT_NEXT;
+    case 0x37:                                                      // SCF
+        emit_op8_imm(e, 4, REG_F, 0x80);                            // and f, z
+        emit_op8_imm(e, 1, REG_F, 0x10);                            // or f, c
+        return EMIT_NEXT;
+    case 0x3f:                                                      // CCF
+        emit_op8_imm(e, 4, REG_F, 0x90);                            // and f, z|c
+        emit_op8_imm(e, 6, REG_F, 0x10);                            // xor f, c
+        return EMIT_NEXT;
+    case 0xe8:                                                      // ADD SP,e
+    case 0xf8:                                                      // LD HL,SP+e
+        // H and C come from adding e to the low byte, unsigned
+        emit_mov(e, RAX, REG_SP);
+        emit_op8_imm(e, 0, RAX, n);                                 // add al, e
+        emit_flags(e, 0x30, 0, 0);
+        if (op == 0xe8) {
+            emit_op16_imm(e, 0, REG_SP, n);                         // add bp, e
+        } else {
+            emit_mov(e, RAX, REG_SP);
+            emit_op16_imm(e, 0, RAX, n);                            // add ax, e
+            emit_pair_set(e, 2, RAX);
+        }
+        return EMIT_NEXT;
+    case 0xf9:                                                      // LD SP,HL
+        emit_pair_get(e, REG_SP, 2);
+        return EMIT_NEXT;
+    case 0xe0: case 0xf0:                                           // LDH (n),A / LDH A,(n)
+        if (n < 0x80 || n == 0xff)
+            return EMIT_FAILED;
+        emit_hram_const(e, i, n, op == 0xe0);
+        return EMIT_NEXT;
+    case 0xe2: case 0xf2:                                           // LD (C),A / LD A,(C)
+        emit_hram_c(e, i, op == 0xe2);
+        return EMIT_NEXT;
+    case 0xea:                                                      // LD (nn),A
+        if (nn >= 0xff80 && nn != 0xffff) {
+            emit_hram_const(e, i, nn & 0xff, true);
+            return EMIT_NEXT;
+        }
+        // ROM writes always reach the MBC, and OAM and I/O have handlers
+        if (nn < 0x8000 || nn >= 0xfe00)
+            return EMIT_FAILED;
+        emit_page_const(e, i, OFF_WRITE_MAP, nn);
+        emit_rm(e, 8, 0x88, REG_A, RAX, NO_REG, 1, nn & 0xff);
+        return EMIT_NEXT;
+    case 0xfa:                                                      // LD A,(nn)
+        if (nn >= 0xff80 && nn != 0xffff) {
+            emit_hram_const(e, i, nn & 0xff, false);
+            return EMIT_NEXT;
+        }
+        if (nn >= 0xfe00)
+            return EMIT_FAILED;
+        emit_page_const(e, i, OFF_READ_MAP, nn);
+        emit_rm(e, 8, 0x0fb6, REG_A, RAX, NO_REG, 1, nn & 0xff);
+        return EMIT_NEXT;
+    case 0xcb:
+        emit_cb(e, i, n);
+        return EMIT_NEXT;
+    }
+    if (x == 3 || op == 0x18 || (op & 0xe7) == 0x20)
+        return emit_branch(e, instr, i, cycles);
+    // DAA, LD (nn),SP, HALT, STOP, DI, EI, RETI and the illegal opcodes
+    return EMIT_FAILED;
+}
+
+/* Translate the block into emitter e. Returns the number of instructions
+   covered, 0 if not even the first one can be translated. */
+static int jit_translate(struct emitter *e, const struct block *block)
+{
+    const struct block_instr *instr = block->instrs;
+    size_t labels[LABEL_RESUME + 1], entries[BLOCK_MAX_INSTRS], mark, table;
+    int cycles = 0, before[BLOCK_MAX_INSTRS + 1], count, result = EMIT_NEXT, fixups;
+    bool used[LABEL_RESUME + 1] = { false };
+
+    for (size_t r = 0; r < sizeof(saved) / sizeof(saved[0]); r++) {
+        if (saved[r] & 8)
+            emit8(e, 0x41);
+        emit8(e, 0x50 + (saved[r] & 7));                            // push
+    }
+    emit_rr(e, 64, 0x89, RDI, REG_GB);                              // mov rbx, rdi
+    for (size_t r = 0; r < sizeof(pinned) / sizeof(pinned[0]); r++)
+        emit_rm(e, 8, 0x0fb6, pinned[r].reg, REG_GB, NO_REG, 1, pinned[r].off);
+    emit_rm(e, 32, 0x0fb7, REG_SP, REG_GB, NO_REG, 1, CPU_OFF(sp)); // movzx ebp, [sp]
+    emit_rr(e, 32, 0x85, RDX, RDX);                                 // test edx, edx
+    emit_jcc(e, CC_NE, LABEL_RESUME);
+
+    for (count = 0; count < block->count && result == EMIT_NEXT; count++) {
+        before[count] = cycles;
+        entries[count] = mark = e->pos;
+        fixups = e->fixup_count;
+        if (count) {
+            // only run once the instructions so far end before the next event
+            emit_rr(e, 32, 0x81, 7, REG_BUDGET); emit32(e, cycles); // cmp esi, cycles
+            emit_jcc(e, CC_LE, count);
+        }
+        result = emit_instr(e, block, count, cycles);
+        if (result == EMIT_FAILED) {
+            e->pos = mark;
+            e->fixup_count = fixups;
+            break;
+        }
+        cycles += instr[count].cycles;
+    }
+    if (!count || e->failed)
+        return 0;
+    before[count] = cycles;
+    if (result != EMIT_EXITED)
+        emit_jmp(e, count);
+
+    // exits before an instruction retire the ones before it
+    for (int f = 0; f < e->fixup_count; f++)
+        used[e->fixups[f].label] = true;
+    for (int l = 0; l <= count; l++) {
+        if (!used[l])
+            continue;
+        labels[l] = e->pos;
+        emit_exit(e, l, before[l], (l < block->count) ? instr[l].pc : instr[l - 1].pc + instr[l - 1].length);
+    }
+
+    labels[LABEL_EPILOGUE] = e->pos;
+    for (size_t r = 0; r < sizeof(pinned) / sizeof(pinned[0]); r++)
+        emit_rm(e, 8, 0x88, pinned[r].reg, REG_GB, NO_REG, 1, pinned[r].off);
+    emit_rm(e, 16, 0x89, REG_SP, REG_GB, NO_REG, 1, CPU_OFF(sp));  // mov [sp], bp
+    emit_rm(e, 16, 0x89, RCX, REG_GB, NO_REG, 1, CPU_OFF(pc));     // mov [pc], cx
+    for (int r = sizeof(saved) / sizeof(saved[0]) - 1; r >= 0; r--) {
+        if (saved[r] & 8)
+            emit8(e, 0x41);
+        emit8(e, 0x58 + (saved[r] & 7));                            // pop
+    }
+    emit8(e, 0xc3);                                                 // ret
+
+    // jump to instruction edx through a table of offsets from the table
+    labels[LABEL_RESUME] = e->pos;
+    emit_mov(e, RDX, RDX);                                          // zero-extend edx
+    emit8(e, 0x48); emit8(e, 0x8d); emit8(e, 0x05); emit32(e, 0);   // lea rax, [rip + table]
+    mark = e->pos;
+    emit_rm(e, 64, 0x63, RDX, RAX, RDX, 4, 0);                      // movsxd rdx, [rax + rdx * 4]
+    emit_rr(e, 64, 0x01, RDX, RAX);                                 // add rax, rdx
+    emit_rr(e, 32, 0xff, 4, RAX);                                   // jmp rax
+    patch32(e, mark - 4, e->pos - mark);
+    table = e->pos;
+    for (int i = 0; i < count; i++)
+        emit32(e, entries[i] - table);
+
+    for (int f = 0; f < e->fixup_count; f++)
+        patch32(e, e->fixups[f].pos, labels[e->fixups[f].label] - (e->fixups[f].pos + 4));
+    return e->failed ? 0 : count;
+}
+
+/* Drop every translation so the code buffer can be reused */
+static void jit_flush(struct gb *gb)
+{
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        gb->block_cache.blocks[i].native = NULL;
+        gb->block_cache.blocks[i].hits = 0;
+    }
+    gb->jit.used = 0;
+}
+
+static void jit_disable(struct gb *gb, const char *why)
+{
+    fprintf(stderr, "jit: %s, disabling\n", why);
+    jit_flush(gb);
+    gb->jit.enabled = false;
+}
+
+/*
+ * The code buffer is never writable and executable at once: it is mapped
+ * read-write, and flipped to read-execute after every compilation and back
+ * before the next one.
+ */
+static void jit_compile(struct gb *gb, struct block *block)
+{
+    struct emitter e;
+    int count = 0;
+
+    if (!gb->jit.code) {
+        gb->jit.code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (gb->jit.code == MAP_FAILED) {
+            gb->jit.code = NULL;
+            jit_disable(gb, "cannot map code buffer");
+            return;
+        }
+    } else if (mprotect(gb->jit.code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE)) {
+        jit_disable(gb, "cannot make code buffer writable");
+        return;
+    }
+    for (int attempt = 0; attempt < 2; attempt++) {
+        e.buf = gb->jit.code + gb->jit.used;
+        e.size = JIT_CODE_SIZE - gb->jit.used;
+        e.pos = 0;
+        e.fixup_count = 0;
+        e.failed = false;
+        count = jit_translate(&e, block);
+        if (e.pos <= e.size)
+            break;
+        jit_flush(gb);
+    }
+    if (count && e.pos <= e.size) {
+        block->native = (int (*)(struct gb *, int, int))e.buf;
+        block->native_count = count;
+        gb->jit.used += (e.pos + 15) & ~15;
+    }
+    if (mprotect(gb->jit.code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC))
+        jit_disable(gb, "cannot make code buffer executable");
+}
+
+void jit_init(struct gb *gb)
+{
+    gb->jit.code = NULL;
+    gb->jit.used = 0;
+    gb->jit.enabled = true;
+    // AH after LAHF: SF ZF - AF - PF - CF
+    for (int ah = 0; ah < 0x100; ah++)
+        gb->jit.flags[ah] = (BIT(ah, 6) << 7) | (BIT(ah, 4) << 5) | (BIT(ah, 0) << 4);
+}
+
+void jit_free(struct gb *gb)
+{
+    if (gb->jit.code)
+        munmap(gb->jit.code, JIT_CODE_SIZE);
+    gb->jit.code = NULL;
+    gb->jit.used = 0;
+}
+
+/*
+ * Run the translation of a block from instruction index, compiling the block
+ * once it is hot. Returns the number of instructions retired, with the
+ * machine cycles they took in *cycles, or 0 when the interpreter has to
+ * execute the instruction at index itself.
+ */
+int jit_run(struct gb *gb, struct block *block, int index, int *cycles)
+{
+    uint64_t budget = 0;
+    int before = 0, ret;
+
+    if (!gb->jit.enabled || (block->key & BLOCK_KEY_RAM))
+        return 0;
+    if (!block->native) {
+        if (index || block->hits == JIT_HOT_THRESHOLD)
+            return 0;
+        if (++block->hits < JIT_HOT_THRESHOLD)
+            return 0;
+        jit_compile(gb, block);
+        if (!block->native)
+            return 0;
+    }
+    // ROM blocks are keyed by ROM offset, and an MBC can map the same bytes
+    // at two addresses: translations hold the addresses they were made for
+    if (index >= block->native_count || block->instrs[index].pc != gb->cpu.pc)
+        return 0;
+    // an interrupt due now is taken by the interpreter before anything runs
+    if (gb->cpu.ime && is_interrupt_pending(gb))
+        return 0;
+    if (gb->scheduler.next > gb->scheduler.now)
+        budget = (gb->scheduler.next - gb->scheduler.now + 3) / 4;
+    // the budget checks count cycles from the start of the block
+    for (int i = 0; i < index; i++)
+        before += block->instrs[i].cycles;
+    budget += before;
+    sm83_flags_sync(gb);
+    ret = block->native(gb, (budget > INT32_MAX) ? INT32_MAX : (int)budget, index);
+    *cycles = (ret >> 8) - before;
+    return (ret & 0xff) - index;
+}
+
@@ -0,0 +1,15 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gb.h"
+
+void jit_init(struct gb *gb);
+void jit_free(struct gb *gb);
+int jit_run(struct gb *gb, struct block *block, int index, int *cycles);
+
+#ifdef __cplusplus
+}
+#endif
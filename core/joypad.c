@@ -1,6 +1,6 @@
 #include "joypad.h"
 
-uint8_t joypad_read(struct gb *gb)
+uint8_t joypad_read(struct gb *gb, uint16_t addr)
 {
     uint8_t ret = 0xff;
 
@@ -13,7 +13,7 @@ uint8_t joypad_read(struct gb *gb)
     return ret;
 }
 
-void joypad_write(struct gb *gb, uint8_t val)
+void joypad_write(struct gb *gb, uint16_t addr, uint8_t val)
 {
     gb->joypad.joyp.val = val | (gb->joypad.joyp.val & 0xcf) | 0xc0;
 }
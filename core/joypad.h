@@ -16,7 +16,7 @@ typedef enum JOYPAD_KEYS {
     JOYPAD_DOWN = (1U << 7),
 } joypad_keys_t;
 
-uint8_t joypad_read(struct gb *gb);
-void joypad_write(struct gb *gb, uint8_t val);
+uint8_t joypad_read(struct gb *gb, uint16_t addr);
+void joypad_write(struct gb *gb, uint16_t addr, uint8_t val);
 void joypad_press_button(struct gb *gb, joypad_keys_t key);
 void joypad_release_button(struct gb *gb, joypad_keys_t key);
@@ -69,10 +69,9 @@ void mbc1_ram_load(struct gb *gb)
 
     asprintf(&save_file, "%s.sav", gb->cart.infos.name);
     FILE *fp = fopen(save_file, "r");
-    if (!fp) {
-        printf("This ROM doesn't have save file available\n");
+    // no save yet, the RAM starts out cleared
+    if (!fp)
         return;
-    }
     if (fread(gb->cart.ram, 1, gb->cart.infos.ram_size, fp) != gb->cart.infos.ram_size)
         fprintf(stderr, "RAM loading failed\n");
     fclose(fp); 
@@ -96,10 +95,9 @@ void mbc3_ram_load(struct gb *gb)
 
     asprintf(&save_file, "%s.sav", gb->cart.infos.name);
     FILE *fp = fopen(save_file, "r");
-    if (!fp) {
-        printf("This ROM doesn't have save file available\n");
+    // no save yet, the RAM starts out cleared
+    if (!fp)
         return;
-    }
     if (fread(gb->cart.ram, 1, gb->cart.infos.ram_size, fp) != gb->cart.infos.ram_size)
         fprintf(stderr, "RAM loading failed\n");
     fclose(fp); 
@@ -158,6 +156,52 @@ uint8_t mbc3_read(struct gb *gb, uint16_t addr)
     return ret;
 }
 
+/* Host address of the ROM bank currently mapped at 0x4000-0x7fff, or NULL
+   when the MBC has to go through its read function. */
+uint8_t *mbc_get_rom_bank(struct gb *gb)
+{
+    uint8_t *ret = NULL, rom_bank;
+
+    switch (gb->cart.infos.type) {
+    case NO_MBC:
+        ret = gb->cart.rom + 0x4000;
+        break;
+    case MBC1:
+    case MBC1_RAM:
+    case MBC1_RAM_BATTERY:
+        rom_bank = gb->mbc.mbc1.rom_bank & mbc1_bit_mask[gb->cart.infos.bank_size];
+        ret = gb->cart.rom + 0x4000 * rom_bank;
+        break;
+    case MBC3_RAM_BATTERY:
+        ret = gb->cart.rom + 0x4000 * gb->mbc.mbc3.rom_bank;
+        break;
+    default:
+        break;
+    }
+    return ret;
+}
+
+/* Host address of the external RAM bank currently mapped at 0xa000-0xbfff,
+   or NULL when accesses have to go through the MBC. */
+uint8_t *mbc_get_ram_bank(struct gb *gb)
+{
+    uint8_t *ret = NULL;
+
+    switch (gb->cart.infos.type) {
+    case MBC1_RAM:
+    case MBC1_RAM_BATTERY:
+        ret = gb->cart.ram;
+        break;
+    case MBC3_RAM_BATTERY:
+        if (gb->mbc.mbc3.ram_enable)
+            ret = gb->cart.ram + 0x2000 * gb->mbc.mbc3.ram_bank;
+        break;
+    default:
+        break;
+    }
+    return ret;
+}
+
 void mbc_init(struct gb *gb)
 {
     switch (gb->cart.infos.type) {
@@ -35,4 +35,6 @@ uint8_t mbc3_read(struct gb *gb, uint16_t addr);
 void mbc3_ram_dump(struct gb *gb);
 void mbc3_ram_load(struct gb *gb);
 
+uint8_t *mbc_get_rom_bank(struct gb *gb);
+uint8_t *mbc_get_ram_bank(struct gb *gb);
 void mbc_init(struct gb *gb);
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "ppu.h"
+#include "trace.h"
 
 /* RGBA format */
 uint32_t gb_palette[4] = {
@@ -14,24 +15,21 @@ static void set_mode(struct gb *gb, ppu_mode_t mode)
     gb->ppu.mode = mode;
 }
 
-uint32_t get_color_from_palette(struct gb *gb, palette_t palette, uint8_t color_id)
+static void ppu_update_palette(struct gb *gb, palette_t palette, uint8_t val)
 {
-    uint8_t *tmp = NULL;
+    for (int i = 0; i < 4; i++)
+        gb->ppu.colors[palette][i] = gb->user_palette[(val >> (i * 2)) & 0x03];
+}
 
-    switch (palette) {
-    case BGP:
-        tmp = &gb->ppu.bgp;
-        break;
-    case OBP0:
-        tmp = &gb->ppu.obp0;
-        break;
-    case OBP1:
-        tmp = &gb->ppu.obp1;
-        break;
-    default:
-        break;
-    }
-    return gb_palette[(*tmp >> (color_id * 2)) & 0x03];
+/* Resolve all three palettes again, after a reset or a new output palette.
+   Without one set by the user the output palette is gb_palette. */
+void ppu_update_palettes(struct gb *gb)
+{
+    if (!gb->palette_set)
+        memcpy(gb->user_palette, gb_palette, sizeof(gb_palette));
+    ppu_update_palette(gb, BGP, gb->ppu.bgp);
+    ppu_update_palette(gb, OBP0, gb->ppu.obp0);
+    ppu_update_palette(gb, OBP1, gb->ppu.obp1);
 }
 
 uint8_t read_vram(struct gb *gb, uint16_t addr)
@@ -39,193 +37,282 @@ uint8_t read_vram(struct gb *gb, uint16_t addr)
     return gb->vram[addr - 0x8000];
 }
 
-uint8_t ppu_read(struct gb *gb, uint16_t addr)
+uint8_t ppu_lcdc_read(struct gb *gb, uint16_t addr)
 {
-    uint8_t ret = 0xff;
+    return gb->ppu.lcdc.val;
+}
 
-    switch (addr) {
-    case PPU_REG_LCDC:
-        ret = gb->ppu.lcdc.val;
-        break;
-    case PPU_REG_STAT:
-        ret = gb->ppu.stat.val;
-        break;
-    case PPU_REG_SCY:
-        ret = gb->ppu.scy;
-        break; 
-    case PPU_REG_SCX:
-        ret = gb->ppu.scx;
-        break; 
-    case PPU_REG_LY:
-        ret = gb->ppu.ly;
-        break; 
-    case PPU_REG_LYC:
-        ret = gb->ppu.lyc;
-        break; 
-    case PPU_REG_BGP:
-        ret = gb->ppu.bgp;
-        break;
-    case PPU_REG_OBP0:
-        ret = gb->ppu.obp0;
-        break;
-    case PPU_REG_OBP1:
-        ret = gb->ppu.obp1;
-        break;
-    case PPU_REG_WY:
-        ret = gb->ppu.wy;
-        break;
-    case PPU_REG_WX:
-        ret = gb->ppu.wx;
-        break;
-    default:
-        break;
-    }
-    return ret;
+uint8_t ppu_stat_read(struct gb *gb, uint16_t addr)
+{
+    return gb->ppu.stat.val;
 }
 
-void ppu_write(struct gb *gb, uint16_t addr, uint8_t val)
+uint8_t ppu_scy_read(struct gb *gb, uint16_t addr)
 {
-    switch (addr) {
-    case PPU_REG_LCDC:
-        gb->ppu.lcdc.val = val;
-        if (!gb->ppu.lcdc.ppu_enable) {
-            set_mode(gb, HBLANK);
-            gb->ppu.ly = 0;
-        }
-        break;
-    case PPU_REG_STAT:
-        gb->ppu.stat.val = (val & 0xf8) | (gb->ppu.stat.val & 0x87);
-        break;
-    case PPU_REG_SCY:
-        gb->ppu.scy = val;
-        break; 
-    case PPU_REG_SCX:
-        gb->ppu.scx = val;
-        break; 
-    case PPU_REG_LYC:
-        gb->ppu.lyc = val;
-        gb->ppu.stat.lyc_equal_ly = gb->ppu.lyc == gb->ppu.ly;
-        break; 
-    case PPU_REG_BGP:
-        gb->ppu.bgp = val;
-        break;
-    case PPU_REG_OBP0:
-        gb->ppu.obp0 = val;
-        break;
-    case PPU_REG_OBP1:
-        gb->ppu.obp1 = val;
-        break;
-    case PPU_REG_WY:
-        gb->ppu.wy = val;
-        gb->ppu.window_in_frame = gb->ppu.wy == gb->ppu.ly;
-        break;
-    case PPU_REG_WX:
-        gb->ppu.wx = val;
-        break;
-    default:
-        break;
+    return gb->ppu.scy;
+}
+
+uint8_t ppu_scx_read(struct gb *gb, uint16_t addr)
+{
+    return gb->ppu.scx;
+}
+
+uint8_t ppu_ly_read(struct gb *gb, uint16_t addr)
+{
+    return gb->ppu.ly;
+}
+
+uint8_t ppu_lyc_read(struct gb *gb, uint16_t addr)
+{
+    return gb->ppu.lyc;
+}
+
+uint8_t ppu_bgp_read(struct gb *gb, uint16_t addr)
+{
+    return gb->ppu.bgp;
+}
+
+uint8_t ppu_obp0_read(struct gb *gb, uint16_t addr)
+{
+    return gb->ppu.obp0;
+}
+
+uint8_t ppu_obp1_read(struct gb *gb, uint16_t addr)
+{
+    return gb->ppu.obp1;
+}
+
+uint8_t ppu_wy_read(struct gb *gb, uint16_t addr)
+{
+    return gb->ppu.wy;
+}
+
+uint8_t ppu_wx_read(struct gb *gb, uint16_t addr)
+{
+    return gb->ppu.wx;
+}
+
+void ppu_lcdc_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    gb->ppu.lcdc.val = val;
+    if (!gb->ppu.lcdc.ppu_enable) {
+        set_mode(gb, HBLANK);
+        gb->ppu.ly = 0;
     }
+    // the STAT line has to be re-evaluated on the next dot
+    ppu_schedule(gb, true);
 }
 
-int cmpfunc(const void *a, const void *b)
+void ppu_stat_write(struct gb *gb, uint16_t addr, uint8_t val)
 {
-    struct oam_entry *sa = (struct oam_entry *)a;
-    struct oam_entry *sb = (struct oam_entry *)b;
+    gb->ppu.stat.val = (val & 0xf8) | (gb->ppu.stat.val & 0x87);
+    ppu_schedule(gb, true);
+}
 
-    return (sa->x - sb->x);
+void ppu_scy_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    gb->ppu.scy = val;
 }
 
+void ppu_scx_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    gb->ppu.scx = val;
+}
+
+void ppu_lyc_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    gb->ppu.lyc = val;
+    gb->ppu.stat.lyc_equal_ly = gb->ppu.lyc == gb->ppu.ly;
+    ppu_schedule(gb, true);
+}
+
+void ppu_bgp_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    gb->ppu.bgp = val;
+    ppu_update_palette(gb, BGP, val);
+}
+
+void ppu_obp0_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    gb->ppu.obp0 = val;
+    ppu_update_palette(gb, OBP0, val);
+}
+
+void ppu_obp1_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    gb->ppu.obp1 = val;
+    ppu_update_palette(gb, OBP1, val);
+}
+
+void ppu_wy_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    gb->ppu.wy = val;
+    gb->ppu.window_in_frame = gb->ppu.wy == gb->ppu.ly;
+}
+
+void ppu_wx_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    gb->ppu.wx = val;
+}
+
+/*
+ * Every write to OAM, by the CPU or by DMA, comes through here. A new Y moves
+ * the entry between the per-line lists, which assume 8x16 sprites so that
+ * LCDC can change the size at any time; the scan rejects the bottom half of
+ * 8x8 ones. OAM starts out zeroed, and Y 0 is on no line.
+ */
+void ppu_oam_write(struct gb *gb, uint8_t offset, uint8_t val)
+{
+    uint64_t bit = 1ULL << (offset / 4);
+    int line;
+
+    if (offset % 4 == 0 && gb->oam[offset] != val) {
+        for (line = gb->oam[offset] - 16; line < gb->oam[offset]; line++)
+            if (line >= 0 && line < SCREEN_HEIGHT)
+                gb->ppu.line_sprites[line] &= ~bit;
+        for (line = val - 16; line < val; line++)
+            if (line >= 0 && line < SCREEN_HEIGHT)
+                gb->ppu.line_sprites[line] |= bit;
+    }
+    gb->oam[offset] = val;
+}
+
+/* Select up to 10 sprites on the line in OAM order, then sort them by X.
+   The sort is stable, so for equal X the lower OAM entry stays first. */
 void ppu_oam_scan(struct gb *gb)
 {
+    struct oam_entry entry;
+    uint64_t sprites;
+    const uint8_t *oam;
+    int j;
+
     if (gb->ppu.ticks == 80) {
-        uint8_t sprite_height = (gb->ppu.lcdc.obj_size) ? 16 : 8;
-        for (int i = 0; i < 40; i++) {
-            if (gb->oam[i * 4 + 1] > 0 && gb->ppu.oam_entry_cnt < 10 &&
-                IN_RANGE(gb->ppu.ly, gb->oam[i * 4] - 16, gb->oam[i * 4] - 17 + sprite_height)) {
-                gb->ppu.oam_entry[gb->ppu.oam_entry_cnt].y = gb->oam[i * 4];
-                gb->ppu.oam_entry[gb->ppu.oam_entry_cnt].x = gb->oam[i * 4 + 1];
-                gb->ppu.oam_entry[gb->ppu.oam_entry_cnt].tile_index = gb->oam[i * 4 + 2];
-                gb->ppu.oam_entry[gb->ppu.oam_entry_cnt].attributes.val = gb->oam[i * 4 + 3];
-                gb->ppu.oam_entry_cnt++;
-            }
-            if (gb->ppu.oam_entry_cnt == 10)
-                break;
+        sprites = (gb->ppu.ly < SCREEN_HEIGHT) ? gb->ppu.line_sprites[gb->ppu.ly] : 0;
+        for (; sprites && gb->ppu.oam_entry_cnt < 10; sprites &= sprites - 1) {
+            oam = gb->oam + __builtin_ctzll(sprites) * 4;
+            if (!oam[1] || (!gb->ppu.lcdc.obj_size && gb->ppu.ly >= oam[0] - 8))
+                continue;
+            entry.y = oam[0];
+            entry.x = oam[1];
+            entry.tile_index = oam[2];
+            entry.attributes.val = oam[3];
+            for (j = gb->ppu.oam_entry_cnt; j > 0 && gb->ppu.oam_entry[j - 1].x > entry.x; j--)
+                gb->ppu.oam_entry[j] = gb->ppu.oam_entry[j - 1];
+            gb->ppu.oam_entry[j] = entry;
+            gb->ppu.oam_entry_cnt++;
         }
-        qsort(gb->ppu.oam_entry, gb->ppu.oam_entry_cnt, sizeof(struct oam_entry), cmpfunc);
         set_mode(gb, DRAWING);
     }
 }
 
+/*
+ * Tile data is decoded from 2bpp planar into one colour ID per byte as it is
+ * written, so that drawing a line copies rows of 8 pixels. VRAM starts out
+ * zeroed like the decoded tiles, and every write to 0x8000-0x97ff goes
+ * through vram_write(), so the two never disagree.
+ */
+void ppu_tile_write(struct gb *gb, uint16_t addr)
+{
+    uint16_t offset = (addr - 0x8000) & ~1;
+    uint8_t low = gb->vram[offset], high = gb->vram[offset + 1];
+    uint8_t *row = gb->ppu.tiles[offset / 16][(offset % 16) / 2];
+    uint8_t *flipped = gb->ppu.tiles_flipped[offset / 16][(offset % 16) / 2];
+
+    for (int i = 0; i < 8; i++)
+        row[i] = flipped[7 - i] = ((low >> (7 - i)) & 0x01) | (((high >> (7 - i)) & 0x01) << 1);
+}
+
+/*
+ * Colour IDs of pixels [start, end) of the line from the tile map at map,
+ * the first of them at (x, y) in map space. Each tile row is copied once;
+ * x wraps around the 256-pixel map.
+ */
+static void ppu_draw_tiles(struct gb *gb, uint8_t *line, int start, int end, uint16_t map, uint8_t x, uint8_t y)
+{
+    const uint8_t *map_row = gb->vram + (map - 0x8000) + (y / 8) * 32;
+    uint8_t tile_index;
+    int i = start, n;
+
+    while (i < end) {
+        tile_index = map_row[x / 8];
+        n = 8 - x % 8;
+        if (n > end - i)
+            n = end - i;
+        memcpy(line + i, gb->ppu.tiles[(gb->ppu.lcdc.bg_win_tiles) ? tile_index : 256 + (int8_t)tile_index][y % 8] + x % 8, n);
+        i += n;
+        x += n;
+    }
+}
+
+#define OBJ_SHOWN   0x80
+
 void ppu_draw_scanline(struct gb *gb)
 {
-    uint8_t tile_index, sprite_height, color_id_low, color_id_high, color_id,
-            offset_x, offset_y, x_pos, y_pos, sprite_color_id;
-    bool is_window_pixel;
-    uint16_t tile_map_addr, tile_addr;
-    static int window_offset = 0;
-    pixel_type_t ptype;
-
-    for (int i = 0; i < SCREEN_WIDTH; i++) {
-        // deal with bg and window
-        sprite_height = (gb->ppu.lcdc.obj_size) ? 16 : 8;
-        is_window_pixel = gb->ppu.lcdc.win_enable && gb->ppu.window_in_frame && i + 7 >= gb->ppu.wx;
-        gb->ppu.draw_window_this_line = is_window_pixel;
-        tile_map_addr = ((is_window_pixel) ? gb->ppu.lcdc.win_tile_map : gb->ppu.lcdc.bg_tile_map) ? 0x9c00 : 0x9800;
-        offset_x = (!is_window_pixel) ? (i + gb->ppu.scx) & 0xff : window_offset;
-        offset_y = (!is_window_pixel) ? (gb->ppu.ly + gb->ppu.scy) & 0xff : gb->ppu.window_line_cnt;
-        ptype = BG_WIN;
-        tile_index = read_vram(gb, tile_map_addr + ((offset_x / 8 + 32 * (offset_y / 8)) & 0x3ff));
-
-        // get tile data
-        tile_addr = (gb->ppu.lcdc.bg_win_tiles)
-                    ? 0x8000 + 16 * (uint8_t)tile_index : 0x9000 + 16 * (int8_t)tile_index;
-        if (is_window_pixel)
-            offset_x = window_offset++;
-        color_id_low = (read_vram(gb, tile_addr + (offset_y % 8) * 2) >> (7 - (offset_x % 8))) & 0x01;
-        color_id_high = (read_vram(gb, tile_addr + (offset_y % 8) * 2 + 1) >> (7 - (offset_x % 8))) & 0x01;
-        color_id = color_id_low | (color_id_high << 1);
-        gb->ppu.frame_buffer[i + gb->ppu.ly * SCREEN_WIDTH] = (gb->ppu.lcdc.bg_win_enable) 
-                                                                    ? get_color_from_palette(gb, BGP, color_id) : gb_palette[0];
-        
-        // deal with sprite
-        if (!gb->ppu.lcdc.obj_enable)
-            continue;
-        for (int j = gb->ppu.oam_entry_cnt - 1; j >= 0; j--) {
-            if (!IN_RANGE(i, gb->ppu.oam_entry[j].x - 8, gb->ppu.oam_entry[j].x))
-                continue;
-            tile_index = gb->ppu.oam_entry[j].tile_index;
-            x_pos = i - (gb->ppu.oam_entry[j].x - 8);
-            y_pos = (gb->ppu.ly - (gb->ppu.oam_entry[j].y - 16)) % 16;
-            offset_x = (gb->ppu.oam_entry[j].attributes.x_flip) ? x_pos : 7 - x_pos;
-            offset_y = (!gb->ppu.oam_entry[j].attributes.y_flip) ? y_pos : sprite_height - 1 - (y_pos);
-            if (sprite_height == 16 && y_pos >= 8)  // bottom
-                tile_index = (gb->ppu.oam_entry[j].attributes.y_flip) ?  tile_index & 0xfe : tile_index | 0x01;
-            else if (sprite_height == 16 && y_pos <= 7) // top
-                tile_index = (gb->ppu.oam_entry[j].attributes.y_flip) ?  tile_index | 0x01 : tile_index & 0xfe;
-            tile_addr = 0x8000 + 16 * (uint8_t)tile_index;
-            // TODO
-            uint8_t test = (!gb->ppu.oam_entry[j].attributes.y_flip) ? (y_pos % 8) : 7 - (y_pos % 8);
-            // color_id_low = (read_vram(gb, tile_addr + (offset_y) * 2) >> (offset_x)) & 0x01;
-            // color_id_high = (read_vram(gb, tile_addr + (offset_y) * 2 + 1) >> (offset_x)) & 0x01;
-            color_id_low = (read_vram(gb, tile_addr + (test) * 2) >> (offset_x)) & 0x01;
-            color_id_high = (read_vram(gb, tile_addr + (test) * 2 + 1) >> (offset_x)) & 0x01;
-            sprite_color_id = color_id_low | (color_id_high << 1);
-            if (((ptype == BG_WIN) && (!sprite_color_id || (sprite_color_id > 0 && gb->ppu.oam_entry[j].attributes.priority && color_id > 0))) ||
-                ((ptype == SPRITE) && (color_id > 0 && !sprite_color_id)))
+    uint8_t tile_index, sprite_height, y_pos;
+    uint8_t line[SCREEN_WIDTH], obj[SCREEN_WIDTH];
+    uint32_t *pixels = gb->ppu.frame_buffer + gb->ppu.ly * SCREEN_WIDTH;
+    const struct oam_entry *entry;
+    const uint32_t *colors;
+    const uint8_t *row;
+    int window_start = SCREEN_WIDTH;
+
+    // the window covers the line from WX - 7 to the right edge
+    gb->ppu.draw_window_this_line = gb->ppu.lcdc.win_enable && gb->ppu.window_in_frame &&
+                                    gb->ppu.wx < SCREEN_WIDTH + 7;
+    if (gb->ppu.draw_window_this_line)
+        window_start = (gb->ppu.wx > 7) ? gb->ppu.wx - 7 : 0;
+    ppu_draw_tiles(gb, line, 0, window_start, (gb->ppu.lcdc.bg_tile_map) ? 0x9c00 : 0x9800,
+                   gb->ppu.scx, gb->ppu.ly + gb->ppu.scy);
+    ppu_draw_tiles(gb, line, window_start, SCREEN_WIDTH, (gb->ppu.lcdc.win_tile_map) ? 0x9c00 : 0x9800,
+                   0, gb->ppu.window_line_cnt);
+    if (gb->ppu.lcdc.bg_win_enable) {
+        colors = gb->ppu.colors[BGP];
+        for (int i = 0; i < SCREEN_WIDTH; i++)
+            pixels[i] = colors[line[i]];
+    } else {
+        for (int i = 0; i < SCREEN_WIDTH; i++)
+            pixels[i] = gb->user_palette[0];
+    }
+
+    if (!gb->ppu.lcdc.obj_enable)
+        return;
+    /*
+     * Sprites are merged one at a time, in X order, into obj: the colour ID
+     * and palette of the frontmost opaque sprite on each pixel, with OBJ_SHOWN
+     * set once any opaque sprite there is not behind a non-zero background.
+     * The column right of each sprite is in range but transparent.
+     */
+    memset(obj, 0, sizeof(obj));
+    sprite_height = (gb->ppu.lcdc.obj_size) ? 16 : 8;
+    for (int j = 0; j < gb->ppu.oam_entry_cnt; j++) {
+        entry = &gb->ppu.oam_entry[j];
+        tile_index = entry->tile_index;
+        y_pos = gb->ppu.ly - (entry->y - 16);
+        if (sprite_height == 16)
+            tile_index = ((y_pos >= 8) != entry->attributes.y_flip) ? tile_index | 0x01 : tile_index & 0xfe;
+        y_pos = (!entry->attributes.y_flip) ? y_pos % 8 : 7 - y_pos % 8;
+        row = (entry->attributes.x_flip) ? gb->ppu.tiles_flipped[tile_index][y_pos]
+                                         : gb->ppu.tiles[tile_index][y_pos];
+        for (int x = 0, i = entry->x - 8; x < 8; x++, i++) {
+            if (i < 0 || i >= SCREEN_WIDTH || !row[x])
                 continue;
-            gb->ppu.frame_buffer[i + gb->ppu.ly * SCREEN_WIDTH] = 
-                            get_color_from_palette(gb, gb->ppu.oam_entry[j].attributes.dmg_palette, sprite_color_id);
-            color_id = sprite_color_id;
-            ptype = SPRITE;
+            if (!(obj[i] & 0x03))
+                obj[i] = row[x] | (entry->attributes.dmg_palette << 2);
+            if (!entry->attributes.priority || !line[i])
+                obj[i] |= OBJ_SHOWN;
         }
     }
-    window_offset = 0;
+    for (int i = 0; i < SCREEN_WIDTH; i++)
+        if (obj[i] & OBJ_SHOWN)
+            pixels[i] = gb->ppu.colors[(obj[i] >> 2) & 0x01][obj[i] & 0x03];
 }
 
 void ppu_draw(struct gb *gb)
 {
     if (gb->ppu.ticks == 252) {
+        TRACE_BEGIN(gb, start);
         ppu_draw_scanline(gb);
+        TRACE_END(gb, TRACE_SCANLINE, start);
         set_mode(gb, HBLANK);
     }
 }
@@ -244,9 +331,36 @@ void ppu_check_stat_intr(struct gb *gb)
     gb->ppu.stat_intr_line = stat_intr_line;
 }
 
-void ppu_tick(struct gb *gb)
+/* The dot at which the current mode ends */
+static uint16_t ppu_mode_end(struct gb *gb)
+{
+    uint16_t ret = 456;
+
+    switch (gb->ppu.mode) {
+    case OAM_SCAN:
+        ret = 80;
+        break;
+    case DRAWING:
+        ret = 252;
+        break;
+    default:
+        break;
+    }
+    return ret;
+}
+
+void ppu_schedule(struct gb *gb, bool check_stat)
+{
+    uint64_t when = gb->ppu.line_start + ppu_mode_end(gb);
+
+    if (check_stat && gb->scheduler.now + 1 < when)
+        when = gb->scheduler.now + 1;
+    scheduler_schedule(gb, EVENT_PPU, when);
+}
+
+void ppu_event(struct gb *gb)
 {
-    gb->ppu.ticks++;
+    gb->ppu.ticks = gb->scheduler.now - gb->ppu.line_start;
     switch (gb->ppu.mode) {
     case OAM_SCAN:
         ppu_oam_scan(gb);
@@ -264,6 +378,7 @@ void ppu_tick(struct gb *gb)
                 if (gb->ppu.lcdc.ppu_enable)
                     interrupt_request(gb, INTR_SRC_VBLANK);
                 gb->ppu.frame_ready = true;
+                COUNTER_ADD(gb->stats.frames, 1);
                 gb->ppu.window_line_cnt = 0;
                 gb->ppu.draw_window_this_line = false;
                 gb->ppu.window_in_frame = false;
@@ -277,6 +392,7 @@ void ppu_tick(struct gb *gb)
                 }
             }
             gb->ppu.ticks = 0;
+            gb->ppu.line_start = gb->scheduler.now;
             gb->ppu.oam_entry_cnt = 0;
         }
         break;
@@ -294,10 +410,12 @@ void ppu_tick(struct gb *gb)
             }
             gb->ppu.stat.lyc_equal_ly = gb->ppu.ly == gb->ppu.lyc;
             gb->ppu.ticks = 0;
+            gb->ppu.line_start = gb->scheduler.now;
         }
         break;
     default:
         break;
     }
     ppu_check_stat_intr(gb);
+    ppu_schedule(gb, false);
 }
\ No newline at end of file
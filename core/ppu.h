@@ -6,6 +6,7 @@ extern "C" {
 
 #include "gb.h"
 #include "interrupt.h"
+#include "scheduler.h"
 
 #define PPU_REG_LCDC                0xff40
 #define PPU_REG_STAT                0xff41
@@ -30,14 +31,33 @@ typedef enum {
     BGP,
 } palette_t;
 
-typedef enum {
-    BG_WIN,
-    SPRITE,
-} pixel_type_t;
-
-uint8_t ppu_read(struct gb *gb, uint16_t addr);
-void ppu_write(struct gb *gb, uint16_t addr, uint8_t val);
-void ppu_tick(struct gb *gb);
+uint8_t ppu_lcdc_read(struct gb *gb, uint16_t addr);
+uint8_t ppu_stat_read(struct gb *gb, uint16_t addr);
+uint8_t ppu_scy_read(struct gb *gb, uint16_t addr);
+uint8_t ppu_scx_read(struct gb *gb, uint16_t addr);
+uint8_t ppu_ly_read(struct gb *gb, uint16_t addr);
+uint8_t ppu_lyc_read(struct gb *gb, uint16_t addr);
+uint8_t ppu_bgp_read(struct gb *gb, uint16_t addr);
+uint8_t ppu_obp0_read(struct gb *gb, uint16_t addr);
+uint8_t ppu_obp1_read(struct gb *gb, uint16_t addr);
+uint8_t ppu_wy_read(struct gb *gb, uint16_t addr);
+uint8_t ppu_wx_read(struct gb *gb, uint16_t addr);
+void ppu_lcdc_write(struct gb *gb, uint16_t addr, uint8_t val);
+void ppu_stat_write(struct gb *gb, uint16_t addr, uint8_t val);
+void ppu_scy_write(struct gb *gb, uint16_t addr, uint8_t val);
+void ppu_scx_write(struct gb *gb, uint16_t addr, uint8_t val);
+void ppu_lyc_write(struct gb *gb, uint16_t addr, uint8_t val);
+void ppu_bgp_write(struct gb *gb, uint16_t addr, uint8_t val);
+void ppu_obp0_write(struct gb *gb, uint16_t addr, uint8_t val);
+void ppu_obp1_write(struct gb *gb, uint16_t addr, uint8_t val);
+void ppu_wy_write(struct gb *gb, uint16_t addr, uint8_t val);
+void ppu_wx_write(struct gb *gb, uint16_t addr, uint8_t val);
+void ppu_update_palettes(struct gb *gb);
+void ppu_oam_write(struct gb *gb, uint8_t offset, uint8_t val);
+void ppu_tile_write(struct gb *gb, uint16_t addr);
+void ppu_draw_scanline(struct gb *gb);
+void ppu_schedule(struct gb *gb, bool check_stat);
+void ppu_event(struct gb *gb);
 
 #ifdef __cplusplus
 }
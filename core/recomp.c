@@ -0,0 +1,51 @@
+#include "recomp.h"
+
+/*
+ * Files generated by gbda-recomp register themselves here when the program
+ * starts. When a cartridge is loaded the one whose header checksums match is
+ * attached, and the block cache asks it for compiled code every time it
+ * decodes a ROM block. Keys are ROM offsets, so a bank switch can never run
+ * code compiled for another bank.
+ */
+static struct recomp_rom *recomp_roms;
+
+void recomp_register(struct recomp_rom *rom)
+{
+    rom->next = recomp_roms;
+    recomp_roms = rom;
+}
+
+void recomp_attach(struct gb *gb)
+{
+    uint8_t header_checksum = gb->cart.rom[0x14d];
+    uint16_t global_checksum = TO_U16(gb->cart.rom[0x14f], gb->cart.rom[0x14e]);
+
+    gb->recomp = NULL;
+    for (struct recomp_rom *rom = recomp_roms; rom; rom = rom->next) {
+        if (rom->header_checksum == header_checksum && rom->global_checksum == global_checksum) {
+            gb->recomp = rom;
+            break;
+        }
+    }
+}
+
+/* Blocks are sorted by offset */
+bool (*recomp_find(struct gb *gb, uint32_t offset))(struct gb *gb)
+{
+    const struct recomp_rom *rom = gb->recomp;
+    int lo = 0, hi, mid;
+
+    if (!rom)
+        return NULL;
+    hi = rom->count - 1;
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (rom->blocks[mid].offset == offset)
+            return rom->blocks[mid].run;
+        else if (rom->blocks[mid].offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return NULL;
+}
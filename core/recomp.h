@@ -0,0 +1,15 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gb.h"
+
+void recomp_register(struct recomp_rom *rom);
+void recomp_attach(struct gb *gb);
+bool (*recomp_find(struct gb *gb, uint32_t offset))(struct gb *gb);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,59 @@
+#include "scheduler.h"
+#include "timer.h"
+#include "ppu.h"
+#include "apu.h"
+#include "dma.h"
+
+/* Components are only called when something observable happens to them.
+   Every event is a timestamp in T-cycles; when two events share the same
+   timestamp they run in event_t order, which is the order the components
+   used to be ticked in. */
+static void (*event_handler[])(struct gb *gb) = {
+    [EVENT_TIMER] = timer_event,
+    [EVENT_PPU] = ppu_event,
+    [EVENT_APU] = apu_event,
+    [EVENT_DMA] = dma_event,
+};
+
+static void scheduler_update_next(struct scheduler *scheduler)
+{
+    scheduler->next = EVENT_NEVER;
+    for (int i = 0; i < EVENT_MAX; i++)
+        if (scheduler->events[i] < scheduler->next)
+            scheduler->next = scheduler->events[i];
+}
+
+void scheduler_init(struct gb *gb)
+{
+    gb->scheduler.now = 0;
+    for (int i = 0; i < EVENT_MAX; i++)
+        gb->scheduler.events[i] = EVENT_NEVER;
+    gb->scheduler.next = EVENT_NEVER;
+}
+
+void scheduler_schedule(struct gb *gb, event_t event, uint64_t when)
+{
+    gb->scheduler.events[event] = when;
+    scheduler_update_next(&gb->scheduler);
+}
+
+void scheduler_cancel(struct gb *gb, event_t event)
+{
+    scheduler_schedule(gb, event, EVENT_NEVER);
+}
+
+void scheduler_run(struct gb *gb, uint64_t until)
+{
+    struct scheduler *scheduler = &gb->scheduler;
+    event_t event;
+
+    while (scheduler->next <= until) {
+        for (event = 0; scheduler->events[event] != scheduler->next; event++)
+            ;
+        scheduler->now = scheduler->next;
+        scheduler->events[event] = EVENT_NEVER;
+        scheduler_update_next(scheduler);
+        event_handler[event](gb);
+    }
+    scheduler->now = until;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gb.h"
+
+#define EVENT_NEVER                 UINT64_MAX
+
+void scheduler_init(struct gb *gb);
+void scheduler_schedule(struct gb *gb, event_t event, uint64_t when);
+void scheduler_cancel(struct gb *gb, event_t event);
+void scheduler_run(struct gb *gb, uint64_t until);
+
+#ifdef __cplusplus
+}
+#endif
@@ -40,45 +40,40 @@ int cb_instr_cycle[] = {
     2, 2, 2, 2, 2, 2, 4, 2, 2, 2, 2, 2, 2, 2, 4, 2, // Fx 
 };
 
-void sm83_tick(struct gb *gb)
-{
-    for (int i = 0; i < 4; i++) {
-        timer_tick(gb);
-        ppu_tick(gb);
-        apu_tick(gb);
-    }
-}
+int instr_length[] = {
+//  x0 x1 x2 x3 x4 x5 x6 x7 x8 x9 xA xB xC xD xE xF
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1, // 0x
+    1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 1x
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 2x
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1, // 3x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 4x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 5x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 6x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 7x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 8x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 9x
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // Ax
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // Bx
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1, // Cx
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, // Dx
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // Ex
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1, // Fx
+};
 
 void sm83_cycle(struct gb *gb, int cycles)
 {
-    static int i = 0, passed_cycles = 0;
-
-    for (int j = 0; j < cycles; j++) {
-        passed_cycles += 1;
-        if (passed_cycles == 95) {
-            passed_cycles = 0;
-        }
-        sm83_tick(gb);
-
-        // deal with DMA
-        if (gb->dma.mode == WAITING) {
-            gb->dma.mode = TRANSFERING;
-        } else if (gb->dma.mode == TRANSFERING) {
-            gb->oam[i] = dma_get_data(gb, gb->dma.start_addr + i);
-            if (i == 0x9f) {
-                gb->dma.mode = OFF;
-                i = 0;
-            } else {
-                i++;
-            }
-        }
-    }
+    scheduler_run(gb, gb->scheduler.now + cycles * 4);
 }
 
 void sm83_init(struct gb *gb)
 {
     gb->cpu.pc = 0;
     gb->cart.cartridge_loaded = false;
+    scheduler_init(gb);
+    gb->recomp = NULL;
+#ifdef SM83_JIT
+    jit_init(gb);
+#endif
 }
 
 uint8_t sm83_fetch_byte(struct gb *gb)
@@ -101,6 +96,15 @@ uint16_t sm83_fetch_word(struct gb *gb)
     return TO_U16(lsb, msb);
 }
 
+static inline uint16_t sm83_fetch_operand(struct gb *gb, uint8_t opcode)
+{
+    switch (instr_length[opcode]) {
+    case 2:  return sm83_fetch_byte(gb);
+    case 3:  return sm83_fetch_word(gb);
+    default: return 0;
+    }
+}
+
 void sm83_push_byte(struct gb *gb, uint8_t val)
 {
     bus_write(gb, --gb->cpu.sp, val);
@@ -133,6 +137,129 @@ static inline void toggle_znh(struct gb *gb, uint8_t res, bool n, bool h)
     gb->cpu.af.flag.h = h;
 }
 
+/*
+ * Lazy flags. ADD/ADC/SUB/SBC/CP, 8-bit INC/DEC and AND/OR/XOR only record
+ * their operands in cpu.lazy; flags_sync() recomputes Z/N/H/C from them the
+ * first time F is needed and writes it with a single store. Everything that
+ * reads F, or writes only some of its flags, syncs first.
+ */
+static inline void flags_record(struct gb *gb, flags_op_t op, uint8_t a, uint8_t b, uint8_t c)
+{
+    gb->cpu.lazy.op = op;
+    gb->cpu.lazy.a = a;
+    gb->cpu.lazy.b = b;
+    gb->cpu.lazy.c = c;
+}
+
+static void flags_materialize(struct gb *gb)
+{
+    uint8_t a = gb->cpu.lazy.a, b = gb->cpu.lazy.b, c = gb->cpu.lazy.c;
+    uint16_t res, carry_per_bit;
+    bool z, n, h;
+
+    switch (gb->cpu.lazy.op) {
+    case FLAGS_ADD:
+        res = a + b + c;
+        carry_per_bit = res ^ a ^ b;
+        z = !(uint8_t)res;
+        n = 0;
+        h = BIT(carry_per_bit, 4);
+        c = BIT(carry_per_bit, 8);
+        break;
+    case FLAGS_SUB:
+        res = a + ~b + 1 - c;
+        carry_per_bit = res ^ a ^ ~b;
+        z = !(uint8_t)res;
+        n = 1;
+        h = !BIT(carry_per_bit, 4);
+        c = !BIT(carry_per_bit, 8);
+        break;
+    case FLAGS_INC:
+        res = (uint8_t)(a + 1);
+        carry_per_bit = res ^ a ^ 1;
+        z = !res;
+        n = 0;
+        h = BIT(carry_per_bit, 4);
+        break;
+    case FLAGS_DEC:
+        res = (uint8_t)(a - 1);
+        carry_per_bit = res ^ a ^ 0xff;
+        z = !res;
+        n = 1;
+        h = !BIT(carry_per_bit, 4);
+        break;
+    default:    // FLAGS_LOGIC: a is the result, b the half-carry
+        z = !a;
+        n = 0;
+        h = b;
+        c = 0;
+        break;
+    }
+    gb->cpu.af.f = (gb->cpu.af.f & 0x0f) | (z << 7) | (n << 6) | (h << 5) | (c << 4);
+    gb->cpu.lazy.op = FLAGS_SYNCED;
+}
+
+static inline void flags_sync(struct gb *gb)
+{
+    if (gb->cpu.lazy.op != FLAGS_SYNCED)
+        flags_materialize(gb);
+}
+
+static inline bool flag_z(struct gb *gb)
+{
+    flags_sync(gb);
+    return gb->cpu.af.flag.z;
+}
+
+/* INC/DEC keep the carry, so it is known without a full sync */
+static inline bool flag_c(struct gb *gb)
+{
+    switch (gb->cpu.lazy.op) {
+    case FLAGS_INC:
+    case FLAGS_DEC:
+        return gb->cpu.lazy.c;
+    case FLAGS_LOGIC:
+        return 0;
+    default:
+        flags_sync(gb);
+        return gb->cpu.af.flag.c;
+    }
+}
+
+void sm83_flags_sync(struct gb *gb)
+{
+    flags_sync(gb);
+}
+
+bool sm83_flag_z(struct gb *gb)
+{
+    return flag_z(gb);
+}
+
+bool sm83_flag_c(struct gb *gb)
+{
+    return flag_c(gb);
+}
+
+/* AF as seen by PUSH AF and written by POP AF */
+uint16_t sm83_get_af(struct gb *gb)
+{
+    flags_sync(gb);
+    return gb->cpu.af.val;
+}
+
+void sm83_set_af(struct gb *gb, uint16_t val)
+{
+    gb->cpu.af.val = val & 0xfff0;
+    gb->cpu.lazy.op = FLAGS_SYNCED;
+}
+
+/* Flags of AND/OR/XOR, from the new value of A */
+void sm83_flags_logic(struct gb *gb, bool h)
+{
+    flags_record(gb, FLAGS_LOGIC, gb->cpu.af.a, h, 0);
+}
+
 /* Instructions */
 
 static inline void ld_indirect_hl_n(struct gb *gb, uint8_t n)
@@ -142,22 +269,22 @@ static inline void ld_indirect_hl_n(struct gb *gb, uint8_t n)
 
 static inline void ldh_indirect_c_a(struct gb *gb)
 {
-    bus_write(gb, 0xff00 + gb->cpu.bc.c, gb->cpu.af.a);
+    io_write(gb, 0xff00 + gb->cpu.bc.c, gb->cpu.af.a);
 }
 
 static inline void ldh_a_indirect_c(struct gb *gb)
 {
-    gb->cpu.af.a = bus_read(gb, 0xff00 + gb->cpu.bc.c);
+    gb->cpu.af.a = io_read(gb, 0xff00 + gb->cpu.bc.c);
 }
 
 static inline void ldh_indirect_n_a(struct gb *gb, uint8_t n)
 {
-    bus_write(gb, 0xff00 + n, gb->cpu.af.a);
+    io_write(gb, 0xff00 + n, gb->cpu.af.a);
 }
 
 static inline void ldh_a_indirect_n(struct gb *gb, uint8_t n)
 {
-    gb->cpu.af.a = bus_read(gb, 0xff00 + n);
+    gb->cpu.af.a = io_read(gb, 0xff00 + n);
 }
 
 static inline void ld_indirect_nn_sp(struct gb *gb, uint16_t nn)
@@ -175,6 +302,7 @@ static inline void ld_hl_sp_plus_i8(struct gb *gb, uint8_t i8)
 {
     uint16_t carry_per_bit = (gb->cpu.sp + i8) ^ gb->cpu.sp ^ i8;
 
+    flags_sync(gb);
     gb->cpu.hl.val = gb->cpu.sp + (int8_t)i8;
     gb->cpu.af.flag.z = 0;
     gb->cpu.af.flag.n = 0;
@@ -184,97 +312,78 @@ static inline void ld_hl_sp_plus_i8(struct gb *gb, uint8_t i8)
 
 void add(struct gb *gb, uint8_t b, uint8_t c)
 {
-    uint16_t res = gb->cpu.af.a + b + c;
-    uint16_t carry_per_bit = res ^ gb->cpu.af.a ^ b;
-
-    gb->cpu.af.a = res;
-    toggle_znh(gb, res, 0, BIT(carry_per_bit, 4));
-    gb->cpu.af.flag.c = BIT(carry_per_bit, 8);
+    flags_record(gb, FLAGS_ADD, gb->cpu.af.a, b, c);
+    gb->cpu.af.a += b + c;
 }
 
 void sub(struct gb *gb, uint8_t b, uint8_t c)
 {
-    uint16_t res = gb->cpu.af.a + ~b + 1 - c;
-    uint16_t carry_per_bit = res ^ gb->cpu.af.a ^ ~b;
-
-    gb->cpu.af.a = res;
-    toggle_znh(gb, res, 1, !BIT(carry_per_bit, 4));
-    gb->cpu.af.flag.c = !BIT(carry_per_bit, 8);
+    flags_record(gb, FLAGS_SUB, gb->cpu.af.a, b, c);
+    gb->cpu.af.a -= b + c;
 }
 
 void cp(struct gb *gb, uint8_t b)
 {
-    uint16_t res = gb->cpu.af.a + ~b + 1;
-    uint16_t carry_per_bit = gb->cpu.af.a ^ ~b ^ res;
-
-    toggle_znh(gb, res, 1, !BIT(carry_per_bit, 4));
-    gb->cpu.af.flag.c = !BIT(carry_per_bit, 8);
+    flags_record(gb, FLAGS_SUB, gb->cpu.af.a, b, 0);
 }
 
 void inc_r(struct gb *gb, uint8_t *r)
 {
-    uint8_t res = *r + 1, carry_per_bit = res ^ *r ^ 1;
-
+    flags_record(gb, FLAGS_INC, *r, 0, flag_c(gb));
     *r += 1;
-    toggle_znh(gb, res, 0, BIT(carry_per_bit, 4));
 }
 
 void inc_indirect_hl(struct gb *gb)
 {
     uint8_t val = bus_read(gb, gb->cpu.hl.val);
-    uint8_t res = val + 1, carry_per_bit = res ^ val ^ 1U;
 
-    bus_write(gb, gb->cpu.hl.val, res);
-    toggle_znh(gb, res, 0, BIT(carry_per_bit, 4));
+    flags_record(gb, FLAGS_INC, val, 0, flag_c(gb));
+    bus_write(gb, gb->cpu.hl.val, val + 1);
 }
 
 void dec_r(struct gb *gb, uint8_t *r)
 {
-    uint8_t res = *r - 1, carry_per_bit = res ^ *r ^ 0xff;
-
+    flags_record(gb, FLAGS_DEC, *r, 0, flag_c(gb));
     *r -= 1;
-    toggle_znh(gb, res, 1, !BIT(carry_per_bit, 4));
 }
 
 void dec_indirect_hl(struct gb *gb)
 {
     uint8_t val = bus_read(gb, gb->cpu.hl.val);
-    uint8_t res = val - 1, carry_per_bit = res ^ val ^ 0xff;
 
-    bus_write(gb, gb->cpu.hl.val, res);
-    toggle_znh(gb, res, 1, !BIT(carry_per_bit, 4));
+    flags_record(gb, FLAGS_DEC, val, 0, flag_c(gb));
+    bus_write(gb, gb->cpu.hl.val, val - 1);
 }
 
 static inline void and(struct gb *gb, uint8_t b)
 {
     gb->cpu.af.a &= b;
-    toggle_znh(gb, gb->cpu.af.a, 0, 1);
-    gb->cpu.af.flag.c = 0;
+    flags_record(gb, FLAGS_LOGIC, gb->cpu.af.a, 1, 0);
 }
 
 static inline void or(struct gb *gb, uint8_t b)
 {
     gb->cpu.af.a |= b;
-    toggle_znh(gb, gb->cpu.af.a, 0, 0);
-    gb->cpu.af.flag.c = 0;
+    flags_record(gb, FLAGS_LOGIC, gb->cpu.af.a, 0, 0);
 }
 
 static inline void xor(struct gb *gb, uint8_t b)
 {
     gb->cpu.af.a ^= b;
-    toggle_znh(gb, gb->cpu.af.a, 0, 0);
-    gb->cpu.af.flag.c = 0;
+    flags_record(gb, FLAGS_LOGIC, gb->cpu.af.a, 0, 0);
 }
 
-static inline void ccf(struct gb *gb)
+void ccf(struct gb *gb)
 {
+    flags_sync(gb);
     gb->cpu.af.flag.n = 0;
     gb->cpu.af.flag.h = 0;
     gb->cpu.af.flag.c = !gb->cpu.af.flag.c;
 }
 
-static inline void scf(struct gb *gb)
+void scf(struct gb *gb)
 {
+    flags_sync(gb);
     gb->cpu.af.flag.n = 0;
     gb->cpu.af.flag.h = 0;
     gb->cpu.af.flag.c = 1;
@@ -283,6 +392,8 @@ static inline void scf(struct gb *gb)
 void daa(struct gb *gb)
 {
     uint8_t a = gb->cpu.af.a;
+
+    flags_sync(gb);
     if (!gb->cpu.af.flag.n) {
         if (gb->cpu.af.flag.h || (gb->cpu.af.a & 0x0f) > 0x09)
             a += 0x06;
@@ -301,8 +412,9 @@ void daa(struct gb *gb)
     gb->cpu.af.a = a;
 }
 
-static inline void cpl(struct gb *gb)
+void cpl(struct gb *gb)
 {
+    flags_sync(gb);
     gb->cpu.af.a = ~gb->cpu.af.a;
     gb->cpu.af.flag.n = 1;
     gb->cpu.af.flag.h = 1;
@@ -323,6 +435,7 @@ void add_hl_rr(struct gb *gb, uint16_t rr)
     uint32_t res = gb->cpu.hl.val + rr;
     uint32_t carry_per_bit = res ^ gb->cpu.hl.val ^ rr;
 
+    flags_sync(gb);
     gb->cpu.hl.val = res;
     gb->cpu.af.flag.n = 0;
     gb->cpu.af.flag.h = BIT(carry_per_bit, 12);
@@ -333,21 +446,24 @@ void add_sp_i8(struct gb *gb, uint8_t i8)
 {
     uint16_t carry_per_bit = (gb->cpu.sp + i8) ^ gb->cpu.sp ^ i8;
 
+    flags_sync(gb);
     gb->cpu.sp = gb->cpu.sp + (int8_t)i8;
     gb->cpu.af.flag.z = gb->cpu.af.flag.n = 0;
     gb->cpu.af.flag.h = BIT(carry_per_bit, 4);
     gb->cpu.af.flag.c = BIT(carry_per_bit, 8);
 }
 
-static inline void rlca(struct gb *gb)
+void rlca(struct gb *gb)
 {
+    flags_sync(gb);
     gb->cpu.af.flag.c = BIT(gb->cpu.af.a, 7);
     gb->cpu.af.a = (gb->cpu.af.a << 1) | gb->cpu.af.flag.c;
     gb->cpu.af.flag.z = gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0; 
 }
 
-static inline void rrca(struct gb *gb)
+void rrca(struct gb *gb)
 {
+    flags_sync(gb);
     gb->cpu.af.flag.c = BIT(gb->cpu.af.a, 0);
     gb->cpu.af.a = (gb->cpu.af.a >> 1) | (gb->cpu.af.flag.c << 7);
     gb->cpu.af.flag.z = gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0; 
@@ -357,6 +473,7 @@ void rla(struct gb *gb)
 {
     uint8_t new_c = BIT(gb->cpu.af.a, 7);
 
+    flags_sync(gb);
     gb->cpu.af.a = (gb->cpu.af.a << 1) | gb->cpu.af.flag.c;
     gb->cpu.af.flag.c = new_c;
     gb->cpu.af.flag.z = gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0; 
@@ -366,6 +483,7 @@ void rra(struct gb *gb)
 {
     uint8_t new_c = BIT(gb->cpu.af.a, 0);
 
+    flags_sync(gb);
     gb->cpu.af.a = (gb->cpu.af.a >> 1) | (gb->cpu.af.flag.c << 7);
     gb->cpu.af.flag.c = new_c;
     gb->cpu.af.flag.z = gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0; 
@@ -379,17 +497,6 @@ void rlc_r(struct gb *gb, uint8_t *r)
     gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0;
 }
 
-void rlc_indirect_hl(struct gb *gb)
-{
-    uint8_t val = bus_read(gb, gb->cpu.hl.val);
-
-    gb->cpu.af.flag.c = BIT(val, 7);
-    val = (val << 1) | gb->cpu.af.flag.c;
-    bus_write(gb, gb->cpu.hl.val, val);
-    gb->cpu.af.flag.z = !val;
-    gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0;
-}
-
 void rrc_r(struct gb *gb, uint8_t *r)
 {
     gb->cpu.af.flag.c = BIT(*r, 0);
@@ -398,17 +505,6 @@ void rrc_r(struct gb *gb, uint8_t *r)
     gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0;
 }
 
-void rrc_indirect_hl(struct gb *gb)
-{
-    uint8_t val = bus_read(gb, gb->cpu.hl.val);
-
-    gb->cpu.af.flag.c = BIT(val, 0);
-    val = (val >> 1) | (gb->cpu.af.flag.c << 7);
-    bus_write(gb, gb->cpu.hl.val, val);
-    gb->cpu.af.flag.z = !val;
-    gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0;
-}
-
 void rl_r(struct gb *gb, uint8_t *r)
 {
     uint8_t new_c = BIT(*r, 7);
@@ -419,17 +515,6 @@ void rl_r(struct gb *gb, uint8_t *r)
     gb->cpu.af.flag.c = new_c;
 }
 
-void rl_indirect_hl(struct gb *gb)
-{
-    uint8_t val = bus_read(gb, gb->cpu.hl.val), new_c = BIT(val, 7);
-
-    val = (val << 1) | gb->cpu.af.flag.c;
-    bus_write(gb, gb->cpu.hl.val, val);
-    gb->cpu.af.flag.z = !val;
-    gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0;
-    gb->cpu.af.flag.c = new_c;
-}
-
 void rr_r(struct gb *gb, uint8_t *r)
 {
     uint8_t new_c = BIT(*r, 0);
@@ -440,17 +525,6 @@ void rr_r(struct gb *gb, uint8_t *r)
     gb->cpu.af.flag.c = new_c;
 }
 
-void rr_indirect_hl(struct gb *gb)
-{
-    uint8_t val = bus_read(gb, gb->cpu.hl.val), new_c = BIT(val, 0);
-
-    val = (val >> 1) | (gb->cpu.af.flag.c << 7);
-    bus_write(gb, gb->cpu.hl.val, val);
-    gb->cpu.af.flag.z = !val;
-    gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0;
-    gb->cpu.af.flag.c = new_c;
-}
-
 void sla_r(struct gb *gb, uint8_t *r)
 {
     gb->cpu.af.flag.c = BIT(*r, 7);
@@ -459,17 +533,6 @@ void sla_r(struct gb *gb, uint8_t *r)
     gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0;
 }
 
-void sla_indirect_hl(struct gb *gb)
-{
-    uint8_t val = bus_read(gb, gb->cpu.hl.val);
-
-    gb->cpu.af.flag.c = BIT(val, 7);
-    val <<= 1;
-    bus_write(gb, gb->cpu.hl.val, val);
-    gb->cpu.af.flag.z = !val;
-    gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0;
-}
-
 void sra_r(struct gb *gb, uint8_t *r)
 {
     gb->cpu.af.flag.c = BIT(*r, 0);
@@ -478,17 +541,6 @@ void sra_r(struct gb *gb, uint8_t *r)
     gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0;
 }
 
-void sra_indirect_hl(struct gb *gb)
-{
-    uint8_t val = bus_read(gb, gb->cpu.hl.val);
-
-    gb->cpu.af.flag.c = BIT(val, 0);
-    val = (val & 0x80) | (val >> 1);
-    bus_write(gb, gb->cpu.hl.val, val);
-    gb->cpu.af.flag.z = !val;
-    gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0;
-}
-
 void swap_r(struct gb *gb, uint8_t *r)
 {
     *r = (*r >> 4) | (*r << 4);
@@ -496,16 +548,6 @@ void swap_r(struct gb *gb, uint8_t *r)
     gb->cpu.af.flag.c = 0;
 }
 
-void swap_indirect_hl(struct gb *gb)
-{
-    uint8_t val = bus_read(gb, gb->cpu.hl.val);
-
-    val = (val >> 4) | (val << 4);
-    bus_write(gb, gb->cpu.hl.val, val);
-    toggle_znh(gb, val, 0, 0);
-    gb->cpu.af.flag.c = 0;
-}
-
 void srl_r(struct gb *gb, uint8_t *r)
 {
     gb->cpu.af.flag.c = BIT(*r, 0);
@@ -514,100 +556,99 @@ void srl_r(struct gb *gb, uint8_t *r)
     gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0;
 }
 
-void srl_indirect_hl(struct gb *gb)
-{
-    uint8_t val = bus_read(gb, gb->cpu.hl.val);
-
-    gb->cpu.af.flag.c = BIT(val, 0);
-    val >>= 1;
-    bus_write(gb, gb->cpu.hl.val, val);
-    gb->cpu.af.flag.z = !val;
-    gb->cpu.af.flag.n = gb->cpu.af.flag.h = 0;
-}
-
 static inline void bit_n_r(struct gb *gb, uint8_t n, uint8_t *r)
 {
     toggle_znh(gb, BIT(*r, n), 0, 1);
 }
 
-void bit_n_indirect_hl(struct gb *gb, uint8_t n)
-{
-    uint8_t val = bus_read(gb, gb->cpu.hl.val);
-
-    toggle_znh(gb, BIT(val, n), 0, 1);
-}
-
 void res_n_r(struct gb *gb, uint8_t n, uint8_t *r)
 {
     RES(*r, n); 
 }
 
-void res_n_indirect_hl(struct gb *gb, uint8_t n)
-{
-    uint8_t val = bus_read(gb, gb->cpu.hl.val);
-
-    RES(val, n);
-    bus_write(gb, gb->cpu.hl.val, val);
-}
-
 void set_n_r(struct gb *gb, uint8_t n, uint8_t *r)
 {
     SET(*r, n);
 }
 
-void set_n_indirect_hl(struct gb *gb, uint8_t n)
-{
-    uint8_t val = bus_read(gb, gb->cpu.hl.val);
-
-    SET(val, n);
-    bus_write(gb, gb->cpu.hl.val, val);
-}
-
-void jp(struct gb *gb, uint16_t nn, uint8_t offset, bool cond)
+int jp(struct gb *gb, uint16_t nn, uint8_t offset, bool cond)
 {
     if (cond) {
-        gb->executed_cycle += 1;
         gb->cpu.pc = nn + (int8_t)offset;
+        return 1;
     }
+    return 0;
 }
 
-void call(struct gb *gb, uint16_t nn, bool cond)
+int call(struct gb *gb, uint16_t nn, bool cond)
 {
     if (cond) {
         sm83_push_word(gb, gb->cpu.pc);
         gb->cpu.pc = nn;
-        gb->executed_cycle += 3;
+        CALLSTACK_ENTER(gb);
+        return 3;
     }
+    return 0;
 }
 
-void ret(struct gb *gb, uint8_t opcode, bool cond)
+int ret(struct gb *gb, uint8_t opcode, bool cond)
 {
     if (cond) {
         uint16_t pc = sm83_pop_word(gb);
         gb->cpu.pc = pc;
-        gb->executed_cycle += 3;
+        CALLSTACK_LEAVE(gb);
+        return 3;
     }
+    return 0;
 }
 
-void reti(struct gb *gb)
+int reti(struct gb *gb)
 {
-    ret(gb, 0xc9, 1);
+    int extra = ret(gb, 0xc9, 1);
+
     gb->cpu.ime = true;
+    return extra;
 }
 
 void rst_n(struct gb *gb, uint8_t n)
 {
     sm83_push_word(gb, gb->cpu.pc);
     gb->cpu.pc = n;
+    CALLSTACK_ENTER(gb);
 }
 
-void halt(struct gb *gb)
+/* longest single sleep in machine cycles, one frame */
+#define HALT_MAX_IDLE   17556
+
+/*
+ * Returns the extra machine cycles spent halted. Only scheduler events raise
+ * interrupts (the joypad one comes from the frontend between sm83_run()
+ * calls), so nothing can wake the CPU before the next event: rather than
+ * redispatching HALT once per machine cycle, sleep until the cycle that
+ * event falls in and let sm83_cycle() run it.
+ */
+int halt(struct gb *gb)
 {
+    uint64_t idle;
+
+    // waking up to check for interrupts is not another instruction
+    if (gb->mode == HALT)
+        COUNTER_ADD(gb->cpu.instructions, -1);
     gb->mode = HALT;
     if (is_interrupt_pending(gb)) {
         // TODO: halt bug
         gb->mode = (!gb->cpu.ime) ? HALT_BUG : NORMAL;
+        return 0;
     }
+    if (gb->scheduler.next <= gb->scheduler.now + 4) {
+        COUNTER_ADD(gb->stats.halt_cycles, 4);
+        return 0;
+    }
+    idle = (gb->scheduler.next - gb->scheduler.now + 3) / 4;
+    if (idle > HALT_MAX_IDLE)
+        idle = HALT_MAX_IDLE;
+    COUNTER_ADD(gb->stats.halt_cycles, idle * 4);
+    return (int)idle - 1;
 }
 
 void stop(struct gb *gb)
@@ -626,526 +667,739 @@ void ei(struct gb *gb)
     gb->cpu.ime = true;
 }
 
+static inline uint8_t *cb_operand(struct gb *gb, uint8_t index)
+{
+    switch (index) {
+    case 0:  return &gb->cpu.bc.b;
+    case 1:  return &gb->cpu.bc.c;
+    case 2:  return &gb->cpu.de.d;
+    case 3:  return &gb->cpu.de.e;
+    case 4:  return &gb->cpu.hl.h;
+    case 5:  return &gb->cpu.hl.l;
+    default: return &gb->cpu.af.a;
+    }
+}
+
+/* CB-prefixed opcodes are decoded from their fields instead of a 256-case
+   switch: bits 0-2 select the operand (B, C, D, E, H, L, (HL), A), bits 3-5
+   the shift kind or bit number and bits 6-7 the operation. */
 int execute_cb_instructions(struct gb *gb, uint8_t opcode)
 {
-    switch (opcode) {
-    case 0x00: rlc_r(gb, &gb->cpu.bc.b);                              break;
-    case 0x01: rlc_r(gb, &gb->cpu.bc.c);                              break;
-    case 0x02: rlc_r(gb, &gb->cpu.de.d);                              break;
-    case 0x03: rlc_r(gb, &gb->cpu.de.e);                              break;
-    case 0x04: rlc_r(gb, &gb->cpu.hl.h);                              break;
-    case 0x05: rlc_r(gb, &gb->cpu.hl.l);                              break;
-    case 0x06: rlc_indirect_hl(gb);                                     break;
-    case 0x07: rlc_r(gb, &gb->cpu.af.a);                              break;
-    case 0x08: rrc_r(gb, &gb->cpu.bc.b);                              break;
-    case 0x09: rrc_r(gb, &gb->cpu.bc.c);                              break;
-    case 0x0a: rrc_r(gb, &gb->cpu.de.d);                              break;
-    case 0x0b: rrc_r(gb, &gb->cpu.de.e);                              break;
-    case 0x0c: rrc_r(gb, &gb->cpu.hl.h);                              break;
-    case 0x0d: rrc_r(gb, &gb->cpu.hl.l);                              break;
-    case 0x0e: rrc_indirect_hl(gb);                                     break;
-    case 0x0f: rrc_r(gb, &gb->cpu.af.a);                              break;
-    case 0x10: rl_r(gb, &gb->cpu.bc.b);                               break;
-    case 0x11: rl_r(gb, &gb->cpu.bc.c);                               break;
-    case 0x12: rl_r(gb, &gb->cpu.de.d);                               break;
-    case 0x13: rl_r(gb, &gb->cpu.de.e);                               break;
-    case 0x14: rl_r(gb, &gb->cpu.hl.h);                               break;
-    case 0x15: rl_r(gb, &gb->cpu.hl.l);                               break;
-    case 0x16: rl_indirect_hl(gb);                                      break;
-    case 0x17: rl_r(gb, &gb->cpu.af.a);                               break;
-    case 0x18: rr_r(gb, &gb->cpu.bc.b);                               break;
-    case 0x19: rr_r(gb, &gb->cpu.bc.c);                               break;
-    case 0x1a: rr_r(gb, &gb->cpu.de.d);                               break;
-    case 0x1b: rr_r(gb, &gb->cpu.de.e);                               break;
-    case 0x1c: rr_r(gb, &gb->cpu.hl.h);                               break;
-    case 0x1d: rr_r(gb, &gb->cpu.hl.l);                               break;
-    case 0x1e: rr_indirect_hl(gb);                                      break;
-    case 0x1f: rr_r(gb, &gb->cpu.af.a);                               break;
-    case 0x20: sla_r(gb, &gb->cpu.bc.b);                              break;
-    case 0x21: sla_r(gb, &gb->cpu.bc.c);                              break;
-    case 0x22: sla_r(gb, &gb->cpu.de.d);                              break;
-    case 0x23: sla_r(gb, &gb->cpu.de.e);                              break;
-    case 0x24: sla_r(gb, &gb->cpu.hl.h);                              break;
-    case 0x25: sla_r(gb, &gb->cpu.hl.l);                              break;
-    case 0x26: sla_indirect_hl(gb);                                     break;
-    case 0x27: sla_r(gb, &gb->cpu.af.a);                              break;
-    case 0x28: sra_r(gb, &gb->cpu.bc.b);                              break;
-    case 0x29: sra_r(gb, &gb->cpu.bc.c);                              break;
-    case 0x2a: sra_r(gb, &gb->cpu.de.d);                              break;
-    case 0x2b: sra_r(gb, &gb->cpu.de.e);                              break;
-    case 0x2c: sra_r(gb, &gb->cpu.hl.h);                              break;
-    case 0x2d: sra_r(gb, &gb->cpu.hl.l);                              break;
-    case 0x2e: sra_indirect_hl(gb);                                     break;
-    case 0x2f: sra_r(gb, &gb->cpu.af.a);                              break;
-    case 0x30: swap_r(gb, &gb->cpu.bc.b);                             break;
-    case 0x31: swap_r(gb, &gb->cpu.bc.c);                             break;
-    case 0x32: swap_r(gb, &gb->cpu.de.d);                             break;
-    case 0x33: swap_r(gb, &gb->cpu.de.e);                             break;
-    case 0x34: swap_r(gb, &gb->cpu.hl.h);                             break;
-    case 0x35: swap_r(gb, &gb->cpu.hl.l);                             break;
-    case 0x36: swap_indirect_hl(gb);                                    break;
-    case 0x37: swap_r(gb, &gb->cpu.af.a);                             break;
-    case 0x38: srl_r(gb, &gb->cpu.bc.b);                              break;
-    case 0x39: srl_r(gb, &gb->cpu.bc.c);                              break;
-    case 0x3a: srl_r(gb, &gb->cpu.de.d);                              break;
-    case 0x3b: srl_r(gb, &gb->cpu.de.e);                              break;
-    case 0x3c: srl_r(gb, &gb->cpu.hl.h);                              break;
-    case 0x3d: srl_r(gb, &gb->cpu.hl.l);                              break;
-    case 0x3e: srl_indirect_hl(gb);                                     break;
-    case 0x3f: srl_r(gb, &gb->cpu.af.a);                              break;
-    case 0x40: bit_n_r(gb, 0, &gb->cpu.bc.b);                         break;
-    case 0x41: bit_n_r(gb, 0, &gb->cpu.bc.c);                         break;
-    case 0x42: bit_n_r(gb, 0, &gb->cpu.de.d);                         break;
-    case 0x43: bit_n_r(gb, 0, &gb->cpu.de.e);                         break;
-    case 0x44: bit_n_r(gb, 0, &gb->cpu.hl.h);                         break;
-    case 0x45: bit_n_r(gb, 0, &gb->cpu.hl.l);                         break;
-    case 0x46: bit_n_indirect_hl(gb, 0);                                break;
-    case 0x47: bit_n_r(gb, 0, &gb->cpu.af.a);                         break;
-    case 0x48: bit_n_r(gb, 1, &gb->cpu.bc.b);                         break;
-    case 0x49: bit_n_r(gb, 1, &gb->cpu.bc.c);                         break;
-    case 0x4a: bit_n_r(gb, 1, &gb->cpu.de.d);                         break;
-    case 0x4b: bit_n_r(gb, 1, &gb->cpu.de.e);                         break;
-    case 0x4c: bit_n_r(gb, 1, &gb->cpu.hl.h);                         break;
-    case 0x4d: bit_n_r(gb, 1, &gb->cpu.hl.l);                         break;
-    case 0x4e: bit_n_indirect_hl(gb, 1);                                break;
-    case 0x4f: bit_n_r(gb, 1, &gb->cpu.af.a);                         break;
-    case 0x50: bit_n_r(gb, 2, &gb->cpu.bc.b);                         break;
-    case 0x51: bit_n_r(gb, 2, &gb->cpu.bc.c);                         break;
-    case 0x52: bit_n_r(gb, 2, &gb->cpu.de.d);                         break;
-    case 0x53: bit_n_r(gb, 2, &gb->cpu.de.e);                         break;
-    case 0x54: bit_n_r(gb, 2, &gb->cpu.hl.h);                         break;
-    case 0x55: bit_n_r(gb, 2, &gb->cpu.hl.l);                         break;
-    case 0x56: bit_n_indirect_hl(gb, 2);                                break;
-    case 0x57: bit_n_r(gb, 2, &gb->cpu.af.a);                         break;
-    case 0x58: bit_n_r(gb, 3, &gb->cpu.bc.b);                         break;
-    case 0x59: bit_n_r(gb, 3, &gb->cpu.bc.c);                         break;
-    case 0x5a: bit_n_r(gb, 3, &gb->cpu.de.d);                         break;
-    case 0x5b: bit_n_r(gb, 3, &gb->cpu.de.e);                         break;
-    case 0x5c: bit_n_r(gb, 3, &gb->cpu.hl.h);                         break;
-    case 0x5d: bit_n_r(gb, 3, &gb->cpu.hl.l);                         break;
-    case 0x5e: bit_n_indirect_hl(gb, 3);                                break;
-    case 0x5f: bit_n_r(gb, 3, &gb->cpu.af.a);                         break;
-    case 0x60: bit_n_r(gb, 4, &gb->cpu.bc.b);                         break;
-    case 0x61: bit_n_r(gb, 4, &gb->cpu.bc.c);                         break;
-    case 0x62: bit_n_r(gb, 4, &gb->cpu.de.d);                         break;
-    case 0x63: bit_n_r(gb, 4, &gb->cpu.de.e);                         break;
-    case 0x64: bit_n_r(gb, 4, &gb->cpu.hl.h);                         break;
-    case 0x65: bit_n_r(gb, 4, &gb->cpu.hl.l);                         break;
-    case 0x66: bit_n_indirect_hl(gb, 4);                                break;
-    case 0x67: bit_n_r(gb, 4, &gb->cpu.af.a);                         break;
-    case 0x68: bit_n_r(gb, 5, &gb->cpu.bc.b);                         break;
-    case 0x69: bit_n_r(gb, 5, &gb->cpu.bc.c);                         break;
-    case 0x6a: bit_n_r(gb, 5, &gb->cpu.de.d);                         break;
-    case 0x6b: bit_n_r(gb, 5, &gb->cpu.de.e);                         break;
-    case 0x6c: bit_n_r(gb, 5, &gb->cpu.hl.h);                         break;
-    case 0x6d: bit_n_r(gb, 5, &gb->cpu.hl.l);                         break;
-    case 0x6e: bit_n_indirect_hl(gb, 5);                                break;
-    case 0x6f: bit_n_r(gb, 5, &gb->cpu.af.a);                         break;
-    case 0x70: bit_n_r(gb, 6, &gb->cpu.bc.b);                         break;
-    case 0x71: bit_n_r(gb, 6, &gb->cpu.bc.c);                         break;
-    case 0x72: bit_n_r(gb, 6, &gb->cpu.de.d);                         break;
-    case 0x73: bit_n_r(gb, 6, &gb->cpu.de.e);                         break;
-    case 0x74: bit_n_r(gb, 6, &gb->cpu.hl.h);                         break;
-    case 0x75: bit_n_r(gb, 6, &gb->cpu.hl.l);                         break;
-    case 0x76: bit_n_indirect_hl(gb, 6);                                break;
-    case 0x77: bit_n_r(gb, 6, &gb->cpu.af.a);                         break;
-    case 0x78: bit_n_r(gb, 7, &gb->cpu.bc.b);                         break;
-    case 0x79: bit_n_r(gb, 7, &gb->cpu.bc.c);                         break;
-    case 0x7a: bit_n_r(gb, 7, &gb->cpu.de.d);                         break;
-    case 0x7b: bit_n_r(gb, 7, &gb->cpu.de.e);                         break;
-    case 0x7c: bit_n_r(gb, 7, &gb->cpu.hl.h);                         break;
-    case 0x7d: bit_n_r(gb, 7, &gb->cpu.hl.l);                         break;
-    case 0x7e: bit_n_indirect_hl(gb, 7);                                break;
-    case 0x7f: bit_n_r(gb, 7, &gb->cpu.af.a);                         break;
-    case 0x80: res_n_r(gb, 0, &gb->cpu.bc.b);                         break;
-    case 0x81: res_n_r(gb, 0, &gb->cpu.bc.c);                         break;
-    case 0x82: res_n_r(gb, 0, &gb->cpu.de.d);                         break;
-    case 0x83: res_n_r(gb, 0, &gb->cpu.de.e);                         break;
-    case 0x84: res_n_r(gb, 0, &gb->cpu.hl.h);                         break;
-    case 0x85: res_n_r(gb, 0, &gb->cpu.hl.l);                         break;
-    case 0x86: res_n_indirect_hl(gb, 0);                                break;
-    case 0x87: res_n_r(gb, 0, &gb->cpu.af.a);                         break;
-    case 0x88: res_n_r(gb, 1, &gb->cpu.bc.b);                         break;
-    case 0x89: res_n_r(gb, 1, &gb->cpu.bc.c);                         break;
-    case 0x8a: res_n_r(gb, 1, &gb->cpu.de.d);                         break;
-    case 0x8b: res_n_r(gb, 1, &gb->cpu.de.e);                         break;
-    case 0x8c: res_n_r(gb, 1, &gb->cpu.hl.h);                         break;
-    case 0x8d: res_n_r(gb, 1, &gb->cpu.hl.l);                         break;
-    case 0x8e: res_n_indirect_hl(gb, 1);                                break;
-    case 0x8f: res_n_r(gb, 1, &gb->cpu.af.a);                         break;
-    case 0x90: res_n_r(gb, 2, &gb->cpu.bc.b);                         break;
-    case 0x91: res_n_r(gb, 2, &gb->cpu.bc.c);                         break;
-    case 0x92: res_n_r(gb, 2, &gb->cpu.de.d);                         break;
-    case 0x93: res_n_r(gb, 2, &gb->cpu.de.e);                         break;
-    case 0x94: res_n_r(gb, 2, &gb->cpu.hl.h);                         break;
-    case 0x95: res_n_r(gb, 2, &gb->cpu.hl.l);                         break;
-    case 0x96: res_n_indirect_hl(gb, 2);                                break;
-    case 0x97: res_n_r(gb, 2, &gb->cpu.af.a);                         break;
-    case 0x98: res_n_r(gb, 3, &gb->cpu.bc.b);                         break;
-    case 0x99: res_n_r(gb, 3, &gb->cpu.bc.c);                         break;
-    case 0x9a: res_n_r(gb, 3, &gb->cpu.de.d);                         break;
-    case 0x9b: res_n_r(gb, 3, &gb->cpu.de.e);                         break;
-    case 0x9c: res_n_r(gb, 3, &gb->cpu.hl.h);                         break;
-    case 0x9d: res_n_r(gb, 3, &gb->cpu.hl.l);                         break;
-    case 0x9e: res_n_indirect_hl(gb, 3);                                break;
-    case 0x9f: res_n_r(gb, 3, &gb->cpu.af.a);                         break;
-    case 0xa0: res_n_r(gb, 4, &gb->cpu.bc.b);                         break;
-    case 0xa1: res_n_r(gb, 4, &gb->cpu.bc.c);                         break;
-    case 0xa2: res_n_r(gb, 4, &gb->cpu.de.d);                         break;
-    case 0xa3: res_n_r(gb, 4, &gb->cpu.de.e);                         break;
-    case 0xa4: res_n_r(gb, 4, &gb->cpu.hl.h);                         break;
-    case 0xa5: res_n_r(gb, 4, &gb->cpu.hl.l);                         break;
-    case 0xa6: res_n_indirect_hl(gb, 4);                                break;
-    case 0xa7: res_n_r(gb, 4, &gb->cpu.af.a);                         break;
-    case 0xa8: res_n_r(gb, 5, &gb->cpu.bc.b);                         break;
-    case 0xa9: res_n_r(gb, 5, &gb->cpu.bc.c);                         break;
-    case 0xaa: res_n_r(gb, 5, &gb->cpu.de.d);                         break;
-    case 0xab: res_n_r(gb, 5, &gb->cpu.de.e);                         break;
-    case 0xac: res_n_r(gb, 5, &gb->cpu.hl.h);                         break;
-    case 0xad: res_n_r(gb, 5, &gb->cpu.hl.l);                         break;
-    case 0xae: res_n_indirect_hl(gb, 5);                                break;
-    case 0xaf: res_n_r(gb, 5, &gb->cpu.af.a);                         break;
-    case 0xb0: res_n_r(gb, 6, &gb->cpu.bc.b);                         break;
-    case 0xb1: res_n_r(gb, 6, &gb->cpu.bc.c);                         break;
-    case 0xb2: res_n_r(gb, 6, &gb->cpu.de.d);                         break;
-    case 0xb3: res_n_r(gb, 6, &gb->cpu.de.e);                         break;
-    case 0xb4: res_n_r(gb, 6, &gb->cpu.hl.h);                         break;
-    case 0xb5: res_n_r(gb, 6, &gb->cpu.hl.l);                         break;
-    case 0xb6: res_n_indirect_hl(gb, 6);                                break;
-    case 0xb7: res_n_r(gb, 6, &gb->cpu.af.a);                         break;
-    case 0xb8: res_n_r(gb, 7, &gb->cpu.bc.b);                         break;
-    case 0xb9: res_n_r(gb, 7, &gb->cpu.bc.c);                         break;
-    case 0xba: res_n_r(gb, 7, &gb->cpu.de.d);                         break;
-    case 0xbb: res_n_r(gb, 7, &gb->cpu.de.e);                         break;
-    case 0xbc: res_n_r(gb, 7, &gb->cpu.hl.h);                         break;
-    case 0xbd: res_n_r(gb, 7, &gb->cpu.hl.l);                         break;
-    case 0xbe: res_n_indirect_hl(gb, 7);                                break;
-    case 0xbf: res_n_r(gb, 7, &gb->cpu.af.a);                         break;
-    case 0xc0: set_n_r(gb, 0, &gb->cpu.bc.b);                         break;
-    case 0xc1: set_n_r(gb, 0, &gb->cpu.bc.c);                         break;
-    case 0xc2: set_n_r(gb, 0, &gb->cpu.de.d);                         break;
-    case 0xc3: set_n_r(gb, 0, &gb->cpu.de.e);                         break;
-    case 0xc4: set_n_r(gb, 0, &gb->cpu.hl.h);                         break;
-    case 0xc5: set_n_r(gb, 0, &gb->cpu.hl.l);                         break;
-    case 0xc6: set_n_indirect_hl(gb, 0);                                break;
-    case 0xc7: set_n_r(gb, 0, &gb->cpu.af.a);                         break;
-    case 0xc8: set_n_r(gb, 1, &gb->cpu.bc.b);                         break;
-    case 0xc9: set_n_r(gb, 1, &gb->cpu.bc.c);                         break;
-    case 0xca: set_n_r(gb, 1, &gb->cpu.de.d);                         break;
-    case 0xcb: set_n_r(gb, 1, &gb->cpu.de.e);                         break;
-    case 0xcc: set_n_r(gb, 1, &gb->cpu.hl.h);                         break;
-    case 0xcd: set_n_r(gb, 1, &gb->cpu.hl.l);                         break;
-    case 0xce: set_n_indirect_hl(gb, 1);                                break;
-    case 0xcf: set_n_r(gb, 1, &gb->cpu.af.a);                         break;
-    case 0xd0: set_n_r(gb, 2, &gb->cpu.bc.b);                         break;
-    case 0xd1: set_n_r(gb, 2, &gb->cpu.bc.c);                         break;
-    case 0xd2: set_n_r(gb, 2, &gb->cpu.de.d);                         break;
-    case 0xd3: set_n_r(gb, 2, &gb->cpu.de.e);                         break;
-    case 0xd4: set_n_r(gb, 2, &gb->cpu.hl.h);                         break;
-    case 0xd5: set_n_r(gb, 2, &gb->cpu.hl.l);                         break;
-    case 0xd6: set_n_indirect_hl(gb, 2);                                break;
-    case 0xd7: set_n_r(gb, 2, &gb->cpu.af.a);                         break;
-    case 0xd8: set_n_r(gb, 3, &gb->cpu.bc.b);                         break;
-    case 0xd9: set_n_r(gb, 3, &gb->cpu.bc.c);                         break;
-    case 0xda: set_n_r(gb, 3, &gb->cpu.de.d);                         break;
-    case 0xdb: set_n_r(gb, 3, &gb->cpu.de.e);                         break;
-    case 0xdc: set_n_r(gb, 3, &gb->cpu.hl.h);                         break;
-    case 0xdd: set_n_r(gb, 3, &gb->cpu.hl.l);                         break;
-    case 0xde: set_n_indirect_hl(gb, 3);                                break;
-    case 0xdf: set_n_r(gb, 3, &gb->cpu.af.a);                         break;
-    case 0xe0: set_n_r(gb, 4, &gb->cpu.bc.b);                         break;
-    case 0xe1: set_n_r(gb, 4, &gb->cpu.bc.c);                         break;
-    case 0xe2: set_n_r(gb, 4, &gb->cpu.de.d);                         break;
-    case 0xe3: set_n_r(gb, 4, &gb->cpu.de.e);                         break;
-    case 0xe4: set_n_r(gb, 4, &gb->cpu.hl.h);                         break;
-    case 0xe5: set_n_r(gb, 4, &gb->cpu.hl.l);                         break;
-    case 0xe6: set_n_indirect_hl(gb, 4);                                break;
-    case 0xe7: set_n_r(gb, 4, &gb->cpu.af.a);                         break;
-    case 0xe8: set_n_r(gb, 5, &gb->cpu.bc.b);                         break;
-    case 0xe9: set_n_r(gb, 5, &gb->cpu.bc.c);                         break;
-    case 0xea: set_n_r(gb, 5, &gb->cpu.de.d);                         break;
-    case 0xeb: set_n_r(gb, 5, &gb->cpu.de.e);                         break;
-    case 0xec: set_n_r(gb, 5, &gb->cpu.hl.h);                         break;
-    case 0xed: set_n_r(gb, 5, &gb->cpu.hl.l);                         break;
-    case 0xee: set_n_indirect_hl(gb, 5);                                break;
-    case 0xef: set_n_r(gb, 5, &gb->cpu.af.a);                         break;
-    case 0xf0: set_n_r(gb, 6, &gb->cpu.bc.b);                         break;
-    case 0xf1: set_n_r(gb, 6, &gb->cpu.bc.c);                         break;
-    case 0xf2: set_n_r(gb, 6, &gb->cpu.de.d);                         break;
-    case 0xf3: set_n_r(gb, 6, &gb->cpu.de.e);                         break;
-    case 0xf4: set_n_r(gb, 6, &gb->cpu.hl.h);                         break;
-    case 0xf5: set_n_r(gb, 6, &gb->cpu.hl.l);                         break;
-    case 0xf6: set_n_indirect_hl(gb, 6);                                break;
-    case 0xf7: set_n_r(gb, 6, &gb->cpu.af.a);                         break;
-    case 0xf8: set_n_r(gb, 7, &gb->cpu.bc.b);                         break;
-    case 0xf9: set_n_r(gb, 7, &gb->cpu.bc.c);                         break;
-    case 0xfa: set_n_r(gb, 7, &gb->cpu.de.d);                         break;
-    case 0xfb: set_n_r(gb, 7, &gb->cpu.de.e);                         break;
-    case 0xfc: set_n_r(gb, 7, &gb->cpu.hl.h);                         break;
-    case 0xfd: set_n_r(gb, 7, &gb->cpu.hl.l);                         break;
-    case 0xfe: set_n_indirect_hl(gb, 7);                                break;
-    case 0xff: set_n_r(gb, 7, &gb->cpu.af.a);                         break;
-    default:
+    uint8_t index = opcode & 0x07, n = (opcode >> 3) & 0x07;
+    uint8_t val = (index == 6) ? bus_read(gb, gb->cpu.hl.val) : *cb_operand(gb, index);
+
+    flags_sync(gb);
+    switch (opcode >> 6) {
+    case 0:
+        switch (n) {
+        case 0: rlc_r(gb, &val);    break;
+        case 1: rrc_r(gb, &val);    break;
+        case 2: rl_r(gb, &val);     break;
+        case 3: rr_r(gb, &val);     break;
+        case 4: sla_r(gb, &val);    break;
+        case 5: sra_r(gb, &val);    break;
+        case 6: swap_r(gb, &val);   break;
+        case 7: srl_r(gb, &val);    break;
+        }
+        break;
+    case 1:
+        bit_n_r(gb, n, &val);
+        return cb_instr_cycle[opcode];
+    case 2:
+        res_n_r(gb, n, &val);
+        break;
+    case 3:
+        set_n_r(gb, n, &val);
         break;
     }
+    if (index == 6)
+        bus_write(gb, gb->cpu.hl.val, val);
+    else
+        *cb_operand(gb, index) = val;
     return cb_instr_cycle[opcode];
 }
 
-int sm83_step(struct gb *gb)
+static inline bool sm83_should_stop(struct gb *gb)
+{
+    return gb->ppu.frame_ready || gb->apu.sample_buffer.is_full;
+}
+
+#ifdef SM83_PROFILE
+/*
+ * Opt-in profiling (GBDA_PROFILE): every instruction retired by the
+ * interpreter is counted, with the T-cycles it took, by opcode, by ROM bank
+ * and by PC. ROM code is counted by offset in the ROM image, like block keys,
+ * so the same PC in two banks is kept apart. The counters are allocated on
+ * first use and reported when the instance is destroyed.
+ */
+#define PROFILE_REPORT_PCS  32
+
+static const char *const mnemonics[0x100] = {
+    "nop", "ld bc,nn", "ld (bc),a", "inc bc", "inc b", "dec b", "ld b,n", "rlca",
+    "ld (nn),sp", "add hl,bc", "ld a,(bc)", "dec bc", "inc c", "dec c", "ld c,n", "rrca",
+    "stop", "ld de,nn", "ld (de),a", "inc de", "inc d", "dec d", "ld d,n", "rla",
+    "jr e", "add hl,de", "ld a,(de)", "dec de", "inc e", "dec e", "ld e,n", "rra",
+    "jr nz,e", "ld hl,nn", "ld (hl+),a", "inc hl", "inc h", "dec h", "ld h,n", "daa",
+    "jr z,e", "add hl,hl", "ld a,(hl+)", "dec hl", "inc l", "dec l", "ld l,n", "cpl",
+    "jr nc,e", "ld sp,nn", "ld (hl-),a", "inc sp", "inc (hl)", "dec (hl)", "ld (hl),n", "scf",
+    "jr c,e", "add hl,sp", "ld a,(hl-)", "dec sp", "inc a", "dec a", "ld a,n", "ccf",
+    "ld b,b", "ld b,c", "ld b,d", "ld b,e", "ld b,h", "ld b,l", "ld b,(hl)", "ld b,a",
+    "ld c,b", "ld c,c", "ld c,d", "ld c,e", "ld c,h", "ld c,l", "ld c,(hl)", "ld c,a",
+    "ld d,b", "ld d,c", "ld d,d", "ld d,e", "ld d,h", "ld d,l", "ld d,(hl)", "ld d,a",
+    "ld e,b", "ld e,c", "ld e,d", "ld e,e", "ld e,h", "ld e,l", "ld e,(hl)", "ld e,a",
+    "ld h,b", "ld h,c", "ld h,d", "ld h,e", "ld h,h", "ld h,l", "ld h,(hl)", "ld h,a",
+    "ld l,b", "ld l,c", "ld l,d", "ld l,e", "ld l,h", "ld l,l", "ld l,(hl)", "ld l,a",
+    "ld (hl),b", "ld (hl),c", "ld (hl),d", "ld (hl),e", "ld (hl),h", "ld (hl),l", "halt", "ld (hl),a",
+    "ld a,b", "ld a,c", "ld a,d", "ld a,e", "ld a,h", "ld a,l", "ld a,(hl)", "ld a,a",
+    "add a,b", "add a,c", "add a,d", "add a,e", "add a,h", "add a,l", "add a,(hl)", "add a,a",
+    "adc a,b", "adc a,c", "adc a,d", "adc a,e", "adc a,h", "adc a,l", "adc a,(hl)", "adc a,a",
+    "sub b", "sub c", "sub d", "sub e", "sub h", "sub l", "sub (hl)", "sub a",
+    "sbc a,b", "sbc a,c", "sbc a,d", "sbc a,e", "sbc a,h", "sbc a,l", "sbc a,(hl)", "sbc a,a",
+    "and b", "and c", "and d", "and e", "and h", "and l", "and (hl)", "and a",
+    "xor b", "xor c", "xor d", "xor e", "xor h", "xor l", "xor (hl)", "xor a",
+    "or b", "or c", "or d", "or e", "or h", "or l", "or (hl)", "or a",
+    "cp b", "cp c", "cp d", "cp e", "cp h", "cp l", "cp (hl)", "cp a",
+    "ret nz", "pop bc", "jp nz,nn", "jp nn", "call nz,nn", "push bc", "add a,n", "rst $00",
+    "ret z", "ret", "jp z,nn", "prefix cb", "call z,nn", "call nn", "adc a,n", "rst $08",
+    "ret nc", "pop de", "jp nc,nn", "-", "call nc,nn", "push de", "sub n", "rst $10",
+    "ret c", "reti", "jp c,nn", "-", "call c,nn", "-", "sbc a,n", "rst $18",
+    "ldh (n),a", "pop hl", "ld (c),a", "-", "-", "push hl", "and n", "rst $20",
+    "add sp,e", "jp hl", "ld (nn),a", "-", "-", "-", "xor n", "rst $28",
+    "ldh a,(n)", "pop af", "ld a,(c)", "di", "-", "push af", "or n", "rst $30",
+    "ld hl,sp+e", "ld sp,hl", "ld a,(nn)", "ei", "-", "-", "cp n", "rst $38",
+};
+
+static void profile_mnemonic(int op, char *buf, size_t size)
 {
-    uint8_t opcode = sm83_fetch_byte(gb);
-    gb->executed_cycle = instr_cycle[opcode];
-
-    switch (opcode) {
-    case 0x00:                                                          break;
-    case 0x01: gb->cpu.bc.val = sm83_fetch_word(gb);                   break;
-    case 0x02: bus_write(gb, gb->cpu.bc.val, gb->cpu.af.a);          break;
-    case 0x03: inc_rr(gb, &gb->cpu.bc.val);                            break;
-    case 0x04: inc_r(gb, &gb->cpu.bc.b);                              break;
-    case 0x05: dec_r(gb, &gb->cpu.bc.b);                              break;
-    case 0x06: gb->cpu.bc.b = sm83_fetch_byte(gb);                    break;
-    case 0x07: rlca(gb);                                                break;
-    case 0x08: ld_indirect_nn_sp(gb, sm83_fetch_word(gb));              break;
-    case 0x09: add_hl_rr(gb, gb->cpu.bc.val);                          break;
-    case 0x0a: gb->cpu.af.a = bus_read(gb, gb->cpu.bc.val);          break;
-    case 0x0b: dec_rr(gb, &gb->cpu.bc.val);                            break;
-    case 0x0c: inc_r(gb, &gb->cpu.bc.c);                              break;
-    case 0x0d: dec_r(gb, &gb->cpu.bc.c);                              break;
-    case 0x0e: gb->cpu.bc.c = sm83_fetch_byte(gb);                    break;
-    case 0x0f: rrca(gb);                                                break;
-    case 0x10: stop(gb);                                                break;
-    case 0x11: gb->cpu.de.val = sm83_fetch_word(gb);                   break;
-    case 0x12: bus_write(gb, gb->cpu.de.val, gb->cpu.af.a);          break;
-    case 0x13: inc_rr(gb, &gb->cpu.de.val);                            break;
-    case 0x14: inc_r(gb, &gb->cpu.de.d);                              break;
-    case 0x15: dec_r(gb, &gb->cpu.de.d);                              break;
-    case 0x16: gb->cpu.de.d = sm83_fetch_byte(gb);                    break;
-    case 0x17: rla(gb);                                                 break;
-    case 0x18: jp(gb, gb->cpu.pc, sm83_fetch_byte(gb), 1);         break;
-    case 0x19: add_hl_rr(gb, gb->cpu.de.val);                          break;
-    case 0x1a: gb->cpu.af.a = bus_read(gb, gb->cpu.de.val);          break;
-    case 0x1b: dec_rr(gb, &gb->cpu.de.val);                            break;
-    case 0x1c: inc_r(gb, &gb->cpu.de.e);                              break;
-    case 0x1d: dec_r(gb, &gb->cpu.de.e);                              break;
-    case 0x1e: gb->cpu.de.e = sm83_fetch_byte(gb);                    break;
-    case 0x1f: rra(gb);                                                 break;
-    case 0x20: jp(gb, gb->cpu.pc, sm83_fetch_byte(gb), !gb->cpu.af.flag.z);  break;
-    case 0x21: gb->cpu.hl.val = sm83_fetch_word(gb);                   break;
-    case 0x22: bus_write(gb, gb->cpu.hl.val++, gb->cpu.af.a);        break;
-    case 0x23: inc_rr(gb, &gb->cpu.hl.val);                            break;
-    case 0x24: inc_r(gb, &gb->cpu.hl.h);                              break;
-    case 0x25: dec_r(gb, &gb->cpu.hl.h);                              break;
-    case 0x26: gb->cpu.hl.h = sm83_fetch_byte(gb);                    break;
-    case 0x27: daa(gb);                                                 break;
-    case 0x28: jp(gb, gb->cpu.pc, sm83_fetch_byte(gb), gb->cpu.af.flag.z);  break;
-    case 0x29: add_hl_rr(gb, gb->cpu.hl.val);                          break;
-    case 0x2a: gb->cpu.af.a = bus_read(gb, gb->cpu.hl.val++);        break;
-    case 0x2b: dec_rr(gb, &gb->cpu.hl.val);                            break;
-    case 0x2c: inc_r(gb, &gb->cpu.hl.l);                              break;
-    case 0x2d: dec_r(gb, &gb->cpu.hl.l);                              break;
-    case 0x2e: gb->cpu.hl.l = sm83_fetch_byte(gb);                    break;
-    case 0x2f: cpl(gb);                                                 break;
-    case 0x30: jp(gb, gb->cpu.pc, sm83_fetch_byte(gb), !gb->cpu.af.flag.c);  break;
-    case 0x31: gb->cpu.sp = sm83_fetch_word(gb);                   break;
-    case 0x32: bus_write(gb, gb->cpu.hl.val--, gb->cpu.af.a);        break;
-    case 0x33: inc_rr(gb, &gb->cpu.sp);                            break;
-    case 0x34: inc_indirect_hl(gb);                                     break;
-    case 0x35: dec_indirect_hl(gb);                                     break;
-    case 0x36: ld_indirect_hl_n(gb, sm83_fetch_byte(gb));               break;
-    case 0x37: scf(gb);                                                 break;
-    case 0x38: jp(gb, gb->cpu.pc, sm83_fetch_byte(gb), gb->cpu.af.flag.c);  break;
-    case 0x39: add_hl_rr(gb, gb->cpu.sp);                          break;
-    case 0x3a: gb->cpu.af.a = bus_read(gb, gb->cpu.hl.val--);        break;
-    case 0x3b: dec_rr(gb, &gb->cpu.sp);                            break;
-    case 0x3c: inc_r(gb, &gb->cpu.af.a);                              break;
-    case 0x3d: dec_r(gb, &gb->cpu.af.a);                              break;
-    case 0x3e: gb->cpu.af.a = sm83_fetch_byte(gb);                    break;
-    case 0x3f: ccf(gb);                                                 break;
-    case 0x40: gb->cpu.bc.b = gb->cpu.bc.b;                         break;
-    case 0x41: gb->cpu.bc.b = gb->cpu.bc.c;                         break;
-    case 0x42: gb->cpu.bc.b = gb->cpu.de.d;                         break;
-    case 0x43: gb->cpu.bc.b = gb->cpu.de.e;                         break;
-    case 0x44: gb->cpu.bc.b = gb->cpu.hl.h;                         break;
-    case 0x45: gb->cpu.bc.b = gb->cpu.hl.l;                         break;
-    case 0x46: gb->cpu.bc.b = bus_read(gb, gb->cpu.hl.val);          break;
-    case 0x47: gb->cpu.bc.b = gb->cpu.af.a;                         break;
-    case 0x48: gb->cpu.bc.c = gb->cpu.bc.b;                         break;
-    case 0x49: gb->cpu.bc.c = gb->cpu.bc.c;                         break;
-    case 0x4a: gb->cpu.bc.c = gb->cpu.de.d;                         break;
-    case 0x4b: gb->cpu.bc.c = gb->cpu.de.e;                         break;
-    case 0x4c: gb->cpu.bc.c = gb->cpu.hl.h;                         break;
-    case 0x4d: gb->cpu.bc.c = gb->cpu.hl.l;                         break;
-    case 0x4e: gb->cpu.bc.c = bus_read(gb, gb->cpu.hl.val);          break;
-    case 0x4f: gb->cpu.bc.c = gb->cpu.af.a;                         break;
-    case 0x50: gb->cpu.de.d = gb->cpu.bc.b;                         break;
-    case 0x51: gb->cpu.de.d = gb->cpu.bc.c;                         break;
-    case 0x52: gb->cpu.de.d = gb->cpu.de.d;                         break;
-    case 0x53: gb->cpu.de.d = gb->cpu.de.e;                         break;
-    case 0x54: gb->cpu.de.d = gb->cpu.hl.h;                         break;
-    case 0x55: gb->cpu.de.d = gb->cpu.hl.l;                         break;
-    case 0x56: gb->cpu.de.d = bus_read(gb, gb->cpu.hl.val);          break;
-    case 0x57: gb->cpu.de.d = gb->cpu.af.a;                         break;
-    case 0x58: gb->cpu.de.e = gb->cpu.bc.b;                         break;
-    case 0x59: gb->cpu.de.e = gb->cpu.bc.c;                         break;
-    case 0x5a: gb->cpu.de.e = gb->cpu.de.d;                         break;
-    case 0x5b: gb->cpu.de.e = gb->cpu.de.e;                         break;
-    case 0x5c: gb->cpu.de.e = gb->cpu.hl.h;                         break;
-    case 0x5d: gb->cpu.de.e = gb->cpu.hl.l;                         break;
-    case 0x5e: gb->cpu.de.e = bus_read(gb, gb->cpu.hl.val);          break;
-    case 0x5f: gb->cpu.de.e = gb->cpu.af.a;                         break;
-    case 0x60: gb->cpu.hl.h = gb->cpu.bc.b;                         break;
-    case 0x61: gb->cpu.hl.h = gb->cpu.bc.c;                         break;
-    case 0x62: gb->cpu.hl.h = gb->cpu.de.d;                         break;
-    case 0x63: gb->cpu.hl.h = gb->cpu.de.e;                         break;
-    case 0x64: gb->cpu.hl.h = gb->cpu.hl.h;                         break;
-    case 0x65: gb->cpu.hl.h = gb->cpu.hl.l;                         break;
-    case 0x66: gb->cpu.hl.h = bus_read(gb, gb->cpu.hl.val);          break;
-    case 0x67: gb->cpu.hl.h = gb->cpu.af.a;                         break;
-    case 0x68: gb->cpu.hl.l = gb->cpu.bc.b;                         break;
-    case 0x69: gb->cpu.hl.l = gb->cpu.bc.c;                         break;
-    case 0x6a: gb->cpu.hl.l = gb->cpu.de.d;                         break;
-    case 0x6b: gb->cpu.hl.l = gb->cpu.de.e;                         break;
-    case 0x6c: gb->cpu.hl.l = gb->cpu.hl.h;                         break;
-    case 0x6d: gb->cpu.hl.l = gb->cpu.hl.l;                         break;
-    case 0x6e: gb->cpu.hl.l = bus_read(gb, gb->cpu.hl.val);          break;
-    case 0x6f: gb->cpu.hl.l = gb->cpu.af.a;                         break;
-    case 0x70: bus_write(gb, gb->cpu.hl.val, gb->cpu.bc.b);          break;
-    case 0x71: bus_write(gb, gb->cpu.hl.val, gb->cpu.bc.c);          break;
-    case 0x72: bus_write(gb, gb->cpu.hl.val, gb->cpu.de.d);          break;
-    case 0x73: bus_write(gb, gb->cpu.hl.val, gb->cpu.de.e);          break;
-    case 0x74: bus_write(gb, gb->cpu.hl.val, gb->cpu.hl.h);          break;
-    case 0x75: bus_write(gb, gb->cpu.hl.val, gb->cpu.hl.l);          break;
-    case 0x76: halt(gb);                                                break;
-    case 0x77: bus_write(gb, gb->cpu.hl.val, gb->cpu.af.a);          break;
-    case 0x78: gb->cpu.af.a = gb->cpu.bc.b;                         break;
-    case 0x79: gb->cpu.af.a = gb->cpu.bc.c;                         break;
-    case 0x7a: gb->cpu.af.a = gb->cpu.de.d;                         break;
-    case 0x7b: gb->cpu.af.a = gb->cpu.de.e;                         break;
-    case 0x7c: gb->cpu.af.a = gb->cpu.hl.h;                         break;
-    case 0x7d: gb->cpu.af.a = gb->cpu.hl.l;                         break;
-    case 0x7e: gb->cpu.af.a = bus_read(gb, gb->cpu.hl.val);          break;
-    case 0x7f: gb->cpu.af.a = gb->cpu.af.a;                         break;
-    case 0x80: add(gb, gb->cpu.bc.b, 0);                              break;
-    case 0x81: add(gb, gb->cpu.bc.c, 0);                              break;
-    case 0x82: add(gb, gb->cpu.de.d, 0);                              break;
-    case 0x83: add(gb, gb->cpu.de.e, 0);                              break;
-    case 0x84: add(gb, gb->cpu.hl.h, 0);                              break;
-    case 0x85: add(gb, gb->cpu.hl.l, 0);                              break;
-    case 0x86: add(gb, bus_read(gb, gb->cpu.hl.val), 0);               break;
-    case 0x87: add(gb, gb->cpu.af.a, 0);                              break;
-    case 0x88: add(gb, gb->cpu.bc.b, gb->cpu.af.flag.c);            break;
-    case 0x89: add(gb, gb->cpu.bc.c, gb->cpu.af.flag.c);            break;
-    case 0x8a: add(gb, gb->cpu.de.d, gb->cpu.af.flag.c);            break;
-    case 0x8b: add(gb, gb->cpu.de.e, gb->cpu.af.flag.c);            break;
-    case 0x8c: add(gb, gb->cpu.hl.h, gb->cpu.af.flag.c);            break;
-    case 0x8d: add(gb, gb->cpu.hl.l, gb->cpu.af.flag.c);            break;
-    case 0x8e: add(gb, bus_read(gb, gb->cpu.hl.val), gb->cpu.af.flag.c); break;
-    case 0x8f: add(gb, gb->cpu.af.a, gb->cpu.af.flag.c);            break;
-    case 0x90: sub(gb, gb->cpu.bc.b, 0);                              break;
-    case 0x91: sub(gb, gb->cpu.bc.c, 0);                              break;
-    case 0x92: sub(gb, gb->cpu.de.d, 0);                              break;
-    case 0x93: sub(gb, gb->cpu.de.e, 0);                              break;
-    case 0x94: sub(gb, gb->cpu.hl.h, 0);                              break;
-    case 0x95: sub(gb, gb->cpu.hl.l, 0);                              break;
-    case 0x96: sub(gb, bus_read(gb, gb->cpu.hl.val), 0);               break;
-    case 0x97: sub(gb, gb->cpu.af.a, 0);                              break;
-    case 0x98: sub(gb, gb->cpu.bc.b, gb->cpu.af.flag.c);            break;
-    case 0x99: sub(gb, gb->cpu.bc.c, gb->cpu.af.flag.c);            break;
-    case 0x9a: sub(gb, gb->cpu.de.d, gb->cpu.af.flag.c);            break;
-    case 0x9b: sub(gb, gb->cpu.de.e, gb->cpu.af.flag.c);            break;
-    case 0x9c: sub(gb, gb->cpu.hl.h, gb->cpu.af.flag.c);            break;
-    case 0x9d: sub(gb, gb->cpu.hl.l, gb->cpu.af.flag.c);            break;
-    case 0x9e: sub(gb, bus_read(gb, gb->cpu.hl.val), gb->cpu.af.flag.c); break;
-    case 0x9f: sub(gb, gb->cpu.af.a, gb->cpu.af.flag.c);            break;
-    case 0xa0: and(gb, gb->cpu.bc.b);                                 break;
-    case 0xa1: and(gb, gb->cpu.bc.c);                                 break;
-    case 0xa2: and(gb, gb->cpu.de.d);                                 break;
-    case 0xa3: and(gb, gb->cpu.de.e);                                 break;
-    case 0xa4: and(gb, gb->cpu.hl.h);                                 break;
-    case 0xa5: and(gb, gb->cpu.hl.l);                                 break;
-    case 0xa6: and(gb, bus_read(gb, gb->cpu.hl.val));                  break;
-    case 0xa7: and(gb, gb->cpu.af.a);                                 break;
-    case 0xa8: xor(gb, gb->cpu.bc.b);                                 break;
-    case 0xa9: xor(gb, gb->cpu.bc.c);                                 break;
-    case 0xaa: xor(gb, gb->cpu.de.d);                                 break;
-    case 0xab: xor(gb, gb->cpu.de.e);                                 break;
-    case 0xac: xor(gb, gb->cpu.hl.h);                                 break;
-    case 0xad: xor(gb, gb->cpu.hl.l);                                 break;
-    case 0xae: xor(gb, bus_read(gb, gb->cpu.hl.val));                  break;
-    case 0xaf: xor(gb, gb->cpu.af.a);                                 break;
-    case 0xb0: or(gb, gb->cpu.bc.b);                                  break;
-    case 0xb1: or(gb, gb->cpu.bc.c);                                  break;
-    case 0xb2: or(gb, gb->cpu.de.d);                                  break;
-    case 0xb3: or(gb, gb->cpu.de.e);                                  break;
-    case 0xb4: or(gb, gb->cpu.hl.h);                                  break;
-    case 0xb5: or(gb, gb->cpu.hl.l);                                  break;
-    case 0xb6: or(gb, bus_read(gb, gb->cpu.hl.val));                   break;
-    case 0xb7: or(gb, gb->cpu.af.a);                                  break;
-    case 0xb8: cp(gb, gb->cpu.bc.b);                                  break;
-    case 0xb9: cp(gb, gb->cpu.bc.c);                                  break;
-    case 0xba: cp(gb, gb->cpu.de.d);                                  break;
-    case 0xbb: cp(gb, gb->cpu.de.e);                                  break;
-    case 0xbc: cp(gb, gb->cpu.hl.h);                                  break;
-    case 0xbd: cp(gb, gb->cpu.hl.l);                                  break;
-    case 0xbe: cp(gb, bus_read(gb, gb->cpu.hl.val));                   break;
-    case 0xbf: cp(gb, gb->cpu.af.a);                                  break;
-    case 0xc0: ret(gb, opcode, !gb->cpu.af.flag.z);                   break;
-    case 0xc1: gb->cpu.bc.val = sm83_pop_word(gb);                     break;
-    case 0xc2: jp(gb, sm83_fetch_word(gb), 0, !gb->cpu.af.flag.z);    break;
-    case 0xc3: jp(gb, sm83_fetch_word(gb), 0, 1);                       break; 
-    case 0xc4: call(gb, sm83_fetch_word(gb), !gb->cpu.af.flag.z);     break;
-    case 0xc5: push_rr(gb, gb->cpu.bc.val);                            break;
-    case 0xc6: add(gb, sm83_fetch_byte(gb), 0);                         break;
-    case 0xc7: rst_n(gb, 0x00);                                         break;
-    case 0xc8: ret(gb, opcode, gb->cpu.af.flag.z);                    break;
-    case 0xc9: ret(gb, opcode, 1);                                      break;
-    case 0xca: jp(gb, sm83_fetch_word(gb), 0, gb->cpu.af.flag.z);     break;
-    case 0xcb: gb->executed_cycle = execute_cb_instructions(gb, sm83_fetch_byte(gb));        break;
-    case 0xcc: call(gb, sm83_fetch_word(gb), gb->cpu.af.flag.z);      break;
-    case 0xcd: call(gb, sm83_fetch_word(gb), 1);                        break;
-    case 0xce: add(gb, sm83_fetch_byte(gb), gb->cpu.af.flag.c);       break;
-    case 0xcf: rst_n(gb, 0x08);                                         break;
-    case 0xd0: ret(gb, opcode, !gb->cpu.af.flag.c);                   break;
-    case 0xd1: gb->cpu.de.val = sm83_pop_word(gb);                     break;
-    case 0xd2: jp(gb, sm83_fetch_word(gb), 0, !gb->cpu.af.flag.c);    break;
-    case 0xd4: call(gb, sm83_fetch_word(gb), !gb->cpu.af.flag.c);     break;
-    case 0xd5: push_rr(gb, gb->cpu.de.val);                            break;
-    case 0xd6: sub(gb, sm83_fetch_byte(gb), 0);                         break;
-    case 0xd7: rst_n(gb, 0x10);                                         break;
-    case 0xd8: ret(gb, opcode, gb->cpu.af.flag.c);                    break;
-    case 0xd9: reti(gb);                                                break;
-    case 0xda: jp(gb, sm83_fetch_word(gb), 0, gb->cpu.af.flag.c);     break;
-    case 0xdc: call(gb, sm83_fetch_word(gb), gb->cpu.af.flag.c);      break;
-    case 0xde: sub(gb, sm83_fetch_byte(gb), gb->cpu.af.flag.c);       break;
-    case 0xdf: rst_n(gb, 0x18);                                         break;
-    case 0xe0: ldh_indirect_n_a(gb, sm83_fetch_byte(gb));               break;
-    case 0xe1: gb->cpu.hl.val = sm83_pop_word(gb);                     break;
-    case 0xe2: ldh_indirect_c_a(gb);                                    break;
-    case 0xe5: push_rr(gb, gb->cpu.hl.val);                            break;
-    case 0xe6: and(gb, sm83_fetch_byte(gb));                            break;
-    case 0xe7: rst_n(gb, 0x20);                                         break;
-    case 0xe8: add_sp_i8(gb, sm83_fetch_byte(gb));                      break;
-    case 0xe9: gb->cpu.pc = gb->cpu.hl.val;                       break;
-    case 0xea: bus_write(gb, sm83_fetch_word(gb), gb->cpu.af.a);      break;
-    case 0xee: xor(gb, sm83_fetch_byte(gb));                            break;
-    case 0xef: rst_n(gb, 0x28);                                         break;
-    case 0xf0: ldh_a_indirect_n(gb, sm83_fetch_byte(gb));               break;
-    case 0xf1: gb->cpu.af.val = (sm83_pop_word(gb) & 0xfff0) & ~0x000f; break;
-    case 0xf2: ldh_a_indirect_c(gb);                                    break;
-    case 0xf3: di(gb);                                                  break;
-    case 0xf5: push_rr(gb, gb->cpu.af.val);                            break;
-    case 0xf6: or(gb, sm83_fetch_byte(gb));                             break;
-    case 0xf7: rst_n(gb, 0x30);                                         break;
-    case 0xf8: ld_hl_sp_plus_i8(gb, sm83_fetch_byte(gb));               break;
-    case 0xf9: gb->cpu.sp = gb->cpu.hl.val;         break;
-    case 0xfa: gb->cpu.af.a = bus_read(gb, sm83_fetch_word(gb));      break;
-    case 0xfb: ei(gb);                                                  break;
-    case 0xfe: cp(gb, sm83_fetch_byte(gb));                             break;
-    case 0xff: rst_n(gb, 0x38);                                         break;
+    static const char *const shifts[] = { "rlc", "rrc", "rl", "rr", "sla", "sra", "swap", "srl" };
+    static const char *const bits[] = { "bit", "res", "set" };
+    static const char *const regs[] = { "b", "c", "d", "e", "h", "l", "(hl)", "a" };
+
+    if (op < 0x100)
+        snprintf(buf, size, "%s", mnemonics[op]);
+    else if ((op & 0xff) < 0x40)
+        snprintf(buf, size, "%s %s", shifts[(op >> 3) & 7], regs[op & 7]);
+    else
+        snprintf(buf, size, "%s %d,%s", bits[((op & 0xff) >> 6) - 1], (op >> 3) & 7, regs[op & 7]);
+}
+
+static void sm83_profile(struct gb *gb, uint16_t pc, uint8_t opcode, uint16_t operand, int cycles)
+{
+    struct profile *prof = gb->profile;
+    uint64_t count, t_cycles = cycles * 4;
+    uint32_t slot, bank;
+    uint8_t *page;
+    int op;
+
+    if (!prof && !(prof = gb->profile = calloc(1, sizeof(*prof))))
+        return;
+    // a CPU woken up from HALT redispatches it without retiring anything
+    count = gb->cpu.instructions != prof->instructions;
+    prof->instructions = gb->cpu.instructions;
+
+    op = (opcode == 0xcb) ? 0x100 | (operand & 0xff) : opcode;
+    if (pc < 0x8000 && (page = gb->bus.read_map[pc >> 8])) {
+        slot = page + (pc & 0xff) - gb->cart.rom;
+        bank = slot >> 14;
+    } else {
+        slot = 2 * MiB + (pc & 0x7fff);
+        bank = PROFILE_ROM_BANKS + ((pc & 0x7fff) >> 13);
+    }
+
+    prof->opcodes[op].count += count;
+    prof->opcodes[op].cycles += t_cycles;
+    prof->banks[bank].count += count;
+    prof->banks[bank].cycles += t_cycles;
+    prof->pcs[slot].count += count;
+    prof->pcs[slot].cycles += t_cycles;
+    if (gb->callstack)
+        callstack_sample(gb, t_cycles);
+}
+
+struct profile_entry {
+    uint32_t index;
+    struct profile_counter counter;
+};
+
+static int profile_entry_cmp(const void *a, const void *b)
+{
+    const struct profile_entry *x = a, *y = b;
+
+    if (x->counter.cycles != y->counter.cycles)
+        return (x->counter.cycles < y->counter.cycles) ? 1 : -1;
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/* Collect the non-zero counters, hottest first */
+static int profile_sort(const struct profile_counter *counters, uint32_t cnt,
+                        struct profile_entry *entries)
+{
+    int n = 0;
+
+    for (uint32_t i = 0; i < cnt; i++)
+        if (counters[i].cycles)
+            entries[n++] = (struct profile_entry){ i, counters[i] };
+    qsort(entries, n, sizeof(*entries), profile_entry_cmp);
+    return n;
+}
+
+static void profile_pc_name(uint32_t slot, char *buf, size_t size)
+{
+    if (slot < 2 * MiB)
+        snprintf(buf, size, "%02x:%04x", slot >> 14, (slot < 0x4000) ? slot : 0x4000 | (slot & 0x3fff));
+    else
+        snprintf(buf, size, "--:%04x", 0x8000 + slot - 2 * MiB);
+}
+
+void sm83_profile_report(struct gb *gb, FILE *f)
+{
+    static const char *const regions[] = { "vram", "sram", "wram", "hram" };
+    struct profile *prof = gb->profile;
+    struct profile_entry *entries;
+    uint64_t total_count = 0, total_cycles = 0;
+    char name[32];
+    int n;
+
+    if (!prof || !(entries = malloc(PROFILE_PCS * sizeof(*entries))))
+        return;
+    for (int i = 0; i < PROFILE_OPCODES; i++) {
+        total_count += prof->opcodes[i].count;
+        total_cycles += prof->opcodes[i].cycles;
+    }
+    if (!total_cycles) {
+        free(entries);
+        return;
+    }
+
+    fprintf(f, "%llu instructions, %llu T-cycles\n\n%-14s %12s %12s %7s\n", (unsigned long long)total_count,
+            (unsigned long long)total_cycles, "opcode", "count", "cycles", "%");
+    n = profile_sort(prof->opcodes, PROFILE_OPCODES, entries);
+    for (int i = 0; i < n; i++) {
+        profile_mnemonic(entries[i].index, name, sizeof(name));
+        fprintf(f, "%-14s %12llu %12llu %6.2f%%\n", name, (unsigned long long)entries[i].counter.count,
+                (unsigned long long)entries[i].counter.cycles, 100.0 * entries[i].counter.cycles / total_cycles);
+    }
+
+    fprintf(f, "\n%-14s %12s %12s %7s\n", "bank", "count", "cycles", "%");
+    n = profile_sort(prof->banks, PROFILE_BANKS, entries);
+    for (int i = 0; i < n; i++) {
+        if (entries[i].index < PROFILE_ROM_BANKS)
+            snprintf(name, sizeof(name), "rom %02x", entries[i].index);
+        else
+            snprintf(name, sizeof(name), "%s", regions[entries[i].index - PROFILE_ROM_BANKS]);
+        fprintf(f, "%-14s %12llu %12llu %6.2f%%\n", name, (unsigned long long)entries[i].counter.count,
+                (unsigned long long)entries[i].counter.cycles, 100.0 * entries[i].counter.cycles / total_cycles);
+    }
+
+    fprintf(f, "\n%-14s %12s %12s %7s\n", "pc", "count", "cycles", "%");
+    n = profile_sort(prof->pcs, PROFILE_PCS, entries);
+    for (int i = 0; i < n && i < PROFILE_REPORT_PCS; i++) {
+        profile_pc_name(entries[i].index, name, sizeof(name));
+        fprintf(f, "%-14s %12llu %12llu %6.2f%%\n", name, (unsigned long long)entries[i].counter.count,
+                (unsigned long long)entries[i].counter.cycles, 100.0 * entries[i].counter.cycles / total_cycles);
+    }
+    free(entries);
+}
+
+void sm83_profile_free(struct gb *gb)
+{
+    free(gb->profile);
+    gb->profile = NULL;
+}
+
+#define PROFILE_PC(pc)  op_pc = (pc)
+#define PROFILE()       sm83_profile(gb, op_pc, opcode, operand, cycles)
+#else
+#define PROFILE_PC(pc)  do { } while (0)
+#define PROFILE()       do { } while (0)
+#endif
+
+/*
+ * The opcode handlers below are shared by both dispatch strategies. With
+ * SM83_THREADED_DISPATCH on GCC/Clang every handler ends in its own copy of
+ * the fetch/dispatch sequence and jumps straight to the next handler through
+ * a label table; otherwise they are the cases of a plain switch.
+ *
+ * When run is false a single instruction is executed and its cycle count
+ * returned without ticking the rest of the system (sm83_step()). When run is
+ * true the system is ticked after each instruction and execution continues
+ * until a frame or a sample buffer is ready (sm83_run()). In that mode code
+ * in ROM, WRAM and HRAM comes predecoded from the block cache: as long as
+ * execution falls through the current block the next instruction is taken
+ * from it without touching the bus. last_key remembers the block entered
+ * last, so that a polling loop running straight back into itself can be
+ * fast-forwarded (block_idle_loop()).
+ */
+#define IN_BLOCK()      (instr != end && instr->pc == gb->cpu.pc && !gb->block_cache.flush)
+#define FETCH_CACHED()  do {                                    \
+                            opcode = instr->opcode;             \
+                            operand = instr->operand;           \
+                            cycles = instr->cycles;             \
+                            PROFILE_PC(instr->pc);              \
+                            gb->cpu.pc += instr->length;        \
+                            instr++;                            \
+                        } while (0)
+
+#if defined(SM83_THREADED_DISPATCH) && defined(__GNUC__)
+#define COMPUTED_GOTO   1
+#define OPCODE(n)       op_##n:
+#define DISPATCH()      goto *dispatch_table[opcode];
+#define DISPATCH_END()
+#define NEXT            do {                                      \
+                            COUNTER_ADD(gb->cpu.instructions, 1); \
+                            PROFILE();                            \
+                            cycles += interrupt_process(gb);      \
+                            if (!run)                             \
+                                return cycles;                    \
+                            sm83_cycle(gb, cycles);               \
+                            if (sm83_should_stop(gb))             \
+                                return cycles;                    \
+                            if (!IN_BLOCK())                      \
+                                goto fetch;                       \
+                            FETCH_CACHED();                       \
+                            goto *dispatch_table[opcode];         \
+                        } while (0)
+#else
+#define OPCODE(n)       case n:
+#define DISPATCH()      switch (opcode) {
+#define DISPATCH_END()  }
+#define NEXT            break
+#endif
+
+static int sm83_execute(struct gb *gb, bool run)
+{
+    const struct block_instr *instr = NULL, *end = NULL;
+    struct block *block;
+#ifndef SM83_PROFILE
+    uint32_t last_key = BLOCK_KEY_NONE;
+#endif
+#ifdef SM83_JIT
+    int count;
+#endif
+#ifdef SM83_PROFILE
+    uint16_t op_pc = 0;
+#endif
+    uint16_t operand;
+    uint8_t opcode;
+    int cycles;
+#ifdef COMPUTED_GOTO
+    static void *const dispatch_table[0x100] = {
+        [0x00] = &&op_0x00, [0x01] = &&op_0x01, [0x02] = &&op_0x02, [0x03] = &&op_0x03,
+        [0x04] = &&op_0x04, [0x05] = &&op_0x05, [0x06] = &&op_0x06, [0x07] = &&op_0x07,
+        [0x08] = &&op_0x08, [0x09] = &&op_0x09, [0x0a] = &&op_0x0a, [0x0b] = &&op_0x0b,
+        [0x0c] = &&op_0x0c, [0x0d] = &&op_0x0d, [0x0e] = &&op_0x0e, [0x0f] = &&op_0x0f,
+        [0x10] = &&op_0x10, [0x11] = &&op_0x11, [0x12] = &&op_0x12, [0x13] = &&op_0x13,
+        [0x14] = &&op_0x14, [0x15] = &&op_0x15, [0x16] = &&op_0x16, [0x17] = &&op_0x17,
+        [0x18] = &&op_0x18, [0x19] = &&op_0x19, [0x1a] = &&op_0x1a, [0x1b] = &&op_0x1b,
+        [0x1c] = &&op_0x1c, [0x1d] = &&op_0x1d, [0x1e] = &&op_0x1e, [0x1f] = &&op_0x1f,
+        [0x20] = &&op_0x20, [0x21] = &&op_0x21, [0x22] = &&op_0x22, [0x23] = &&op_0x23,
+        [0x24] = &&op_0x24, [0x25] = &&op_0x25, [0x26] = &&op_0x26, [0x27] = &&op_0x27,
+        [0x28] = &&op_0x28, [0x29] = &&op_0x29, [0x2a] = &&op_0x2a, [0x2b] = &&op_0x2b,
+        [0x2c] = &&op_0x2c, [0x2d] = &&op_0x2d, [0x2e] = &&op_0x2e, [0x2f] = &&op_0x2f,
+        [0x30] = &&op_0x30, [0x31] = &&op_0x31, [0x32] = &&op_0x32, [0x33] = &&op_0x33,
+        [0x34] = &&op_0x34, [0x35] = &&op_0x35, [0x36] = &&op_0x36, [0x37] = &&op_0x37,
+        [0x38] = &&op_0x38, [0x39] = &&op_0x39, [0x3a] = &&op_0x3a, [0x3b] = &&op_0x3b,
+        [0x3c] = &&op_0x3c, [0x3d] = &&op_0x3d, [0x3e] = &&op_0x3e, [0x3f] = &&op_0x3f,
+        [0x40] = &&op_0x40, [0x41] = &&op_0x41, [0x42] = &&op_0x42, [0x43] = &&op_0x43,
+        [0x44] = &&op_0x44, [0x45] = &&op_0x45, [0x46] = &&op_0x46, [0x47] = &&op_0x47,
+        [0x48] = &&op_0x48, [0x49] = &&op_0x49, [0x4a] = &&op_0x4a, [0x4b] = &&op_0x4b,
+        [0x4c] = &&op_0x4c, [0x4d] = &&op_0x4d, [0x4e] = &&op_0x4e, [0x4f] = &&op_0x4f,
+        [0x50] = &&op_0x50, [0x51] = &&op_0x51, [0x52] = &&op_0x52, [0x53] = &&op_0x53,
+        [0x54] = &&op_0x54, [0x55] = &&op_0x55, [0x56] = &&op_0x56, [0x57] = &&op_0x57,
+        [0x58] = &&op_0x58, [0x59] = &&op_0x59, [0x5a] = &&op_0x5a, [0x5b] = &&op_0x5b,
+        [0x5c] = &&op_0x5c, [0x5d] = &&op_0x5d, [0x5e] = &&op_0x5e, [0x5f] = &&op_0x5f,
+        [0x60] = &&op_0x60, [0x61] = &&op_0x61, [0x62] = &&op_0x62, [0x63] = &&op_0x63,
+        [0x64] = &&op_0x64, [0x65] = &&op_0x65, [0x66] = &&op_0x66, [0x67] = &&op_0x67,
+        [0x68] = &&op_0x68, [0x69] = &&op_0x69, [0x6a] = &&op_0x6a, [0x6b] = &&op_0x6b,
+        [0x6c] = &&op_0x6c, [0x6d] = &&op_0x6d, [0x6e] = &&op_0x6e, [0x6f] = &&op_0x6f,
+        [0x70] = &&op_0x70, [0x71] = &&op_0x71, [0x72] = &&op_0x72, [0x73] = &&op_0x73,
+        [0x74] = &&op_0x74, [0x75] = &&op_0x75, [0x76] = &&op_0x76, [0x77] = &&op_0x77,
+        [0x78] = &&op_0x78, [0x79] = &&op_0x79, [0x7a] = &&op_0x7a, [0x7b] = &&op_0x7b,
+        [0x7c] = &&op_0x7c, [0x7d] = &&op_0x7d, [0x7e] = &&op_0x7e, [0x7f] = &&op_0x7f,
+        [0x80] = &&op_0x80, [0x81] = &&op_0x81, [0x82] = &&op_0x82, [0x83] = &&op_0x83,
+        [0x84] = &&op_0x84, [0x85] = &&op_0x85, [0x86] = &&op_0x86, [0x87] = &&op_0x87,
+        [0x88] = &&op_0x88, [0x89] = &&op_0x89, [0x8a] = &&op_0x8a, [0x8b] = &&op_0x8b,
+        [0x8c] = &&op_0x8c, [0x8d] = &&op_0x8d, [0x8e] = &&op_0x8e, [0x8f] = &&op_0x8f,
+        [0x90] = &&op_0x90, [0x91] = &&op_0x91, [0x92] = &&op_0x92, [0x93] = &&op_0x93,
+        [0x94] = &&op_0x94, [0x95] = &&op_0x95, [0x96] = &&op_0x96, [0x97] = &&op_0x97,
+        [0x98] = &&op_0x98, [0x99] = &&op_0x99, [0x9a] = &&op_0x9a, [0x9b] = &&op_0x9b,
+        [0x9c] = &&op_0x9c, [0x9d] = &&op_0x9d, [0x9e] = &&op_0x9e, [0x9f] = &&op_0x9f,
+        [0xa0] = &&op_0xa0, [0xa1] = &&op_0xa1, [0xa2] = &&op_0xa2, [0xa3] = &&op_0xa3,
+        [0xa4] = &&op_0xa4, [0xa5] = &&op_0xa5, [0xa6] = &&op_0xa6, [0xa7] = &&op_0xa7,
+        [0xa8] = &&op_0xa8, [0xa9] = &&op_0xa9, [0xaa] = &&op_0xaa, [0xab] = &&op_0xab,
+        [0xac] = &&op_0xac, [0xad] = &&op_0xad, [0xae] = &&op_0xae, [0xaf] = &&op_0xaf,
+        [0xb0] = &&op_0xb0, [0xb1] = &&op_0xb1, [0xb2] = &&op_0xb2, [0xb3] = &&op_0xb3,
+        [0xb4] = &&op_0xb4, [0xb5] = &&op_0xb5, [0xb6] = &&op_0xb6, [0xb7] = &&op_0xb7,
+        [0xb8] = &&op_0xb8, [0xb9] = &&op_0xb9, [0xba] = &&op_0xba, [0xbb] = &&op_0xbb,
+        [0xbc] = &&op_0xbc, [0xbd] = &&op_0xbd, [0xbe] = &&op_0xbe, [0xbf] = &&op_0xbf,
+        [0xc0] = &&op_0xc0, [0xc1] = &&op_0xc1, [0xc2] = &&op_0xc2, [0xc3] = &&op_0xc3,
+        [0xc4] = &&op_0xc4, [0xc5] = &&op_0xc5, [0xc6] = &&op_0xc6, [0xc7] = &&op_0xc7,
+        [0xc8] = &&op_0xc8, [0xc9] = &&op_0xc9, [0xca] = &&op_0xca, [0xcb] = &&op_0xcb,
+        [0xcc] = &&op_0xcc, [0xcd] = &&op_0xcd, [0xce] = &&op_0xce, [0xcf] = &&op_0xcf,
+        [0xd0] = &&op_0xd0, [0xd1] = &&op_0xd1, [0xd2] = &&op_0xd2, [0xd3] = &&op_unknown,
+        [0xd4] = &&op_0xd4, [0xd5] = &&op_0xd5, [0xd6] = &&op_0xd6, [0xd7] = &&op_0xd7,
+        [0xd8] = &&op_0xd8, [0xd9] = &&op_0xd9, [0xda] = &&op_0xda, [0xdb] = &&op_unknown,
+        [0xdc] = &&op_0xdc, [0xdd] = &&op_unknown, [0xde] = &&op_0xde, [0xdf] = &&op_0xdf,
+        [0xe0] = &&op_0xe0, [0xe1] = &&op_0xe1, [0xe2] = &&op_0xe2, [0xe3] = &&op_unknown,
+        [0xe4] = &&op_unknown, [0xe5] = &&op_0xe5, [0xe6] = &&op_0xe6, [0xe7] = &&op_0xe7,
+        [0xe8] = &&op_0xe8, [0xe9] = &&op_0xe9, [0xea] = &&op_0xea, [0xeb] = &&op_unknown,
+        [0xec] = &&op_unknown, [0xed] = &&op_unknown, [0xee] = &&op_0xee, [0xef] = &&op_0xef,
+        [0xf0] = &&op_0xf0, [0xf1] = &&op_0xf1, [0xf2] = &&op_0xf2, [0xf3] = &&op_0xf3,
+        [0xf4] = &&op_unknown, [0xf5] = &&op_0xf5, [0xf6] = &&op_0xf6, [0xf7] = &&op_0xf7,
+        [0xf8] = &&op_0xf8, [0xf9] = &&op_0xf9, [0xfa] = &&op_0xfa, [0xfb] = &&op_0xfb,
+        [0xfc] = &&op_unknown, [0xfd] = &&op_unknown, [0xfe] = &&op_0xfe, [0xff] = &&op_0xff,
+    };
+#endif
+
+fetch:
+    if (IN_BLOCK()) {
+#ifdef SM83_JIT
+        // back to native code once the interpreter has ticked the system
+        if (block->native && (count = jit_run(gb, block, instr - block->instrs, &cycles))) {
+            instr += count;
+            COUNTER_ADD(gb->cpu.instructions, count - 1);
+            goto retire;
+        }
+#endif
+        FETCH_CACHED();
+    } else if (run && gb->mode != HALT && (block = block_lookup(gb, gb->cpu.pc))) {
+#ifndef SM83_PROFILE
+        // fast-forwarded and recompiled code would bypass the counters
+        if (block->idle && block_idle_loop(gb, block, instr && instr == end && block->key == last_key) &&
+            sm83_should_stop(gb))
+            return 0;
+        last_key = block->key;
+#endif
+        gb->block_cache.flush = false;
+        instr = block->instrs;
+        end = instr + block->count;
+#ifndef SM83_PROFILE
+        if (block->recompiled) {
+            if (block->recompiled(gb))
+                return 0;
+            instr = end = NULL;
+            goto fetch;
+        }
+#endif
+#ifdef SM83_JIT
+        if ((count = jit_run(gb, block, 0, &cycles))) {
+            instr += count;
+            COUNTER_ADD(gb->cpu.instructions, count - 1);
+            goto retire;
+        }
+#endif
+        FETCH_CACHED();
+    } else {
+        instr = end = NULL;
+        PROFILE_PC(gb->cpu.pc - (gb->mode == HALT));
+        opcode = sm83_fetch_byte(gb);
+        cycles = instr_cycle[opcode];
+        operand = sm83_fetch_operand(gb, opcode);
+    }
+
+    DISPATCH()
+    OPCODE(0x00)                                                           NEXT;
+    OPCODE(0x01) gb->cpu.bc.val = operand;                                 NEXT;
+    OPCODE(0x02) bus_write(gb, gb->cpu.bc.val, gb->cpu.af.a);              NEXT;
+    OPCODE(0x03) inc_rr(gb, &gb->cpu.bc.val);                              NEXT;
+    OPCODE(0x04) inc_r(gb, &gb->cpu.bc.b);                                 NEXT;
+    OPCODE(0x05) dec_r(gb, &gb->cpu.bc.b);                                 NEXT;
+    OPCODE(0x06) gb->cpu.bc.b = operand;                                   NEXT;
+    OPCODE(0x07) rlca(gb);                                                 NEXT;
+    OPCODE(0x08) ld_indirect_nn_sp(gb, operand);                           NEXT;
+    OPCODE(0x09) add_hl_rr(gb, gb->cpu.bc.val);                            NEXT;
+    OPCODE(0x0a) gb->cpu.af.a = bus_read(gb, gb->cpu.bc.val);              NEXT;
+    OPCODE(0x0b) dec_rr(gb, &gb->cpu.bc.val);                              NEXT;
+    OPCODE(0x0c) inc_r(gb, &gb->cpu.bc.c);                                 NEXT;
+    OPCODE(0x0d) dec_r(gb, &gb->cpu.bc.c);                                 NEXT;
+    OPCODE(0x0e) gb->cpu.bc.c = operand;                                   NEXT;
+    OPCODE(0x0f) rrca(gb);                                                 NEXT;
+    OPCODE(0x10) stop(gb);                                                 NEXT;
+    OPCODE(0x11) gb->cpu.de.val = operand;                                 NEXT;
+    OPCODE(0x12) bus_write(gb, gb->cpu.de.val, gb->cpu.af.a);              NEXT;
+    OPCODE(0x13) inc_rr(gb, &gb->cpu.de.val);                              NEXT;
+    OPCODE(0x14) inc_r(gb, &gb->cpu.de.d);                                 NEXT;
+    OPCODE(0x15) dec_r(gb, &gb->cpu.de.d);                                 NEXT;
+    OPCODE(0x16) gb->cpu.de.d = operand;                                   NEXT;
+    OPCODE(0x17) rla(gb);                                                  NEXT;
+    OPCODE(0x18) cycles += jp(gb, gb->cpu.pc, operand, 1);                 NEXT;
+    OPCODE(0x19) add_hl_rr(gb, gb->cpu.de.val);                            NEXT;
+    OPCODE(0x1a) gb->cpu.af.a = bus_read(gb, gb->cpu.de.val);              NEXT;
+    OPCODE(0x1b) dec_rr(gb, &gb->cpu.de.val);                              NEXT;
+    OPCODE(0x1c) inc_r(gb, &gb->cpu.de.e);                                 NEXT;
+    OPCODE(0x1d) dec_r(gb, &gb->cpu.de.e);                                 NEXT;
+    OPCODE(0x1e) gb->cpu.de.e = operand;                                   NEXT;
+    OPCODE(0x1f) rra(gb);                                                  NEXT;
+    OPCODE(0x20) cycles += jp(gb, gb->cpu.pc, operand, !flag_z(gb));       NEXT;
+    OPCODE(0x21) gb->cpu.hl.val = operand;                                 NEXT;
+    OPCODE(0x22) bus_write(gb, gb->cpu.hl.val++, gb->cpu.af.a);            NEXT;
+    OPCODE(0x23) inc_rr(gb, &gb->cpu.hl.val);                              NEXT;
+    OPCODE(0x24) inc_r(gb, &gb->cpu.hl.h);                                 NEXT;
+    OPCODE(0x25) dec_r(gb, &gb->cpu.hl.h);                                 NEXT;
+    OPCODE(0x26) gb->cpu.hl.h = operand;                                   NEXT;
+    OPCODE(0x27) daa(gb);                                                  NEXT;
+    OPCODE(0x28) cycles += jp(gb, gb->cpu.pc, operand, flag_z(gb));        NEXT;
+    OPCODE(0x29) add_hl_rr(gb, gb->cpu.hl.val);                            NEXT;
+    OPCODE(0x2a) gb->cpu.af.a = bus_read(gb, gb->cpu.hl.val++);            NEXT;
+    OPCODE(0x2b) dec_rr(gb, &gb->cpu.hl.val);                              NEXT;
+    OPCODE(0x2c) inc_r(gb, &gb->cpu.hl.l);                                 NEXT;
+    OPCODE(0x2d) dec_r(gb, &gb->cpu.hl.l);                                 NEXT;
+    OPCODE(0x2e) gb->cpu.hl.l = operand;                                   NEXT;
+    OPCODE(0x2f) cpl(gb);                                                  NEXT;
+    OPCODE(0x30) cycles += jp(gb, gb->cpu.pc, operand, !flag_c(gb));       NEXT;
+    OPCODE(0x31) gb->cpu.sp = operand;                                     NEXT;
+    OPCODE(0x32) bus_write(gb, gb->cpu.hl.val--, gb->cpu.af.a);            NEXT;
+    OPCODE(0x33) inc_rr(gb, &gb->cpu.sp);                                  NEXT;
+    OPCODE(0x34) inc_indirect_hl(gb);                                      NEXT;
+    OPCODE(0x35) dec_indirect_hl(gb);                                      NEXT;
+    OPCODE(0x36) ld_indirect_hl_n(gb, operand);                            NEXT;
+    OPCODE(0x37) scf(gb);                                                  NEXT;
+    OPCODE(0x38) cycles += jp(gb, gb->cpu.pc, operand, flag_c(gb));        NEXT;
+    OPCODE(0x39) add_hl_rr(gb, gb->cpu.sp);                                NEXT;
+    OPCODE(0x3a) gb->cpu.af.a = bus_read(gb, gb->cpu.hl.val--);            NEXT;
+    OPCODE(0x3b) dec_rr(gb, &gb->cpu.sp);                                  NEXT;
+    OPCODE(0x3c) inc_r(gb, &gb->cpu.af.a);                                 NEXT;
+    OPCODE(0x3d) dec_r(gb, &gb->cpu.af.a);                                 NEXT;
+    OPCODE(0x3e) gb->cpu.af.a = operand;                                   NEXT;
+    OPCODE(0x3f) ccf(gb);                                                  NEXT;
+    OPCODE(0x40) gb->cpu.bc.b = gb->cpu.bc.b;                              NEXT;
+    OPCODE(0x41) gb->cpu.bc.b = gb->cpu.bc.c;                              NEXT;
+    OPCODE(0x42) gb->cpu.bc.b = gb->cpu.de.d;                              NEXT;
+    OPCODE(0x43) gb->cpu.bc.b = gb->cpu.de.e;                              NEXT;
+    OPCODE(0x44) gb->cpu.bc.b = gb->cpu.hl.h;                              NEXT;
+    OPCODE(0x45) gb->cpu.bc.b = gb->cpu.hl.l;                              NEXT;
+    OPCODE(0x46) gb->cpu.bc.b = bus_read(gb, gb->cpu.hl.val);              NEXT;
+    OPCODE(0x47) gb->cpu.bc.b = gb->cpu.af.a;                              NEXT;
+    OPCODE(0x48) gb->cpu.bc.c = gb->cpu.bc.b;                              NEXT;
+    OPCODE(0x49) gb->cpu.bc.c = gb->cpu.bc.c;                              NEXT;
+    OPCODE(0x4a) gb->cpu.bc.c = gb->cpu.de.d;                              NEXT;
+    OPCODE(0x4b) gb->cpu.bc.c = gb->cpu.de.e;                              NEXT;
+    OPCODE(0x4c) gb->cpu.bc.c = gb->cpu.hl.h;                              NEXT;
+    OPCODE(0x4d) gb->cpu.bc.c = gb->cpu.hl.l;                              NEXT;
+    OPCODE(0x4e) gb->cpu.bc.c = bus_read(gb, gb->cpu.hl.val);              NEXT;
+    OPCODE(0x4f) gb->cpu.bc.c = gb->cpu.af.a;                              NEXT;
+    OPCODE(0x50) gb->cpu.de.d = gb->cpu.bc.b;                              NEXT;
+    OPCODE(0x51) gb->cpu.de.d = gb->cpu.bc.c;                              NEXT;
+    OPCODE(0x52) gb->cpu.de.d = gb->cpu.de.d;                              NEXT;
+    OPCODE(0x53) gb->cpu.de.d = gb->cpu.de.e;                              NEXT;
+    OPCODE(0x54) gb->cpu.de.d = gb->cpu.hl.h;                              NEXT;
+    OPCODE(0x55) gb->cpu.de.d = gb->cpu.hl.l;                              NEXT;
+    OPCODE(0x56) gb->cpu.de.d = bus_read(gb, gb->cpu.hl.val);              NEXT;
+    OPCODE(0x57) gb->cpu.de.d = gb->cpu.af.a;                              NEXT;
+    OPCODE(0x58) gb->cpu.de.e = gb->cpu.bc.b;                              NEXT;
+    OPCODE(0x59) gb->cpu.de.e = gb->cpu.bc.c;                              NEXT;
+    OPCODE(0x5a) gb->cpu.de.e = gb->cpu.de.d;                              NEXT;
+    OPCODE(0x5b) gb->cpu.de.e = gb->cpu.de.e;                              NEXT;
+    OPCODE(0x5c) gb->cpu.de.e = gb->cpu.hl.h;                              NEXT;
+    OPCODE(0x5d) gb->cpu.de.e = gb->cpu.hl.l;                              NEXT;
+    OPCODE(0x5e) gb->cpu.de.e = bus_read(gb, gb->cpu.hl.val);              NEXT;
+    OPCODE(0x5f) gb->cpu.de.e = gb->cpu.af.a;                              NEXT;
+    OPCODE(0x60) gb->cpu.hl.h = gb->cpu.bc.b;                              NEXT;
+    OPCODE(0x61) gb->cpu.hl.h = gb->cpu.bc.c;                              NEXT;
+    OPCODE(0x62) gb->cpu.hl.h = gb->cpu.de.d;                              NEXT;
+    OPCODE(0x63) gb->cpu.hl.h = gb->cpu.de.e;                              NEXT;
+    OPCODE(0x64) gb->cpu.hl.h = gb->cpu.hl.h;                              NEXT;
+    OPCODE(0x65) gb->cpu.hl.h = gb->cpu.hl.l;                              NEXT;
+    OPCODE(0x66) gb->cpu.hl.h = bus_read(gb, gb->cpu.hl.val);              NEXT;
+    OPCODE(0x67) gb->cpu.hl.h = gb->cpu.af.a;                              NEXT;
+    OPCODE(0x68) gb->cpu.hl.l = gb->cpu.bc.b;                              NEXT;
+    OPCODE(0x69) gb->cpu.hl.l = gb->cpu.bc.c;                              NEXT;
+    OPCODE(0x6a) gb->cpu.hl.l = gb->cpu.de.d;                              NEXT;
+    OPCODE(0x6b) gb->cpu.hl.l = gb->cpu.de.e;                              NEXT;
+    OPCODE(0x6c) gb->cpu.hl.l = gb->cpu.hl.h;                              NEXT;
+    OPCODE(0x6d) gb->cpu.hl.l = gb->cpu.hl.l;                              NEXT;
+    OPCODE(0x6e) gb->cpu.hl.l = bus_read(gb, gb->cpu.hl.val);              NEXT;
+    OPCODE(0x6f) gb->cpu.hl.l = gb->cpu.af.a;                              NEXT;
+    OPCODE(0x70) bus_write(gb, gb->cpu.hl.val, gb->cpu.bc.b);              NEXT;
+    OPCODE(0x71) bus_write(gb, gb->cpu.hl.val, gb->cpu.bc.c);              NEXT;
+    OPCODE(0x72) bus_write(gb, gb->cpu.hl.val, gb->cpu.de.d);              NEXT;
+    OPCODE(0x73) bus_write(gb, gb->cpu.hl.val, gb->cpu.de.e);              NEXT;
+    OPCODE(0x74) bus_write(gb, gb->cpu.hl.val, gb->cpu.hl.h);              NEXT;
+    OPCODE(0x75) bus_write(gb, gb->cpu.hl.val, gb->cpu.hl.l);              NEXT;
+    OPCODE(0x76) cycles += halt(gb);                                       NEXT;
+    OPCODE(0x77) bus_write(gb, gb->cpu.hl.val, gb->cpu.af.a);              NEXT;
+    OPCODE(0x78) gb->cpu.af.a = gb->cpu.bc.b;                              NEXT;
+    OPCODE(0x79) gb->cpu.af.a = gb->cpu.bc.c;                              NEXT;
+    OPCODE(0x7a) gb->cpu.af.a = gb->cpu.de.d;                              NEXT;
+    OPCODE(0x7b) gb->cpu.af.a = gb->cpu.de.e;                              NEXT;
+    OPCODE(0x7c) gb->cpu.af.a = gb->cpu.hl.h;                              NEXT;
+    OPCODE(0x7d) gb->cpu.af.a = gb->cpu.hl.l;                              NEXT;
+    OPCODE(0x7e) gb->cpu.af.a = bus_read(gb, gb->cpu.hl.val);              NEXT;
+    OPCODE(0x7f) gb->cpu.af.a = gb->cpu.af.a;                              NEXT;
+    OPCODE(0x80) add(gb, gb->cpu.bc.b, 0);                                 NEXT;
+    OPCODE(0x81) add(gb, gb->cpu.bc.c, 0);                                 NEXT;
+    OPCODE(0x82) add(gb, gb->cpu.de.d, 0);                                 NEXT;
+    OPCODE(0x83) add(gb, gb->cpu.de.e, 0);                                 NEXT;
+    OPCODE(0x84) add(gb, gb->cpu.hl.h, 0);                                 NEXT;
+    OPCODE(0x85) add(gb, gb->cpu.hl.l, 0);                                 NEXT;
+    OPCODE(0x86) add(gb, bus_read(gb, gb->cpu.hl.val), 0);                 NEXT;
+    OPCODE(0x87) add(gb, gb->cpu.af.a, 0);                                 NEXT;
+    OPCODE(0x88) add(gb, gb->cpu.bc.b, flag_c(gb));                        NEXT;
+    OPCODE(0x89) add(gb, gb->cpu.bc.c, flag_c(gb));                        NEXT;
+    OPCODE(0x8a) add(gb, gb->cpu.de.d, flag_c(gb));                        NEXT;
+    OPCODE(0x8b) add(gb, gb->cpu.de.e, flag_c(gb));                        NEXT;
+    OPCODE(0x8c) add(gb, gb->cpu.hl.h, flag_c(gb));                        NEXT;
+    OPCODE(0x8d) add(gb, gb->cpu.hl.l, flag_c(gb));                        NEXT;
+    OPCODE(0x8e) add(gb, bus_read(gb, gb->cpu.hl.val), flag_c(gb));        NEXT;
+    OPCODE(0x8f) add(gb, gb->cpu.af.a, flag_c(gb));                        NEXT;
+    OPCODE(0x90) sub(gb, gb->cpu.bc.b, 0);                                 NEXT;
+    OPCODE(0x91) sub(gb, gb->cpu.bc.c, 0);                                 NEXT;
+    OPCODE(0x92) sub(gb, gb->cpu.de.d, 0);                                 NEXT;
+    OPCODE(0x93) sub(gb, gb->cpu.de.e, 0);                                 NEXT;
+    OPCODE(0x94) sub(gb, gb->cpu.hl.h, 0);                                 NEXT;
+    OPCODE(0x95) sub(gb, gb->cpu.hl.l, 0);                                 NEXT;
+    OPCODE(0x96) sub(gb, bus_read(gb, gb->cpu.hl.val), 0);                 NEXT;
+    OPCODE(0x97) sub(gb, gb->cpu.af.a, 0);                                 NEXT;
+    OPCODE(0x98) sub(gb, gb->cpu.bc.b, flag_c(gb));                        NEXT;
+    OPCODE(0x99) sub(gb, gb->cpu.bc.c, flag_c(gb));                        NEXT;
+    OPCODE(0x9a) sub(gb, gb->cpu.de.d, flag_c(gb));                        NEXT;
+    OPCODE(0x9b) sub(gb, gb->cpu.de.e, flag_c(gb));                        NEXT;
+    OPCODE(0x9c) sub(gb, gb->cpu.hl.h, flag_c(gb));                        NEXT;
+    OPCODE(0x9d) sub(gb, gb->cpu.hl.l, flag_c(gb));                        NEXT;
+    OPCODE(0x9e) sub(gb, bus_read(gb, gb->cpu.hl.val), flag_c(gb));        NEXT;
+    OPCODE(0x9f) sub(gb, gb->cpu.af.a, flag_c(gb));                        NEXT;
+    OPCODE(0xa0) and(gb, gb->cpu.bc.b);                                    NEXT;
+    OPCODE(0xa1) and(gb, gb->cpu.bc.c);                                    NEXT;
+    OPCODE(0xa2) and(gb, gb->cpu.de.d);                                    NEXT;
+    OPCODE(0xa3) and(gb, gb->cpu.de.e);                                    NEXT;
+    OPCODE(0xa4) and(gb, gb->cpu.hl.h);                                    NEXT;
+    OPCODE(0xa5) and(gb, gb->cpu.hl.l);                                    NEXT;
+    OPCODE(0xa6) and(gb, bus_read(gb, gb->cpu.hl.val));                    NEXT;
+    OPCODE(0xa7) and(gb, gb->cpu.af.a);                                    NEXT;
+    OPCODE(0xa8) xor(gb, gb->cpu.bc.b);                                    NEXT;
+    OPCODE(0xa9) xor(gb, gb->cpu.bc.c);                                    NEXT;
+    OPCODE(0xaa) xor(gb, gb->cpu.de.d);                                    NEXT;
+    OPCODE(0xab) xor(gb, gb->cpu.de.e);                                    NEXT;
+    OPCODE(0xac) xor(gb, gb->cpu.hl.h);                                    NEXT;
+    OPCODE(0xad) xor(gb, gb->cpu.hl.l);                                    NEXT;
+    OPCODE(0xae) xor(gb, bus_read(gb, gb->cpu.hl.val));                    NEXT;
+    OPCODE(0xaf) xor(gb, gb->cpu.af.a);                                    NEXT;
+    OPCODE(0xb0) or(gb, gb->cpu.bc.b);                                     NEXT;
+    OPCODE(0xb1) or(gb, gb->cpu.bc.c);                                     NEXT;
+    OPCODE(0xb2) or(gb, gb->cpu.de.d);                                     NEXT;
+    OPCODE(0xb3) or(gb, gb->cpu.de.e);                                     NEXT;
+    OPCODE(0xb4) or(gb, gb->cpu.hl.h);                                     NEXT;
+    OPCODE(0xb5) or(gb, gb->cpu.hl.l);                                     NEXT;
+    OPCODE(0xb6) or(gb, bus_read(gb, gb->cpu.hl.val));                     NEXT;
+    OPCODE(0xb7) or(gb, gb->cpu.af.a);                                     NEXT;
+    OPCODE(0xb8) cp(gb, gb->cpu.bc.b);                                     NEXT;
+    OPCODE(0xb9) cp(gb, gb->cpu.bc.c);                                     NEXT;
+    OPCODE(0xba) cp(gb, gb->cpu.de.d);                                     NEXT;
+    OPCODE(0xbb) cp(gb, gb->cpu.de.e);                                     NEXT;
+    OPCODE(0xbc) cp(gb, gb->cpu.hl.h);                                     NEXT;
+    OPCODE(0xbd) cp(gb, gb->cpu.hl.l);                                     NEXT;
+    OPCODE(0xbe) cp(gb, bus_read(gb, gb->cpu.hl.val));                     NEXT;
+    OPCODE(0xbf) cp(gb, gb->cpu.af.a);                                     NEXT;
+    OPCODE(0xc0) cycles += ret(gb, opcode, !flag_z(gb));                   NEXT;
+    OPCODE(0xc1) gb->cpu.bc.val = sm83_pop_word(gb);                       NEXT;
+    OPCODE(0xc2) cycles += jp(gb, operand, 0, !flag_z(gb));                NEXT;
+    OPCODE(0xc3) cycles += jp(gb, operand, 0, 1);                          NEXT;
+    OPCODE(0xc4) cycles += call(gb, operand, !flag_z(gb));                 NEXT;
+    OPCODE(0xc5) push_rr(gb, gb->cpu.bc.val);                              NEXT;
+    OPCODE(0xc6) add(gb, operand, 0);                                      NEXT;
+    OPCODE(0xc7) rst_n(gb, 0x00);                                          NEXT;
+    OPCODE(0xc8) cycles += ret(gb, opcode, flag_z(gb));                    NEXT;
+    OPCODE(0xc9) cycles += ret(gb, opcode, 1);                             NEXT;
+    OPCODE(0xca) cycles += jp(gb, operand, 0, flag_z(gb));                 NEXT;
+    OPCODE(0xcb) cycles = execute_cb_instructions(gb, operand);            NEXT;
+    OPCODE(0xcc) cycles += call(gb, operand, flag_z(gb));                  NEXT;
+    OPCODE(0xcd) cycles += call(gb, operand, 1);                           NEXT;
+    OPCODE(0xce) add(gb, operand, flag_c(gb));                             NEXT;
+    OPCODE(0xcf) rst_n(gb, 0x08);                                          NEXT;
+    OPCODE(0xd0) cycles += ret(gb, opcode, !flag_c(gb));                   NEXT;
+    OPCODE(0xd1) gb->cpu.de.val = sm83_pop_word(gb);                       NEXT;
+    OPCODE(0xd2) cycles += jp(gb, operand, 0, !flag_c(gb));                NEXT;
+    OPCODE(0xd4) cycles += call(gb, operand, !flag_c(gb));                 NEXT;
+    OPCODE(0xd5) push_rr(gb, gb->cpu.de.val);                              NEXT;
+    OPCODE(0xd6) sub(gb, operand, 0);                                      NEXT;
+    OPCODE(0xd7) rst_n(gb, 0x10);                                          NEXT;
+    OPCODE(0xd8) cycles += ret(gb, opcode, flag_c(gb));                    NEXT;
+    OPCODE(0xd9) cycles += reti(gb);                                       NEXT;
+    OPCODE(0xda) cycles += jp(gb, operand, 0, flag_c(gb));                 NEXT;
+    OPCODE(0xdc) cycles += call(gb, operand, flag_c(gb));                  NEXT;
+    OPCODE(0xde) sub(gb, operand, flag_c(gb));                             NEXT;
+    OPCODE(0xdf) rst_n(gb, 0x18);                                          NEXT;
+    OPCODE(0xe0) ldh_indirect_n_a(gb, operand);                            NEXT;
+    OPCODE(0xe1) gb->cpu.hl.val = sm83_pop_word(gb);                       NEXT;
+    OPCODE(0xe2) ldh_indirect_c_a(gb);                                     NEXT;
+    OPCODE(0xe5) push_rr(gb, gb->cpu.hl.val);                              NEXT;
+    OPCODE(0xe6) and(gb, operand);                                         NEXT;
+    OPCODE(0xe7) rst_n(gb, 0x20);                                          NEXT;
+    OPCODE(0xe8) add_sp_i8(gb, operand);                                   NEXT;
+    OPCODE(0xe9) gb->cpu.pc = gb->cpu.hl.val;                              NEXT;
+    OPCODE(0xea) bus_write(gb, operand, gb->cpu.af.a);                     NEXT;
+    OPCODE(0xee) xor(gb, operand);                                         NEXT;
+    OPCODE(0xef) rst_n(gb, 0x28);                                          NEXT;
+    OPCODE(0xf0) ldh_a_indirect_n(gb, operand);                            NEXT;
+    OPCODE(0xf1) sm83_set_af(gb, sm83_pop_word(gb));                       NEXT;
+    OPCODE(0xf2) ldh_a_indirect_c(gb);                                     NEXT;
+    OPCODE(0xf3) di(gb);                                                   NEXT;
+    OPCODE(0xf5) push_rr(gb, sm83_get_af(gb));                             NEXT;
+    OPCODE(0xf6) or(gb, operand);                                          NEXT;
+    OPCODE(0xf7) rst_n(gb, 0x30);                                          NEXT;
+    OPCODE(0xf8) ld_hl_sp_plus_i8(gb, operand);                            NEXT;
+    OPCODE(0xf9) gb->cpu.sp = gb->cpu.hl.val;                              NEXT;
+    OPCODE(0xfa) gb->cpu.af.a = bus_read(gb, operand);                     NEXT;
+    OPCODE(0xfb) ei(gb);                                                   NEXT;
+    OPCODE(0xfe) cp(gb, operand);                                          NEXT;
+    OPCODE(0xff) rst_n(gb, 0x38);                                          NEXT;
+#ifdef COMPUTED_GOTO
+    op_unknown:
+#else
     default:
+#endif
         fprintf(stderr, "Unknown opcode 0x%02x\n", opcode);
-        break;
-    }
-    gb->executed_cycle += interrupt_process(gb);
-    return gb->executed_cycle;
-}
\ No newline at end of file
+        NEXT;
+    DISPATCH_END()
+
+#ifdef SM83_JIT
+retire:
+#endif
+    COUNTER_ADD(gb->cpu.instructions, 1);
+    PROFILE();
+    cycles += interrupt_process(gb);
+    if (!run)
+        return cycles;
+    sm83_cycle(gb, cycles);
+    if (sm83_should_stop(gb))
+        return cycles;
+    goto fetch;
+}
+
+#undef IN_BLOCK
+#undef FETCH_CACHED
+#undef COMPUTED_GOTO
+#undef OPCODE
+#undef DISPATCH
+#undef DISPATCH_END
+#undef NEXT
+
+int sm83_step(struct gb *gb)
+{
+    return sm83_execute(gb, false);
+}
+
+/* Finish an instruction executed outside the interpreter loop the way
+   sm83_run() does: take interrupts and tick the system. Returns true once
+   a frame or a sample buffer is ready. */
+bool sm83_retire(struct gb *gb, int cycles)
+{
+    COUNTER_ADD(gb->cpu.instructions, 1);
+    cycles += interrupt_process(gb);
+    sm83_cycle(gb, cycles);
+    return sm83_should_stop(gb);
+}
+
+/* Same, for an instruction handed back to the interpreter */
+bool sm83_step_retire(struct gb *gb)
+{
+    sm83_cycle(gb, sm83_step(gb));
+    return sm83_should_stop(gb);
+}
+
+void sm83_run(struct gb *gb)
+{
+    TRACE_BEGIN(gb, start);
+    sm83_execute(gb, true);
+    TRACE_END(gb, TRACE_CPU, start);
+}
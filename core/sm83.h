@@ -10,11 +10,60 @@ extern "C" {
 #include "timer.h"
 #include "ppu.h"
 #include "apu.h"
+#include "scheduler.h"
+#include "block.h"
+#include "jit.h"
+#include "recomp.h"
+#include "callstack.h"
+#include "trace.h"
+
+extern int instr_cycle[];
+extern int cb_instr_cycle[];
+extern int instr_length[];
 
 int sm83_step(struct gb *gb);
+void sm83_run(struct gb *gb);
 void sm83_init(struct gb *gb);
 void sm83_cycle(struct gb *gb, int cycles);
 void sm83_push_word(struct gb *gb, uint16_t val);
+uint16_t sm83_pop_word(struct gb *gb);
+bool sm83_retire(struct gb *gb, int cycles);
+bool sm83_step_retire(struct gb *gb);
+#ifdef SM83_PROFILE
+void sm83_profile_report(struct gb *gb, FILE *f);
+void sm83_profile_free(struct gb *gb);
+#endif
+void sm83_flags_sync(struct gb *gb);
+bool sm83_flag_z(struct gb *gb);
+bool sm83_flag_c(struct gb *gb);
+void sm83_flags_logic(struct gb *gb, bool h);
+uint16_t sm83_get_af(struct gb *gb);
+void sm83_set_af(struct gb *gb, uint16_t val);
+
+/* instruction helpers called from recompiled code, see recomp/ */
+void add(struct gb *gb, uint8_t b, uint8_t c);
+void sub(struct gb *gb, uint8_t b, uint8_t c);
+void cp(struct gb *gb, uint8_t b);
+void daa(struct gb *gb);
+void rla(struct gb *gb);
+void rra(struct gb *gb);
+void add_hl_rr(struct gb *gb, uint16_t rr);
+int execute_cb_instructions(struct gb *gb, uint8_t opcode);
+void inc_indirect_hl(struct gb *gb);
+void dec_indirect_hl(struct gb *gb);
+void ccf(struct gb *gb);
+void scf(struct gb *gb);
+void cpl(struct gb *gb);
+void rlca(struct gb *gb);
+void rrca(struct gb *gb);
+void add_sp_i8(struct gb *gb, uint8_t i8);
+int jp(struct gb *gb, uint16_t nn, uint8_t offset, bool cond);
+int call(struct gb *gb, uint16_t nn, bool cond);
+int ret(struct gb *gb, uint8_t opcode, bool cond);
+int reti(struct gb *gb);
+void rst_n(struct gb *gb, uint8_t n);
+void di(struct gb *gb);
+void ei(struct gb *gb);
 
 #ifdef __cplusplus
 }
@@ -7,50 +7,57 @@ int div_bit_to_freq[] = {
     [3] = 5
 };
 
-uint8_t timer_read(struct gb *gb, uint16_t addr)
+uint8_t timer_div_read(struct gb *gb, uint16_t addr)
 {
-    uint8_t ret = 0xff;
-
-    switch (addr) {
-    case TIM_REG_DIV:
-        ret = (gb->timer.div >> 6) & 0x00ff;
-        break;
-    case TIM_REG_TAC:
-        ret = gb->timer.tac.val;
-        break;
-    case TIM_REG_TIMA:
-        ret = gb->timer.tima;
-        break;
-    case TIM_REG_TMA:
-        ret = gb->timer.tma;
-        break;
-    default:
-        break;
-    }
-    return ret;
+    timer_sync(gb);
+    return (gb->timer.div >> 6) & 0x00ff;
 }
 
-void timer_write(struct gb *gb, uint16_t addr, uint8_t val)
+uint8_t timer_tima_read(struct gb *gb, uint16_t addr)
 {
-    switch (addr) {
-    case TIM_REG_DIV:
-        gb->timer.div = 0;
-        break;
-    case TIM_REG_TAC:
-        gb->timer.tac.val = val;
-        break;
-    case TIM_REG_TIMA:
-        gb->timer.tima = val;
-        break;
-    case TIM_REG_TMA:
-        gb->timer.tma = val;
-        break;
-    default:
-        break;
-    }
+    timer_sync(gb);
+    return gb->timer.tima;
+}
+
+uint8_t timer_tma_read(struct gb *gb, uint16_t addr)
+{
+    return gb->timer.tma;
+}
+
+uint8_t timer_tac_read(struct gb *gb, uint16_t addr)
+{
+    return gb->timer.tac.val;
+}
+
+void timer_div_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    timer_sync(gb);
+    gb->timer.div = 0;
+    timer_schedule(gb);
 }
 
-void timer_tick(struct gb *gb)
+void timer_tima_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    timer_sync(gb);
+    gb->timer.tima = val;
+    timer_schedule(gb);
+}
+
+void timer_tma_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    timer_sync(gb);
+    gb->timer.tma = val;
+    timer_schedule(gb);
+}
+
+void timer_tac_write(struct gb *gb, uint16_t addr, uint8_t val)
+{
+    timer_sync(gb);
+    gb->timer.tac.val = val;
+    timer_schedule(gb);
+}
+
+static void timer_tick(struct gb *gb)
 {
     bool old_edge = gb->timer.old_edge, new_edge;
 
@@ -66,4 +73,68 @@ void timer_tick(struct gb *gb)
         }
     } 
     gb->timer.old_edge = BIT(gb->timer.div, div_bit_to_freq[gb->timer.tac.freq]);
-}
\ No newline at end of file
+}
+
+static void timer_increment(struct gb *gb, uint64_t n)
+{
+    while (n) {
+        // increments left until TIMA overflows
+        uint16_t room = 0x100 - gb->timer.tima;
+
+        if (n < room) {
+            gb->timer.tima += n;
+            break;
+        }
+        n -= room;
+        gb->timer.tima = gb->timer.tma;
+        interrupt_request(gb, INTR_SRC_TIMER);
+    }
+}
+
+/* Catch DIV and TIMA up with the scheduler. TIMA counts the falling edges
+   of one DIV bit, so the ticks in between can be skipped arithmetically. */
+void timer_sync(struct gb *gb)
+{
+    uint64_t elapsed = gb->scheduler.now - gb->timer.last_sync, edges;
+    int bit = div_bit_to_freq[gb->timer.tac.freq];
+    uint16_t period = 2U << bit;
+
+    gb->timer.last_sync = gb->scheduler.now;
+    if (!elapsed)
+        return;
+
+    // the first tick may see a stale edge after a DIV or TAC write
+    timer_tick(gb);
+    elapsed--;
+    edges = ((gb->timer.div % period) + elapsed) / period;
+    if (gb->timer.tac.enable)
+        timer_increment(gb, edges);
+    gb->timer.div += elapsed;
+    gb->timer.old_edge = BIT(gb->timer.div, bit);
+}
+
+void timer_schedule(struct gb *gb)
+{
+    int bit = div_bit_to_freq[gb->timer.tac.freq];
+    uint16_t period = 2U << bit;
+    uint64_t when;
+
+    if (!gb->timer.tac.enable) {
+        scheduler_cancel(gb, EVENT_TIMER);
+        return;
+    }
+    if (gb->timer.old_edge != BIT(gb->timer.div, bit)) {
+        when = gb->scheduler.now + 1;
+    } else {
+        // wake up on the tick that makes TIMA overflow
+        when = gb->scheduler.now + (period - gb->timer.div % period) +
+               (uint64_t)(0xff - gb->timer.tima) * period;
+    }
+    scheduler_schedule(gb, EVENT_TIMER, when);
+}
+
+void timer_event(struct gb *gb)
+{
+    timer_sync(gb);
+    timer_schedule(gb);
+}
@@ -2,6 +2,7 @@
 
 #include "gb.h"
 #include "interrupt.h"
+#include "scheduler.h"
 
 struct gb;
 
@@ -10,6 +11,14 @@ struct gb;
 #define TIM_REG_TMA                 0xff06
 #define TIM_REG_TAC                 0xff07
 
-uint8_t timer_read(struct gb *gb, uint16_t addr);
-void timer_write(struct gb *gb, uint16_t addr, uint8_t val);
-void timer_tick(struct gb *gb);
\ No newline at end of file
+uint8_t timer_div_read(struct gb *gb, uint16_t addr);
+uint8_t timer_tima_read(struct gb *gb, uint16_t addr);
+uint8_t timer_tma_read(struct gb *gb, uint16_t addr);
+uint8_t timer_tac_read(struct gb *gb, uint16_t addr);
+void timer_div_write(struct gb *gb, uint16_t addr, uint8_t val);
+void timer_tima_write(struct gb *gb, uint16_t addr, uint8_t val);
+void timer_tma_write(struct gb *gb, uint16_t addr, uint8_t val);
+void timer_tac_write(struct gb *gb, uint16_t addr, uint8_t val);
+void timer_sync(struct gb *gb);
+void timer_schedule(struct gb *gb);
+void timer_event(struct gb *gb);
@@ -0,0 +1,94 @@
+#include "trace.h"
+#include <time.h>
+
+/*
+ * Host-side timing of the phases of a frame for GBDA_TRACE builds. Each
+ * phase records its begin and end on the host clock into a preallocated
+ * buffer; nothing is formatted until the buffer is written out as Chrome
+ * trace-event JSON, which chrome://tracing and ui.perfetto.dev open. Spans
+ * nest as they did at run time: scanlines and samples inside the CPU run
+ * that produced them. Once the buffer is full further events are dropped
+ * and counted.
+ */
+
+static const char *const phase_names[TRACE_PHASE_CNT] = {
+    [TRACE_CPU] = "cpu",
+    [TRACE_SCANLINE] = "scanline",
+    [TRACE_SAMPLE] = "sample",
+    [TRACE_TEXTURE_UPLOAD] = "texture upload",
+    [TRACE_PRESENT] = "present",
+    [TRACE_AUDIO_QUEUE] = "audio queue",
+    [TRACE_AUDIO_WAIT] = "audio wait",
+};
+
+/* Nanoseconds on the monotonic clock */
+uint64_t trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool trace_start(struct gb *gb, size_t capacity)
+{
+    struct trace *trace;
+
+    if (gb->trace || !capacity || !(trace = calloc(1, sizeof(*trace))))
+        return false;
+    if (!(trace->events = malloc(capacity * sizeof(*trace->events)))) {
+        free(trace);
+        return false;
+    }
+    trace->capacity = capacity;
+    trace->origin = trace_now();
+    gb->trace = trace;
+    return true;
+}
+
+void trace_record(struct gb *gb, enum trace_phase phase, uint64_t start)
+{
+    struct trace *trace = gb->trace;
+    struct trace_event *event;
+
+    // a span already running when tracing started
+    if (start < trace->origin)
+        return;
+    if (trace->count == trace->capacity) {
+        trace->dropped++;
+        return;
+    }
+    event = &trace->events[trace->count++];
+    event->start = start;
+    event->end = trace_now();
+    event->phase = phase;
+}
+
+bool trace_write(struct gb *gb, FILE *f)
+{
+    const struct trace *trace = gb->trace;
+
+    if (!trace)
+        return false;
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped\": %llu}, \"traceEvents\": [\n",
+            (unsigned long long)trace->dropped);
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"gbda\"}}");
+    for (size_t i = 0; i < trace->count; i++) {
+        const struct trace_event *event = &trace->events[i];
+
+        fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.3f, \"dur\": %.3f}",
+                phase_names[event->phase], (event->start - trace->origin) / 1e3,
+                (event->end - event->start) / 1e3);
+    }
+    fprintf(f, "\n]}\n");
+    return !ferror(f);
+}
+
+void trace_free(struct gb *gb)
+{
+    if (!gb->trace)
+        return;
+    free(gb->trace->events);
+    free(gb->trace);
+    gb->trace = NULL;
+}
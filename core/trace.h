@@ -0,0 +1,36 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "gb.h"
+
+enum trace_phase {
+    TRACE_CPU,
+    TRACE_SCANLINE,
+    TRACE_SAMPLE,
+    TRACE_TEXTURE_UPLOAD,
+    TRACE_PRESENT,
+    TRACE_AUDIO_QUEUE,
+    TRACE_AUDIO_WAIT,
+    TRACE_PHASE_CNT,
+};
+
+#ifdef GBDA_TRACE
+#define TRACE_BEGIN(gb, start)          uint64_t start = ((gb)->trace) ? trace_now() : 0
+#define TRACE_END(gb, phase, start)     do { if ((gb)->trace) trace_record(gb, phase, start); } while (0)
+#else
+#define TRACE_BEGIN(gb, start)          do { } while (0)
+#define TRACE_END(gb, phase, start)     do { } while (0)
+#endif
+
+uint64_t trace_now(void);
+bool trace_start(struct gb *gb, size_t capacity);
+void trace_record(struct gb *gb, enum trace_phase phase, uint64_t start);
+bool trace_write(struct gb *gb, FILE *f);
+void trace_free(struct gb *gb);
+
+#ifdef __cplusplus
+}
+#endif
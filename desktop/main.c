@@ -1,8 +1,10 @@
 #include "gb.h"
+#include "gbda.h"
 #include "cartridge.h"
 #include "sm83.h"
 #include "bus.h"
 #include "sdl.h"
+#include "trace.h"
 #include <stdio.h>
 #include <unistd.h>
 
@@ -10,8 +12,23 @@
 #error This backend requires SDL2.0.17+ because of SDL_RenderGeometry() function
 #endif
 
+/* Four comma-separated RRGGBB colours, lightest first */
+static bool parse_palette(const char *arg, uint32_t colors[4])
+{
+    char *end;
+
+    for (int i = 0; i < 4; i++) {
+        colors[i] = (strtoul(arg, &end, 16) & 0xffffff) << 8 | 0xff;
+        if (end == arg || *end != ((i < 3) ? ',' : '\0'))
+            return false;
+        arg = end + 1;
+    }
+    return true;
+}
+
 void gb_init(struct gb *gb, int argc, char *argv[])
 {
+    uint32_t colors[4];
     int opt;
 
     if (argc < 2) {
@@ -21,50 +38,102 @@ void gb_init(struct gb *gb, int argc, char *argv[])
 
     gb->screen_scaler = 0;
     gb->volume_set = false;
-    sm83_init(gb);
-    while ((opt = getopt(argc, argv, "r:s:v:")) != -1) {
+    gb->palette_set = false;
+    gb->print_idle_loops = false;
+    gb->trace_path = NULL;
+    while ((opt = getopt(argc, argv, "ip:r:s:t:v:")) != -1) {
         switch (opt) {
         case 'v':
             gb->user_volume = atoi(optarg) & 0x7;
             gb->volume_set = true;
             break;
         case 'r':
-            cartridge_load(gb, optarg);
+            if (cartridge_load(gb, optarg)) {
+                printf("cartridge loaded\n");
+                cartridge_print_info(gb);
+            }
             break;
         case 's':
             gb->screen_scaler = atoi(optarg);
             break;
+        case 'i':
+            gb->print_idle_loops = true;
+            break;
+        case 'p':
+            if (!parse_palette(optarg, colors)) {
+                fprintf(stderr, "palette should be four RRGGBB colours, lightest first\n");
+                abort();
+            }
+            gb_set_palette(gb, colors);
+            break;
+        case 't':
+            gb->trace_path = optarg;
+            break;
         case '?':
         default:
             abort();
         }
     }
     if (gb->cart.cartridge_loaded)
-        load_state_after_booting(gb);
+        gb_reset(gb);
+    if (gb->recomp)
+        printf("using recompiled code: %d blocks\n", gb->recomp->count);
+    if (gb->trace_path && !gb_trace_start(gb, TRACE_CAPACITY)) {
+        fprintf(stderr, "tracing needs a GBDA_TRACE build\n");
+        gb->trace_path = NULL;
+    }
+}
+
+/* Polling loops the core fast-forwarded, as bank:address */
+void print_idle_loops(struct gb *gb)
+{
+    const struct idle_loop *loops;
+    int count;
+
+    loops = block_idle_loops(gb, &count);
+    for (int i = 0; i < count; i++) {
+        if (loops[i].key & BLOCK_KEY_RAM)
+            printf("idle loop   ram:%04x", loops[i].pc);
+        else
+            printf("idle loop %5u:%04x", loops[i].key / (16 * KiB), loops[i].pc);
+        printf("  %10llu hits  %12llu cycles skipped\n",
+               (unsigned long long)loops[i].hits, (unsigned long long)loops[i].cycles);
+    }
 }
 
 int main(int argc, char *argv[])
 {
-    struct gb gb;
+    struct gb *gb = gb_create();
     struct sdl sdl;
     bool done = false;
-    int cycles;
 
-    gb_init(&gb, argc, argv);
-    sdl_init(&sdl, gb.screen_scaler);
+    if (!gb) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    gb_init(gb, argc, argv);
+    sdl_init(&sdl, gb->screen_scaler);
     while (!done) {
-        while (!gb.apu.sample_buffer.is_full && !done) {
-            cycles = sm83_step(&gb);
-            sm83_cycle(&gb, cycles);
-            if (gb.ppu.frame_ready) {
-                gb.ppu.frame_ready = false;
-                sdl_handle_input(&sdl, &gb, &done);
-                sdl_render(&sdl, &gb);
+        while (!gb->apu.sample_buffer.is_full && !done) {
+            sm83_run(gb);
+            if (gb->ppu.frame_ready) {
+                gb->ppu.frame_ready = false;
+                sdl_handle_input(&sdl, gb, &done);
+                sdl_render(&sdl, gb);
             }
         }
-        gb.apu.sample_buffer.is_full = false;
-        SDL_QueueAudio(sdl.audio_dev, gb.apu.sample_buffer.buf, BUFFER_SIZE * 2);
+        gb->apu.sample_buffer.is_full = false;
+        TRACE_BEGIN(gb, queue_start);
+        SDL_QueueAudio(sdl.audio_dev, gb->apu.sample_buffer.buf, BUFFER_SIZE * 2);
+        TRACE_END(gb, TRACE_AUDIO_QUEUE, queue_start);
+        TRACE_BEGIN(gb, wait_start);
         while (SDL_GetQueuedAudioSize(1) > BUFFER_SIZE * 4);
+        TRACE_END(gb, TRACE_AUDIO_WAIT, wait_start);
     }
+    if (gb->print_idle_loops)
+        print_idle_loops(gb);
+    if (gb->trace_path && !gb_trace_write(gb, gb->trace_path))
+        fprintf(stderr, "cannot write %s\n", gb->trace_path);
+    gb_destroy(gb);
     return 0;
 }
\ No newline at end of file
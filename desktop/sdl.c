@@ -94,12 +94,17 @@ void sdl_handle_input(struct sdl *sdl, struct gb *gb, bool *done)
 
 void sdl_render(struct sdl *sdl, struct gb *gb)
 {
+    TRACE_BEGIN(gb, upload_start);
     SDL_RenderClear(sdl->renderer);
-    if (gb->ppu.lcdc.ppu_enable) {
+    if (gb->ppu.lcdc.ppu_enable)
         SDL_UpdateTexture(sdl->texture, NULL, gb->ppu.frame_buffer, SCREEN_WIDTH * 4);
+    TRACE_END(gb, TRACE_TEXTURE_UPLOAD, upload_start);
+
+    TRACE_BEGIN(gb, present_start);
+    if (gb->ppu.lcdc.ppu_enable)
         SDL_RenderCopy(sdl->renderer, sdl->texture, NULL, NULL);
-    }
     SDL_RenderPresent(sdl->renderer);
+    TRACE_END(gb, TRACE_PRESENT, present_start);
 }
 
 void sdl_destroy(struct sdl *sdl)
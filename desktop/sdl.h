@@ -4,6 +4,7 @@
 #include "joypad.h"
 #include "mbc.h"
 #include "apu.h"
+#include "trace.h"
 #include <SDL2/SDL.h>
 
 struct sdl {
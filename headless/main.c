@@ -0,0 +1,126 @@
+#include "gb.h"
+#include "gbda.h"
+#include <time.h>
+
+/*
+ * gbda-headless: run a ROM as fast as possible with no video or audio
+ * output, then print how long it took and hashes of the final framebuffer
+ * and RAM (WRAM, HRAM and cartridge RAM). Two runs of the same build and ROM
+ * always print the same hashes, so they double as a regression check.
+ *
+ * In a GBDA_PROFILE build, -o also samples the guest call stack every -p
+ * T-cycles and writes the samples in folded format for flame graph tools,
+ * with routine names taken from the RGBDS .sym file given with -s. In a
+ * GBDA_TRACE build, -t writes host timings of CPU runs, scanlines and
+ * samples as Chrome trace-event JSON. In a GBDA_JIT build, -i runs
+ * everything in the interpreter; the hashes must not change.
+ */
+
+#define CYCLES_PER_FRAME    70224
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ p[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: gbda-headless [-f frames | -c cycles] [-i] [-o stacks.folded [-p period] [-s rom.sym]] [-t trace.json] rom.gb\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t frames = 3600, cycles = 0, period = 10000, fb_hash, ram_hash;
+    const char *stacks_path = NULL, *sym_path = NULL, *trace_path = NULL;
+    struct timespec start, end;
+    double seconds, emulated;
+    bool interpret = false;
+    struct gb *gb;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:f:io:p:s:t:")) != -1) {
+        switch (opt) {
+        case 'c':
+            cycles = strtoull(optarg, NULL, 0);
+            break;
+        case 'f':
+            frames = strtoull(optarg, NULL, 0);
+            break;
+        case 'i':
+            interpret = true;
+            break;
+        case 'o':
+            stacks_path = optarg;
+            break;
+        case 'p':
+            period = strtoull(optarg, NULL, 0);
+            break;
+        case 's':
+            sym_path = optarg;
+            break;
+        case 't':
+            trace_path = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind != 1)
+        usage();
+
+    gb = gb_create();
+    if (!gb || !gb_load(gb, argv[optind])) {
+        fprintf(stderr, "cannot load %s\n", argv[optind]);
+        return 1;
+    }
+    if (interpret)
+        gb_set_jit(gb, false);
+    if (stacks_path && !gb_sample_stacks(gb, period)) {
+        fprintf(stderr, "call-stack sampling needs a GBDA_PROFILE build and a non-zero period\n");
+        return 1;
+    }
+    if (trace_path && !gb_trace_start(gb, TRACE_CAPACITY)) {
+        fprintf(stderr, "tracing needs a GBDA_TRACE build\n");
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (cycles) {
+        gb_run_cycles(gb, cycles);
+    } else {
+        for (uint64_t i = 0; i < frames; i++)
+            gb_run_frame(gb);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    emulated = (double)gb->scheduler.now / SYSTEM_CLOCK;
+    fb_hash = fnv1a(0xcbf29ce484222325ULL, gb->ppu.frame_buffer, sizeof(gb->ppu.frame_buffer));
+    ram_hash = fnv1a(0xcbf29ce484222325ULL, gb->wram, sizeof(gb->wram));
+    ram_hash = fnv1a(ram_hash, gb->hram, sizeof(gb->hram));
+    ram_hash = fnv1a(ram_hash, gb->extern_ram, sizeof(gb->extern_ram));
+
+    printf("cycles:      %llu\n", (unsigned long long)gb->scheduler.now);
+    printf("frames:      %.1f\n", (double)gb->scheduler.now / CYCLES_PER_FRAME);
+    printf("time:        %.3f s\n", seconds);
+    printf("fps:         %.1f\n", gb->scheduler.now / (double)CYCLES_PER_FRAME / seconds);
+    printf("speed:       %.1fx\n", emulated / seconds);
+    printf("framebuffer: %016llx\n", (unsigned long long)fb_hash);
+    printf("ram:         %016llx\n", (unsigned long long)ram_hash);
+    if (stacks_path && !gb_write_stacks(gb, stacks_path, sym_path)) {
+        fprintf(stderr, "cannot write %s\n", stacks_path);
+        gb_destroy(gb);
+        return 1;
+    }
+    if (trace_path && !gb_trace_write(gb, trace_path)) {
+        fprintf(stderr, "cannot write %s\n", trace_path);
+        gb_destroy(gb);
+        return 1;
+    }
+    gb_destroy(gb);
+    return 0;
+}
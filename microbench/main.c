@@ -0,0 +1,365 @@
+#include "gb.h"
+#include "gbda.h"
+#include "bus.h"
+#include "ppu.h"
+#include "apu.h"
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC    1
+#endif
+
+/*
+ * gbda-microbench: time single core functions in isolation, so that a
+ * slowdown seen in gbda-bench can be pinned on one subsystem.
+ *
+ *   bus_read, bus_write   one case per memory region and a few I/O
+ *                         registers with side effects
+ *   ppu_draw_scanline     0 to 10 sprites, 8x8 or 8x16, window off, over
+ *                         half the line or over all of it
+ *   generate_sample       every combination of the four channels playing
+ *
+ * Each case runs in batches that double in size until one takes at least
+ * -t milliseconds, and the last batch gives ns/op and, on x86, TSC cycles
+ * per op. Arguments select the cases whose function or name start with
+ * them.
+ */
+
+struct mcase {
+    const char *function;
+    char name[32];
+    void (*setup)(struct gb *gb, const struct mcase *c);     // may be NULL
+    void (*run)(struct gb *gb, const struct mcase *c, uint64_t n);
+    uint16_t addr;          // bus: first address and mask for the offset
+    uint16_t mask;
+    int sprites;            // ppu
+    int window;             // ppu: 0 off, 1 half the line, 2 all of it
+    bool tall;              // ppu: 8x16 sprites
+    int channels;           // apu: bit n set for channel n + 1 playing
+};
+
+struct result {
+    const struct mcase *c;
+    uint64_t ops;
+    double ns;
+    double cycles;
+};
+
+#define MAX_CASES       128
+
+static struct mcase cases[MAX_CASES];
+static int case_cnt;
+static volatile uint8_t sink;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void)
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* A 64 KiB MBC3 cartridge with RAM, so that every region is backed */
+static void load_cartridge(struct gb *gb)
+{
+    static uint8_t rom[64 * KiB];
+
+    for (size_t i = 0; i < sizeof(rom); i++)
+        rom[i] = i ^ (i >> 8);
+    memset(&rom[0x134], 0, 0x1c);
+    rom[0x147] = MBC3_RAM_BATTERY;
+    rom[0x148] = 0x01;
+    rom[0x149] = 0x02;
+    gb_load_rom(gb, rom, sizeof(rom));
+    bus_write(gb, 0x0000, 0x0a);
+    bus_write(gb, 0x2000, 0x02);
+}
+
+/* bus_read and bus_write */
+
+static void bus_read_run(struct gb *gb, const struct mcase *c, uint64_t n)
+{
+    uint8_t sum = 0;
+
+    for (uint64_t i = 0; i < n; i++)
+        sum += bus_read(gb, c->addr + (i & c->mask));
+    sink = sum;
+}
+
+static void bus_write_run(struct gb *gb, const struct mcase *c, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        bus_write(gb, c->addr + (i & c->mask), i);
+}
+
+/* MBC bank register: alternate between two banks */
+static void bus_write_mbc_run(struct gb *gb, const struct mcase *c, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        bus_write(gb, c->addr, 1 + (i & 1));
+}
+
+static const struct {
+    const char *name;
+    uint16_t addr;
+    uint16_t mask;
+} read_regions[] = {
+    { "rom0",       0x0000, 0x3fff },
+    { "romx",       0x4000, 0x3fff },
+    { "vram",       0x8000, 0x1fff },
+    { "exram",      0xa000, 0x1fff },
+    { "wram",       0xc000, 0x1fff },
+    { "echo",       0xe000, 0x1dff },
+    { "oam",        0xfe00, 0x007f },
+    { "unusable",   0xfea0, 0x003f },
+    { "io_ly",      0xff44, 0x0000 },
+    { "io_div",     0xff04, 0x0000 },
+    { "io_nr52",    0xff26, 0x0000 },
+    { "wave_ram",   0xff30, 0x000f },
+    { "hram",       0xff80, 0x003f },
+    { "ie",         0xffff, 0x0000 },
+}, write_regions[] = {
+    { "vram",       0x8000, 0x1fff },
+    { "exram",      0xa000, 0x1fff },
+    { "wram",       0xc000, 0x1fff },
+    { "echo",       0xe000, 0x1dff },
+    { "oam",        0xfe00, 0x007f },
+    { "io_scx",     0xff43, 0x0000 },
+    { "io_nr13",    0xff13, 0x0000 },
+    { "wave_ram",   0xff30, 0x000f },
+    { "hram",       0xff80, 0x003f },
+};
+
+/* ppu_draw_scanline */
+
+static void ppu_setup(struct gb *gb, const struct mcase *c)
+{
+    struct ppu *ppu = &gb->ppu;
+
+    for (int i = 0; i < 0x2000; i++)
+        bus_write(gb, 0x8000 + i, i ^ (i >> 8));
+    ppu->lcdc.val = 0x91 | ((c->sprites) ? 0x02 : 0) | ((c->tall) ? 0x04 : 0) |
+                    ((c->window) ? 0x60 : 0);
+    bus_write(gb, PPU_REG_BGP, 0xe4);
+    bus_write(gb, PPU_REG_OBP0, 0xe4);
+    bus_write(gb, PPU_REG_OBP1, 0x1b);
+    ppu->scx = 3;
+    ppu->scy = 5;
+    ppu->ly = 64;
+    ppu->wy = 0;
+    ppu->wx = (c->window == 2) ? 7 : 87;
+    ppu->window_in_frame = c->window != 0;
+    ppu->window_line_cnt = 64;
+    // spread over the line, from the left, overlapping a little
+    ppu->oam_entry_cnt = c->sprites;
+    for (int i = 0; i < c->sprites; i++) {
+        ppu->oam_entry[i].y = ppu->ly + 16 - (i % 8);
+        ppu->oam_entry[i].x = 8 + i * 15;
+        ppu->oam_entry[i].tile_index = i * 2;
+        ppu->oam_entry[i].attributes.val = ((i & 3) << 5) | ((i & 4) << 2);
+    }
+}
+
+static void ppu_run(struct gb *gb, const struct mcase *c, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        ppu_draw_scanline(gb);
+}
+
+/* generate_sample */
+
+static void apu_setup(struct gb *gb, const struct mcase *c)
+{
+    struct apu_channel *chans[4] = { &gb->apu.sqr1, &gb->apu.sqr2, &gb->apu.wave, &gb->apu.noise };
+
+    gb->apu.master_volume_left = gb->apu.master_volume_right = 7;
+    for (int i = 0; i < 4; i++) {
+        struct apu_channel *chan = chans[i];
+
+        chan->is_active = c->channels & (1 << i);
+        chan->left_output = chan->right_output = true;
+        chan->regs.nrx0 = 0x80;
+        chan->regs.nrx2 = 0xf0;
+        chan->volume = 15;
+        chan->output = (chan->name == WAVE) ? 9 : 1;
+    }
+}
+
+static void apu_run(struct gb *gb, const struct mcase *c, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        generate_sample(gb);
+}
+
+static struct mcase *add_case(const char *function, void (*setup)(struct gb *, const struct mcase *),
+                              void (*run)(struct gb *, const struct mcase *, uint64_t))
+{
+    struct mcase *c = &cases[case_cnt++];
+
+    c->function = function;
+    c->setup = setup;
+    c->run = run;
+    return c;
+}
+
+static void build_cases(void)
+{
+    static const int sprite_counts[] = { 0, 1, 5, 10 };
+    static const char *windows[] = { "", "+win_half", "+win_full" };
+    struct mcase *c;
+
+    for (size_t i = 0; i < sizeof(read_regions) / sizeof(read_regions[0]); i++) {
+        c = add_case("bus_read", NULL, bus_read_run);
+        snprintf(c->name, sizeof(c->name), "%s", read_regions[i].name);
+        c->addr = read_regions[i].addr;
+        c->mask = read_regions[i].mask;
+    }
+    for (size_t i = 0; i < sizeof(write_regions) / sizeof(write_regions[0]); i++) {
+        c = add_case("bus_write", NULL, bus_write_run);
+        snprintf(c->name, sizeof(c->name), "%s", write_regions[i].name);
+        c->addr = write_regions[i].addr;
+        c->mask = write_regions[i].mask;
+    }
+    c = add_case("bus_write", NULL, bus_write_mbc_run);
+    snprintf(c->name, sizeof(c->name), "mbc_bank");
+    c->addr = 0x2000;
+
+    for (int w = 0; w < 3; w++) {
+        for (size_t s = 0; s < sizeof(sprite_counts) / sizeof(sprite_counts[0]); s++) {
+            for (int tall = 0; tall <= (sprite_counts[s] != 0); tall++) {
+                c = add_case("ppu_draw_scanline", ppu_setup, ppu_run);
+                snprintf(c->name, sizeof(c->name), "obj%d%s%s", sprite_counts[s],
+                         (tall) ? "x16" : "", windows[w]);
+                c->sprites = sprite_counts[s];
+                c->tall = tall;
+                c->window = w;
+            }
+        }
+    }
+
+    for (int mask = 0; mask < 16; mask++) {
+        c = add_case("generate_sample", apu_setup, apu_run);
+        snprintf(c->name, sizeof(c->name), "ch%s%s%s%s%s", (mask) ? "" : "-",
+                 (mask & 1) ? "1" : "", (mask & 2) ? "2" : "", (mask & 4) ? "3" : "", (mask & 8) ? "4" : "");
+        c->channels = mask;
+    }
+}
+
+static void measure(struct gb *gb, const struct mcase *c, double min_ns, struct result *res)
+{
+    uint64_t n = 1024, cycles;
+    double start;
+
+    if (c->setup)
+        c->setup(gb, c);
+    c->run(gb, c, n);           // warm up
+    for (;;) {
+        start = now_ns();
+        cycles = now_cycles();
+        c->run(gb, c, n);
+        cycles = now_cycles() - cycles;
+        res->ns = now_ns() - start;
+        if (res->ns >= min_ns || n >= (1ULL << 40))
+            break;
+        n *= 2;
+    }
+    res->c = c;
+    res->ops = n;
+    res->cycles = (double)cycles / n;
+    res->ns /= n;
+}
+
+static bool selected(const struct mcase *c, int argc, char *argv[])
+{
+    if (!argc)
+        return true;
+    for (int i = 0; i < argc; i++)
+        if (!strncmp(c->function, argv[i], strlen(argv[i])) || !strncmp(c->name, argv[i], strlen(argv[i])))
+            return true;
+    return false;
+}
+
+static void print_text(const struct result *res, int cnt)
+{
+    printf("%-18s %-20s %10s %10s\n", "function", "case", "ns/op", "cycles/op");
+    for (int i = 0; i < cnt; i++) {
+        printf("%-18s %-20s %10.2f ", res[i].c->function, res[i].c->name, res[i].ns);
+#ifdef HAVE_TSC
+        printf("%10.1f\n", res[i].cycles);
+#else
+        printf("%10s\n", "-");
+#endif
+    }
+}
+
+static void print_json(const struct result *res, int cnt)
+{
+    printf("{\n  \"cases\": [\n");
+    for (int i = 0; i < cnt; i++) {
+        printf("    {\"function\": \"%s\", \"case\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.4f",
+               res[i].c->function, res[i].c->name, (unsigned long long)res[i].ops, res[i].ns);
+#ifdef HAVE_TSC
+        printf(", \"cycles_per_op\": %.3f", res[i].cycles);
+#endif
+        printf("}%s\n", (i + 1 < cnt) ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: gbda-microbench [-j] [-t ms] [function | case]...\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct result res[MAX_CASES];
+    double min_ns = 50e6;
+    bool json = false;
+    int opt, cnt = 0;
+    struct gb *gb;
+
+    while ((opt = getopt(argc, argv, "jt:")) != -1) {
+        switch (opt) {
+        case 'j':
+            json = true;
+            break;
+        case 't':
+            min_ns = atof(optarg) * 1e6;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (min_ns <= 0)
+        usage();
+
+    build_cases();
+    for (int i = 0; i < case_cnt; i++) {
+        if (!selected(&cases[i], argc - optind, argv + optind))
+            continue;
+        // a fresh instance each time, so no case sees another's state
+        if (!(gb = gb_create())) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        load_cartridge(gb);
+        measure(gb, &cases[i], min_ns, &res[cnt++]);
+        gb_destroy(gb);
+    }
+    if (json)
+        print_json(res, cnt);
+    else
+        print_text(res, cnt);
+    return 0;
+}
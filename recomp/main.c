@@ -0,0 +1,511 @@
+#include "gb.h"
+#include "sm83.h"
+#include <stdarg.h>
+
+/*
+ * gbda-recomp: ahead-of-time SM83 to C compiler.
+ *
+ * Code is discovered by walking the cartridge from the entry point, the RST
+ * and interrupt vectors and any -e address given on the command line,
+ * following jumps, calls and the word tables behind RSTs that dispatch
+ * through JP (HL). Every discovered address becomes a C function that runs
+ * instructions until the next branch, retiring each one with sm83_retire() so
+ * timing and interrupts behave exactly as in the interpreter. Like a cached
+ * block, the function returns to the interpreter as soon as a bank switch
+ * flushes the block cache, since its own bank may have been switched out. Instructions
+ * without a specialised translation are handed back to sm83_step().
+ *
+ * The output registers itself with the core (see core/recomp.c), which uses
+ * it whenever a cartridge with the same header checksums is loaded. A
+ * switchable-bank address reached from bank 0 is compiled in every
+ * switchable bank, since the bank mapped there is only known at run time.
+ * Anything that was not discovered, such as code only reached through a
+ * computed jump, keeps running in the interpreter.
+ */
+
+#define ROM_BANK_SIZE       0x4000
+#define MAX_BLOCK_INSTRS    64
+#define MAX_TABLE_ENTRIES   128
+#define MAX_ENTRIES         256
+
+struct rom {
+    uint8_t *data;
+    uint32_t size;
+    uint8_t *leader;    // per ROM offset: set once queued
+    uint32_t *work;
+    int work_cnt;
+};
+
+static const char *r8[8] = {
+    "gb->cpu.bc.b", "gb->cpu.bc.c", "gb->cpu.de.d", "gb->cpu.de.e",
+    "gb->cpu.hl.h", "gb->cpu.hl.l", NULL, "gb->cpu.af.a",
+};
+
+static const char *r16[4] = {
+    "gb->cpu.bc.val", "gb->cpu.de.val", "gb->cpu.hl.val", "gb->cpu.sp",
+};
+
+static const char *r16_stack[4] = {
+    "gb->cpu.bc.val", "gb->cpu.de.val", "gb->cpu.hl.val", "sm83_get_af(gb)",
+};
+
+static const char *cond[4] = {
+    "!sm83_flag_z(gb)", "sm83_flag_z(gb)", "!sm83_flag_c(gb)", "sm83_flag_c(gb)",
+};
+
+static uint32_t rom_offset(int bank, uint16_t addr)
+{
+    return (addr < ROM_BANK_SIZE) ? addr : bank * ROM_BANK_SIZE + (addr - ROM_BANK_SIZE);
+}
+
+static uint8_t rom_byte(struct rom *rom, int bank, uint16_t addr)
+{
+    uint32_t offset = rom_offset(bank, addr);
+
+    return (offset < rom->size) ? rom->data[offset] : 0xff;
+}
+
+/* End of the ROM region holding addr: an instruction never crosses it */
+static uint32_t region_end(uint16_t addr)
+{
+    return (addr < ROM_BANK_SIZE) ? ROM_BANK_SIZE : 2 * ROM_BANK_SIZE;
+}
+
+static void add_offset(struct rom *rom, uint32_t offset)
+{
+    if (offset >= rom->size || rom->leader[offset])
+        return;
+    rom->leader[offset] = 1;
+    rom->work[rom->work_cnt++] = offset;
+}
+
+/* Queue (bank, addr) for compilation. Which bank a switchable-bank target
+   reached from bank 0 lands in is only known at run time, so it is queued
+   in every switchable bank. */
+static void add_leader(struct rom *rom, int from_bank, uint16_t addr)
+{
+    if (addr >= 2 * ROM_BANK_SIZE)
+        return;
+    if (addr < ROM_BANK_SIZE)
+        add_offset(rom, addr);
+    else if (from_bank)
+        add_offset(rom, rom_offset(from_bank, addr));
+    else
+        for (uint32_t bank = 1; bank * ROM_BANK_SIZE < rom->size; bank++)
+            add_offset(rom, rom_offset(bank, addr));
+}
+
+static int offset_bank(uint32_t offset)
+{
+    return (offset < ROM_BANK_SIZE) ? 0 : offset / ROM_BANK_SIZE;
+}
+
+static uint16_t offset_addr(uint32_t offset)
+{
+    return (offset < ROM_BANK_SIZE) ? offset : ROM_BANK_SIZE + offset % ROM_BANK_SIZE;
+}
+
+/* True if the code at a bank 0 address dispatches through JP (HL) before
+   returning or jumping away, following at most one JP nn */
+static bool dispatches_through_hl(struct rom *rom, uint16_t addr)
+{
+    bool followed = false;
+
+    for (int i = 0; i < 32 && addr < ROM_BANK_SIZE; i++) {
+        uint8_t op = rom_byte(rom, 0, addr);
+
+        if (op == 0xe9)
+            return true;
+        if (op == 0xc3 && !followed) {
+            addr = TO_U16(rom_byte(rom, 0, addr + 1), rom_byte(rom, 0, addr + 2));
+            followed = true;
+            continue;
+        }
+        if (op == 0xc3 || op == 0xc9 || op == 0xd9 || op == 0x18)
+            return false;
+        addr += instr_length[op];
+    }
+    return false;
+}
+
+/* Instructions left to the interpreter: HALT, STOP, the rarely used SP
+   loads and the unused opcodes */
+static bool is_fallback(uint8_t op)
+{
+    switch (op) {
+    case 0x08: case 0x10: case 0x76: case 0xf8:
+    case 0xd3: case 0xdb: case 0xdd: case 0xe3: case 0xe4: case 0xeb:
+    case 0xec: case 0xed: case 0xf4: case 0xfc: case 0xfd:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Walk the code reachable from offset and queue every branch target */
+static void discover_block(struct rom *rom, uint32_t offset, const bool *table_rst)
+{
+    int bank = offset_bank(offset);
+    uint16_t addr = offset_addr(offset), target;
+    uint8_t op, len;
+
+    for (int n = 0; n < MAX_BLOCK_INSTRS; n++) {
+        op = rom_byte(rom, bank, addr);
+        len = instr_length[op];
+        if (addr + len > region_end(addr))
+            return;
+        target = (len == 3) ? TO_U16(rom_byte(rom, bank, addr + 1), rom_byte(rom, bank, addr + 2)) : 0;
+        switch (op) {
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+            add_leader(rom, bank, addr + 2 + (int8_t)rom_byte(rom, bank, addr + 1));
+            if (op != 0x18)
+                add_leader(rom, bank, addr + 2);
+            return;
+        case 0xc2: case 0xca: case 0xd2: case 0xda:
+        case 0xc4: case 0xcc: case 0xd4: case 0xdc: case 0xcd:
+            add_leader(rom, bank, target);
+            add_leader(rom, bank, addr + 3);
+            return;
+        case 0xc3:
+            add_leader(rom, bank, target);
+            return;
+        case 0xc0: case 0xc8: case 0xd0: case 0xd8:
+            add_leader(rom, bank, addr + 1);
+            return;
+        case 0xc7: case 0xcf: case 0xd7: case 0xdf:
+        case 0xe7: case 0xef: case 0xf7: case 0xff:
+            if (!table_rst[(op >> 3) & 7]) {
+                add_leader(rom, bank, addr + 1);
+                return;
+            }
+            for (int i = 0; i < MAX_TABLE_ENTRIES; i++) {
+                uint16_t entry = addr + 1 + i * 2;
+
+                if (entry + 2 > region_end(addr))
+                    break;
+                target = TO_U16(rom_byte(rom, bank, entry), rom_byte(rom, bank, entry + 1));
+                if (target < 0x0150 || target >= 2 * ROM_BANK_SIZE)
+                    break;
+                add_leader(rom, bank, target);
+            }
+            return;
+        case 0xc9: case 0xd9: case 0xe9:
+            return;
+        }
+        if (is_fallback(op)) {
+            add_leader(rom, bank, addr + len);
+            return;
+        }
+        addr += len;
+    }
+    add_leader(rom, bank, addr);
+}
+
+static void out(FILE *f, const char *fmt, ...)
+{
+    va_list args;
+
+    fprintf(f, "    ");
+    va_start(args, fmt);
+    vfprintf(f, fmt, args);
+    va_end(args);
+    fprintf(f, "\n");
+}
+
+static void emit_logic(FILE *f, const char *op, const char *src, int h)
+{
+    out(f, "gb->cpu.af.a %s= %s;", op, src);
+    out(f, "sm83_flags_logic(gb, %d);", h);
+}
+
+static void emit_alu(FILE *f, int y, const char *src)
+{
+    switch (y) {
+    case 0: out(f, "add(gb, %s, 0);", src);                     break;
+    case 1: out(f, "add(gb, %s, sm83_flag_c(gb));", src);       break;
+    case 2: out(f, "sub(gb, %s, 0);", src);                     break;
+    case 3: out(f, "sub(gb, %s, sm83_flag_c(gb));", src);       break;
+    case 4: emit_logic(f, "&", src, 1);                         break;
+    case 5: emit_logic(f, "^", src, 0);                         break;
+    case 6: emit_logic(f, "|", src, 0);                         break;
+    case 7: out(f, "cp(gb, %s);", src);                         break;
+    }
+}
+
+enum emit_result {
+    EMIT_RETIRE,        // needs RETIRE() with the opcode's cycle count
+    EMIT_RETIRED,       // retired itself, the block goes on
+    EMIT_END,           // returned, the block ends here
+};
+
+/* Emit the body of one instruction. pc already points past it. */
+static enum emit_result emit_instr(FILE *f, uint8_t op, uint16_t operand, uint16_t next)
+{
+    uint8_t x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+    int cycles = instr_cycle[op];
+    char src[64];
+
+    if (x == 1) {
+        if (y == 6)
+            out(f, "bus_write(gb, gb->cpu.hl.val, %s);", r8[z]);
+        else if (z == 6)
+            out(f, "%s = bus_read(gb, gb->cpu.hl.val);", r8[y]);
+        else
+            out(f, "%s = %s;", r8[y], r8[z]);
+        return EMIT_RETIRE;
+    }
+    if (x == 2 || (x == 3 && z == 6)) {
+        if (x == 3)
+            snprintf(src, sizeof(src), "0x%02x", operand);
+        else
+            snprintf(src, sizeof(src), "%s", (z == 6) ? "bus_read(gb, gb->cpu.hl.val)" : r8[z]);
+        emit_alu(f, y, src);
+        return EMIT_RETIRE;
+    }
+    if (x == 0 && z == 6) {
+        if (y == 6)
+            out(f, "bus_write(gb, gb->cpu.hl.val, 0x%02x);", operand);
+        else
+            out(f, "%s = 0x%02x;", r8[y], operand);
+        return EMIT_RETIRE;
+    }
+    if (x == 0 && (z == 4 || z == 5)) {
+        if (y == 6)
+            out(f, "%s_indirect_hl(gb);", (z == 4) ? "inc" : "dec");
+        else
+            out(f, "%s_r(gb, &%s);", (z == 4) ? "inc" : "dec", r8[y]);
+        return EMIT_RETIRE;
+    }
+    if (x == 0 && z == 1) {
+        if (y & 1)
+            out(f, "add_hl_rr(gb, %s);", r16[y >> 1]);
+        else
+            out(f, "%s = 0x%04x;", r16[y >> 1], operand);
+        return EMIT_RETIRE;
+    }
+    if (x == 0 && z == 3) {
+        out(f, "%s%s;", r16[y >> 1], (y & 1) ? "--" : "++");
+        return EMIT_RETIRE;
+    }
+    if (x == 3 && z == 5 && !(y & 1)) {
+        out(f, "sm83_push_word(gb, %s);", r16_stack[y >> 1]);
+        return EMIT_RETIRE;
+    }
+    if (x == 3 && z == 1 && !(y & 1)) {
+        if (op == 0xf1)
+            out(f, "sm83_set_af(gb, sm83_pop_word(gb));");
+        else
+            out(f, "%s = sm83_pop_word(gb);", r16_stack[y >> 1]);
+        return EMIT_RETIRE;
+    }
+
+    switch (op) {
+    case 0x00:                                                                          return EMIT_RETIRE;
+    case 0x02: out(f, "bus_write(gb, gb->cpu.bc.val, gb->cpu.af.a);");                  return EMIT_RETIRE;
+    case 0x12: out(f, "bus_write(gb, gb->cpu.de.val, gb->cpu.af.a);");                  return EMIT_RETIRE;
+    case 0x22: out(f, "bus_write(gb, gb->cpu.hl.val++, gb->cpu.af.a);");                return EMIT_RETIRE;
+    case 0x32: out(f, "bus_write(gb, gb->cpu.hl.val--, gb->cpu.af.a);");                return EMIT_RETIRE;
+    case 0x0a: out(f, "gb->cpu.af.a = bus_read(gb, gb->cpu.bc.val);");                  return EMIT_RETIRE;
+    case 0x1a: out(f, "gb->cpu.af.a = bus_read(gb, gb->cpu.de.val);");                  return EMIT_RETIRE;
+    case 0x2a: out(f, "gb->cpu.af.a = bus_read(gb, gb->cpu.hl.val++);");                return EMIT_RETIRE;
+    case 0x3a: out(f, "gb->cpu.af.a = bus_read(gb, gb->cpu.hl.val--);");                return EMIT_RETIRE;
+    case 0x07: out(f, "rlca(gb);");                                                     return EMIT_RETIRE;
+    case 0x0f: out(f, "rrca(gb);");                                                     return EMIT_RETIRE;
+    case 0x17: out(f, "rla(gb);");                                                      return EMIT_RETIRE;
+    case 0x1f: out(f, "rra(gb);");                                                      return EMIT_RETIRE;
+    case 0x27: out(f, "daa(gb);");                                                      return EMIT_RETIRE;
+    case 0x2f: out(f, "cpl(gb);");                                                      return EMIT_RETIRE;
+    case 0x37: out(f, "scf(gb);");                                                      return EMIT_RETIRE;
+    case 0x3f: out(f, "ccf(gb);");                                                      return EMIT_RETIRE;
+    case 0xe0: out(f, "io_write(gb, 0xff%02x, gb->cpu.af.a);", operand);                return EMIT_RETIRE;
+    case 0xf0: out(f, "gb->cpu.af.a = io_read(gb, 0xff%02x);", operand);                return EMIT_RETIRE;
+    case 0xe2: out(f, "io_write(gb, 0xff00 + gb->cpu.bc.c, gb->cpu.af.a);");            return EMIT_RETIRE;
+    case 0xf2: out(f, "gb->cpu.af.a = io_read(gb, 0xff00 + gb->cpu.bc.c);");            return EMIT_RETIRE;
+    case 0xea: out(f, "bus_write(gb, 0x%04x, gb->cpu.af.a);", operand);                 return EMIT_RETIRE;
+    case 0xfa: out(f, "gb->cpu.af.a = bus_read(gb, 0x%04x);", operand);                 return EMIT_RETIRE;
+    case 0xe8: out(f, "add_sp_i8(gb, 0x%02x);", operand);                               return EMIT_RETIRE;
+    case 0xf9: out(f, "gb->cpu.sp = gb->cpu.hl.val;");                                  return EMIT_RETIRE;
+    case 0xf3: out(f, "di(gb);");                                                       return EMIT_RETIRE;
+    case 0xfb: out(f, "ei(gb);");                                                       return EMIT_RETIRE;
+    case 0xcb:
+        out(f, "RETIRE(execute_cb_instructions(gb, 0x%02x), 0x%04x);", operand, next);
+        return EMIT_RETIRED;
+    case 0x18:
+        out(f, "return sm83_retire(gb, %d + jp(gb, gb->cpu.pc, 0x%02x, 1));", cycles, operand);
+        return EMIT_END;
+    case 0x20: case 0x28: case 0x30: case 0x38:
+        out(f, "return sm83_retire(gb, %d + jp(gb, gb->cpu.pc, 0x%02x, %s));", cycles, operand, cond[y - 4]);
+        return EMIT_END;
+    case 0xc3:
+        out(f, "return sm83_retire(gb, %d + jp(gb, 0x%04x, 0, 1));", cycles, operand);
+        return EMIT_END;
+    case 0xc2: case 0xca: case 0xd2: case 0xda:
+        out(f, "return sm83_retire(gb, %d + jp(gb, 0x%04x, 0, %s));", cycles, operand, cond[y]);
+        return EMIT_END;
+    case 0xcd:
+        out(f, "return sm83_retire(gb, %d + call(gb, 0x%04x, 1));", cycles, operand);
+        return EMIT_END;
+    case 0xc4: case 0xcc: case 0xd4: case 0xdc:
+        out(f, "return sm83_retire(gb, %d + call(gb, 0x%04x, %s));", cycles, operand, cond[y]);
+        return EMIT_END;
+    case 0xc9:
+        out(f, "return sm83_retire(gb, %d + ret(gb, 0xc9, 1));", cycles);
+        return EMIT_END;
+    case 0xc0: case 0xc8: case 0xd0: case 0xd8:
+        out(f, "return sm83_retire(gb, %d + ret(gb, 0x%02x, %s));", cycles, op, cond[y]);
+        return EMIT_END;
+    case 0xd9:
+        out(f, "return sm83_retire(gb, %d + reti(gb));", cycles);
+        return EMIT_END;
+    case 0xc7: case 0xcf: case 0xd7: case 0xdf:
+    case 0xe7: case 0xef: case 0xf7: case 0xff:
+        out(f, "rst_n(gb, 0x%02x);", y * 8);
+        out(f, "return sm83_retire(gb, %d);", cycles);
+        return EMIT_END;
+    case 0xe9:
+        out(f, "gb->cpu.pc = gb->cpu.hl.val;");
+        out(f, "return sm83_retire(gb, %d);", cycles);
+        return EMIT_END;
+    }
+    return EMIT_RETIRE;
+}
+
+static void emit_block(FILE *f, struct rom *rom, uint32_t offset)
+{
+    int bank = offset_bank(offset);
+    uint16_t addr = offset_addr(offset), next, operand;
+    enum emit_result result = EMIT_RETIRE;
+    uint8_t op, len;
+
+    fprintf(f, "static bool rc_%06x(struct gb *gb)\n{\n", offset);
+    for (int n = 0; n < MAX_BLOCK_INSTRS; n++) {
+        op = rom_byte(rom, bank, addr);
+        len = instr_length[op];
+        if (addr + len > region_end(addr))
+            break;
+        next = addr + len;
+        operand = (len == 3) ? TO_U16(rom_byte(rom, bank, addr + 1), rom_byte(rom, bank, addr + 2))
+                : (len == 2) ? rom_byte(rom, bank, addr + 1) : 0;
+        fprintf(f, "    // %04x: %02x\n", addr, op);
+        if (is_fallback(op)) {
+            out(f, "gb->cpu.pc = 0x%04x;", addr);
+            out(f, "return sm83_step_retire(gb);");
+            result = EMIT_END;
+            break;
+        }
+        out(f, "gb->cpu.pc = 0x%04x;", next);
+        result = emit_instr(f, op, operand, next);
+        if (result == EMIT_RETIRE)
+            out(f, "RETIRE(%d, 0x%04x);", instr_cycle[op], next);
+        else if (result == EMIT_END)
+            break;
+        addr = next;
+    }
+    if (result != EMIT_END)
+        out(f, "return false;");
+    fprintf(f, "}\n\n");
+}
+
+static uint8_t *read_file(const char *path, uint32_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t *buf;
+    long len;
+
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(len);
+    if (buf && fread(buf, 1, len, f) != (size_t)len) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *size = len;
+    return buf;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: gbda-recomp [-e bank:addr]... rom.gb out.c\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct rom rom = {0};
+    bool table_rst[8] = {0};
+    unsigned int entries[MAX_ENTRIES][2];
+    int opt, entry_cnt = 0, blocks = 0;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "e:")) != -1) {
+        if (opt != 'e' || entry_cnt == MAX_ENTRIES ||
+            sscanf(optarg, "%x:%x", &entries[entry_cnt][0], &entries[entry_cnt][1]) != 2)
+            usage();
+        entry_cnt++;
+    }
+    if (argc - optind != 2)
+        usage();
+    rom.data = read_file(argv[optind], &rom.size);
+    if (!rom.data || rom.size < 0x150) {
+        fprintf(stderr, "cannot read ROM %s\n", argv[optind]);
+        return 1;
+    }
+    rom.leader = calloc(rom.size, 1);
+    rom.work = malloc(rom.size * sizeof(*rom.work));
+
+    // entry point, RST and interrupt vectors, then user supplied entries
+    add_leader(&rom, 0, 0x0100);
+    for (int i = 0; i < 8; i++) {
+        table_rst[i] = dispatches_through_hl(&rom, i * 8);
+        add_leader(&rom, 0, i * 8);
+    }
+    for (int i = 0x40; i <= 0x60; i += 8)
+        add_leader(&rom, 0, i);
+    for (int i = 0; i < entry_cnt; i++)
+        add_leader(&rom, entries[i][0], entries[i][1]);
+
+    while (rom.work_cnt)
+        discover_block(&rom, rom.work[--rom.work_cnt], table_rst);
+
+    f = fopen(argv[optind + 1], "w");
+    if (!f) {
+        fprintf(stderr, "cannot write %s\n", argv[optind + 1]);
+        return 1;
+    }
+    fprintf(f, "/* Generated by gbda-recomp from %s, do not edit */\n\n", argv[optind]);
+    fprintf(f, "#include \"sm83.h\"\n\n");
+    fprintf(f, "#define RETIRE(cycles, next)    do {                                        \\\n"
+               "                                    if (sm83_retire(gb, cycles))            \\\n"
+               "                                        return true;                        \\\n"
+               "                                    if (gb->cpu.pc != (next) ||             \\\n"
+               "                                        gb->block_cache.flush)              \\\n"
+               "                                        return false;                       \\\n"
+               "                                } while (0)\n\n");
+    for (uint32_t i = 0; i < rom.size; i++) {
+        if (rom.leader[i]) {
+            emit_block(f, &rom, i);
+            blocks++;
+        }
+    }
+    fprintf(f, "static const struct recomp_block blocks[] = {\n");
+    for (uint32_t i = 0; i < rom.size; i++)
+        if (rom.leader[i])
+            fprintf(f, "    { 0x%06x, rc_%06x },\n", i, i);
+    fprintf(f, "};\n\n");
+    fprintf(f, "static struct recomp_rom rom = {\n"
+               "    .header_checksum = 0x%02x,\n"
+               "    .global_checksum = 0x%04x,\n"
+               "    .blocks = blocks,\n"
+               "    .count = %d,\n"
+               "};\n\n",
+            rom.data[0x14d], TO_U16(rom.data[0x14f], rom.data[0x14e]), blocks);
+    fprintf(f, "__attribute__((constructor)) static void register_rom(void)\n{\n"
+               "    recomp_register(&rom);\n}\n");
+    fclose(f);
+    printf("%s: %d blocks\n", argv[optind + 1], blocks);
+    return 0;
+}
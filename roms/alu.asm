@@ -0,0 +1,34 @@
+; A register-only arithmetic loop with the LCD on but showing nothing: the
+; interpreter's dispatch and ALU flag handling, and nothing else
+
+        include "hardware.inc"
+
+        title "GBDA ALU"
+        cart CART_ROM
+        ramsize RAM_NONE
+
+        include "vectors.inc"
+
+start:
+        di
+        ld sp,$fffe
+        ld a,LCDCF_ON
+        ldh (rLCDC),a
+.loop:
+        add b
+        adc c
+        sub d
+        xor e
+        or h
+        and l
+        inc b
+        dec c
+        ld b,a
+        inc de
+        inc hl
+        swap a
+        rla
+        inc a
+        sbc e
+        ld c,a
+        jr .loop
@@ -0,0 +1,86 @@
+; All four channels playing, their frequencies rewritten on every line and
+; every note retriggered every 8 lines, as a busy music driver would
+
+        include "hardware.inc"
+
+        title "GBDA AUDIO"
+        cart CART_ROM
+        ramsize RAM_NONE
+
+        include "vectors.inc"
+
+start:
+        di
+        ld sp,$fffe
+        ld a,$80
+        ldh (rNR52),a
+        ld a,$77
+        ldh (rNR50),a
+        ld a,$ff
+        ldh (rNR51),a
+
+        ld hl,wave
+        ld de,WAVE_RAM
+        ld b,16
+.wave:
+        ld a,(hl+)
+        ld (de),a
+        inc e
+        dec b
+        jr nz,.wave
+
+        ; every channel on, channel 1 with a frequency sweep
+        ld a,$15
+        ldh (rNR10),a
+        ld a,$80
+        ldh (rNR11),a
+        ld a,$f3
+        ldh (rNR12),a
+        ld a,$40
+        ldh (rNR21),a
+        ld a,$f1
+        ldh (rNR22),a
+        ld a,$80
+        ldh (rNR30),a
+        ld a,$20
+        ldh (rNR32),a
+        ld a,$f1
+        ldh (rNR42),a
+        ld a,$55
+        ldh (rNR43),a
+        call trigger
+main:
+        ldh a,(rLY)
+        ld b,a
+        add c
+        ldh (rNR13),a
+        ldh (rNR23),a
+        cpl
+        ldh (rNR33),a
+        ldh (rNR43),a
+        ld a,b
+        and 7
+        jr nz,.wait
+        call trigger
+        ld a,b
+        and a
+        jr nz,.wait
+        inc c
+.wait:
+        ldh a,(rLY)
+        cp b
+        jr z,.wait
+        jr main
+
+trigger:
+        ld a,$87
+        ldh (rNR14),a
+        ldh (rNR24),a
+        ldh (rNR34),a
+        ld a,$80
+        ldh (rNR44),a
+        ret
+
+wave:
+        db $5a, $4b, $78, $69, $1e, $0f, $3c, $2d
+        db $d2, $c3, $f0, $e1, $96, $87, $b4, $a5
@@ -0,0 +1,90 @@
+; MBC1 bank switching: every frame, each of banks 1 to 7 is mapped in turn
+; and a routine in it sums a 128-byte table of that bank, as a game that
+; keeps its level data and code spread over banks does
+
+        include "hardware.inc"
+
+        title "GBDA BANKS"
+        cart CART_MBC1
+        ramsize RAM_NONE
+
+        include "vectors.inc"
+
+SUMS    equ $c000           ; one byte per bank
+
+start:
+        di
+        ld sp,$fffe
+        ld a,LCDCF_ON
+        ldh (rLCDC),a
+main:
+        ld c,1
+.bank:
+        ld a,c
+        ld (MBC_ROM_BANK),a
+        call bank_sum       ; the same address in every bank
+        ld hl,SUMS
+        ld a,l
+        add c
+        ld l,a
+        ld (hl),e
+        inc c
+        ld a,c
+        cp 8
+        jr nz,.bank
+
+        ; and once per frame, after the last line
+.vblank:
+        ldh a,(rLY)
+        cp 144
+        jr nz,.vblank
+.line0:
+        ldh a,(rLY)
+        and a
+        jr nz,.line0
+        jr main
+
+bank_sum equ $4000
+
+
+        bank 1
+bank1_sum:
+        include "banksum.inc"
+        org $4180
+        ds 128, $20
+
+        bank 2
+bank2_sum:
+        include "banksum.inc"
+        org $4180
+        ds 128, $31
+
+        bank 3
+bank3_sum:
+        include "banksum.inc"
+        org $4180
+        ds 128, $42
+
+        bank 4
+bank4_sum:
+        include "banksum.inc"
+        org $4180
+        ds 128, $53
+
+        bank 5
+bank5_sum:
+        include "banksum.inc"
+        org $4180
+        ds 128, $64
+
+        bank 6
+bank6_sum:
+        include "banksum.inc"
+        org $4180
+        ds 128, $75
+
+        bank 7
+bank7_sum:
+        include "banksum.inc"
+        org $4180
+        ds 128, $86
@@ -0,0 +1,44 @@
+; A game that does its work in the VBlank handler and spends the rest of
+; every frame in HALT
+
+        include "hardware.inc"
+
+        title "GBDA HALT"
+        cart CART_ROM
+        ramsize RAM_NONE
+
+        include "vectors.inc"
+
+FRAMES  equ $c000
+
+        org $40
+        jp vblank
+        org $150
+
+start:
+        di
+        ld sp,$fffe
+        call fill_vram
+        ld a,LCDCF_ON | LCDCF_BG8000 | LCDCF_BGON
+        ldh (rLCDC),a
+        ld a,IEF_VBLANK
+        ldh (rIE),a
+        xor a
+        ldh (rIF),a
+        ei
+.loop:
+        halt
+        nop
+        jr .loop
+
+; count frames and scroll by the count
+vblank:
+        push af
+        ld a,(FRAMES)
+        inc a
+        ld (FRAMES),a
+        ldh (rSCX),a
+        pop af
+        reti
+
+        include "fillvram.inc"
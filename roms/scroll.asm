@@ -0,0 +1,50 @@
+; A fully tiled background with SCX and SCY rewritten on every line and the
+; first four rows of the tile map rewritten on every frame
+
+        include "hardware.inc"
+
+        title "GBDA SCROLL"
+        cart CART_ROM
+        ramsize RAM_NONE
+
+        include "vectors.inc"
+
+start:
+        di
+        ld sp,$fffe
+        call fill_vram
+        ld a,LCDCF_ON | LCDCF_BG8000 | LCDCF_BGON
+        ldh (rLCDC),a
+main:
+        ; SCX = LY + frame, SCY = half that
+        ldh a,(rLY)
+        ld b,a
+        add c
+        ldh (rSCX),a
+        srl a
+        ldh (rSCY),a
+.wait:
+        ldh a,(rLY)
+        cp b
+        jr z,.wait
+        ld a,b
+        cp 143
+        jr nz,main
+
+        ; VBlank: next frame, new tile map rows
+        inc c
+        ld a,c
+        ld hl,$9800
+        ld e,128
+.map:
+        ld (hl+),a
+        inc a
+        dec e
+        jr nz,.map
+.line0:
+        ldh a,(rLY)
+        and a
+        jr nz,.line0
+        jr main
+
+        include "fillvram.inc"
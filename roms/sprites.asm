@@ -0,0 +1,88 @@
+; 40 8x16 sprites in four rows of ten, so most lines drawn have ten on them,
+; moved one pixel right and copied to OAM by DMA on every frame
+
+        include "hardware.inc"
+
+        title "GBDA SPRITES"
+        cart CART_ROM
+        ramsize RAM_NONE
+
+        include "vectors.inc"
+
+OAM_BUFFER      equ $c000
+HRAM_DMA        equ $ff80
+
+start:
+        di
+        ld sp,$fffe
+
+        ; the DMA routine has to run from HRAM
+        ld hl,dma_routine
+        ld de,HRAM_DMA
+        ld b,dma_end - dma_routine
+.copy:
+        ld a,(hl+)
+        ld (de),a
+        inc e
+        dec b
+        jr nz,.copy
+
+        ; y = 16 + row * 36 + (i % 3), x = 8 + column * 16
+        ld hl,OAM_BUFFER
+        ld de,sprite_table
+        ld b,40 * 4
+.table:
+        ld a,(de)
+        ld (hl+),a
+        inc de
+        dec b
+        jr nz,.table
+
+        call fill_vram
+        ld a,LCDCF_ON | LCDCF_BG8000 | LCDCF_OBJ16 | LCDCF_OBJON | LCDCF_BGON
+        ldh (rLCDC),a
+main:
+        ldh a,(rLY)
+        cp 144
+        jr nz,main
+        ld hl,OAM_BUFFER + 1
+        ld b,40
+.move:
+        inc (hl)
+        inc l
+        inc l
+        inc l
+        inc l
+        dec b
+        jr nz,.move
+        ld a,high(OAM_BUFFER)
+        call HRAM_DMA
+.line0:
+        ldh a,(rLY)
+        and a
+        jr nz,.line0
+        jr main
+
+dma_routine:
+        ldh (rDMA),a
+        ld a,40
+.wait:
+        dec a
+        jr nz,.wait
+        ret
+dma_end:
+
+        include "fillvram.inc"
+
+; y, x, tile, attributes (flips and palette vary)
+sprite_table:
+        db  16,   8,   0, $00,   17,  24,   2, $20,   18,  40,   4, $40,   16,  56,   6, $60
+        db  17,  72,   8, $10,   18,  88,  10, $30,   16, 104,  12, $50,   17, 120,  14, $70
+        db  18, 136,  16, $00,   16, 152,  18, $20,   53,   8,  20, $40,   54,  24,  22, $60
+        db  52,  40,  24, $10,   53,  56,  26, $30,   54,  72,  28, $50,   52,  88,  30, $70
+        db  53, 104,  32, $00,   54, 120,  34, $20,   52, 136,  36, $40,   53, 152,  38, $60
+        db  90,   8,  40, $10,   88,  24,  42, $30,   89,  40,  44, $50,   90,  56,  46, $70
+        db  88,  72,  48, $00,   89,  88,  50, $20,   90, 104,  52, $40,   88, 120,  54, $60
+        db  89, 136,  56, $10,   90, 152,  58, $30,  124,   8,  60, $50,  125,  24,  62, $70
+        db 126,  40,  64, $00,  124,  56,  66, $20,  125,  72,  68, $40,  126,  88,  70, $60
+        db 124, 104,  72, $10,  125, 120,  74, $30,  126, 136,  76, $50,  124, 152,  78, $70
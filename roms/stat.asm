@@ -0,0 +1,92 @@
+; Raster effects from the STAT interrupt on an MBC3 cartridge: the HBlank
+; handler sets SCX for the next line from a wave table in ROM bank 1, while
+; the main loop counts through cartridge RAM
+
+        include "hardware.inc"
+
+        title "GBDA STAT"
+        cart CART_MBC3_RAM_BATTERY
+        ramsize RAM_8K
+
+        include "vectors.inc"
+
+PHASE   equ $ff80           ; advances once per frame
+
+        org $48
+        jp hblank
+        org $150
+
+start:
+        di
+        ld sp,$fffe
+        ld a,bank(wave)
+        ld (MBC_ROM_BANK),a
+        ld a,$0a
+        ld (MBC_RAM_ENABLE),a
+        xor a
+        ld (MBC_RAM_BANK),a
+        ldh (PHASE),a
+        call fill_vram
+        ld a,LCDCF_ON | LCDCF_BG8000 | LCDCF_BGON
+        ldh (rLCDC),a
+        ld a,STATF_MODE00
+        ldh (rSTAT),a
+        ld a,IEF_STAT
+        ldh (rIE),a
+        xor a
+        ldh (rIF),a
+        ei
+main:
+        ld hl,$a000
+.loop:
+        ld a,(hl)
+        inc a
+        ld (hl+),a
+        ld a,h
+        cp $c0
+        jr nz,.loop
+        jr main
+
+hblank:
+        push af
+        push hl
+        ldh a,(rLY)
+        and a
+        jr nz,.scroll
+        ldh a,(PHASE)
+        inc a
+        ldh (PHASE),a
+        xor a
+.scroll:
+        ld l,a
+        ldh a,(PHASE)
+        add l
+        ld l,a
+        ld h,high(wave)
+        ld a,(hl)
+        ldh (rSCX),a
+        pop hl
+        pop af
+        reti
+
+        include "fillvram.inc"
+
+        bank 1
+; 8 * sin(x), 256 entries
+wave:
+        db $00, $00, $00, $01, $01, $01, $01, $01, $02, $02, $02, $02, $02, $03, $03, $03
+        db $03, $03, $03, $04, $04, $04, $04, $04, $04, $05, $05, $05, $05, $05, $05, $06
+        db $06, $06, $06, $06, $06, $06, $06, $07, $07, $07, $07, $07, $07, $07, $07, $07
+        db $07, $07, $08, $08, $08, $08, $08, $08, $08, $08, $08, $08, $08, $08, $08, $08
+        db $08, $08, $08, $08, $08, $08, $08, $08, $08, $08, $08, $08, $08, $08, $08, $07
+        db $07, $07, $07, $07, $07, $07, $07, $07, $07, $07, $06, $06, $06, $06, $06, $06
+        db $06, $06, $05, $05, $05, $05, $05, $05, $04, $04, $04, $04, $04, $04, $03, $03
+        db $03, $03, $03, $03, $02, $02, $02, $02, $02, $01, $01, $01, $01, $01, $00, $00
+        db $00, $00, $00, $ff, $ff, $ff, $ff, $ff, $fe, $fe, $fe, $fe, $fe, $fd, $fd, $fd
+        db $fd, $fd, $fd, $fc, $fc, $fc, $fc, $fc, $fc, $fb, $fb, $fb, $fb, $fb, $fb, $fa
+        db $fa, $fa, $fa, $fa, $fa, $fa, $fa, $f9, $f9, $f9, $f9, $f9, $f9, $f9, $f9, $f9
+        db $f9, $f9, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8
+        db $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f8, $f9
+        db $f9, $f9, $f9, $f9, $f9, $f9, $f9, $f9, $f9, $f9, $fa, $fa, $fa, $fa, $fa, $fa
+        db $fa, $fa, $fb, $fb, $fb, $fb, $fb, $fb, $fc, $fc, $fc, $fc, $fc, $fc, $fd, $fd
+        db $fd, $fd, $fd, $fd, $fe, $fe, $fe, $fe, $fe, $ff, $ff, $ff, $ff, $ff, $00, $00